@@ -1,22 +1,50 @@
 // frag ppd
 #version 330 core
 
-// calculate the normal in geom shader and pass it here
+// the normal comes from the precomputed normal field
+// ambient occlusion and sun visibility from the precomputed shading field
 
-uniform sampler2D height_field;
+uniform sampler2D normal_field;
+uniform sampler2D shading_field;
 uniform vec3 light_position;
+uniform mat4 normal_matrix;
 
-in vec3 vertex_color;
-in vec3 vertex_normal;
 in vec3 vertex;
+in vec2 uv;
+in float v_nodata;
 
 out vec4 color;
 
+// octahedral encoding, see terrain::encode_octahedral
+vec3 decode_octahedral(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (n.z < 0.0)
+  {
+    n.xy = (1.0 - abs(n.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return normalize(n);
+}
+
 void main()
 {
+  // no surface next to a no data sample
+  if (v_nodata > 0.0)
+  {
+    discard;
+  }
+
   color = vec4(0.0, 0.0, 0.0, 1.0);
 
-  vec3 N = normalize (vertex_normal);
+  // vertex uvs run from the first to the last texel center
+  vec2 size = vec2(textureSize(normal_field, 0));
+  vec2 st = (uv * (size - 1.0) + 0.5) / size;
+  vec3 normal = decode_octahedral(texture(normal_field, st).xy);
+  vec2 shading = texture(shading_field, st).rg;
+  float ambient_occlusion = shading.r;
+  float sun_visibility = shading.g;
+
+  vec3 N = normalize((normal_matrix * vec4(normal, 0.0)).xyz);
   vec3 L = normalize (light_position - vertex);
   vec3 E = normalize(-vertex);
   vec3 R = reflect (-L, N);
@@ -28,11 +56,14 @@ void main()
   vec4 material_diffuse = vec4(1.0);
   vec4 material_specular = vec4(0.3);
   float material_shininess = 0.3;
+  vec4 light_ambient = vec4(0.2);
+
+  color += light_ambient * material_diffuse * ambient_occlusion;
 
   if(lambertTerm > 0.0)
   {
-    color += light_diffuse * material_diffuse * lambertTerm;
+    color += light_diffuse * material_diffuse * lambertTerm * sun_visibility;
     float specular = pow( max(dot(R, E), 0.0), material_shininess);
-    color += light_specular * material_specular * specular;
+    color += light_specular * material_specular * specular * sun_visibility;
   }
 }
@@ -5,9 +5,46 @@ layout(location = 0) in vec3 vertex_position_modelspace;
 layout(location = 1) in vec2 vertex_uv;
 
 uniform sampler2D height_field;
+uniform sampler2D height_field_tiles;
+uniform sampler2D height_field_float_tiles;
+
+// must match quantized_height_field::tile_size
+const int tile_size = 64;
+// must match quantized_height_field::float_atlas_columns
+const int float_atlas_columns = 32;
+
+// 16 bit sample scaled by the offset/scale of its tile, same texel as a nearest lookup
+// tiles over the error limit are vec2(slot, -1) and read the float atlas instead
+// the reserved code 65535 and NaN float samples are no data, they set nodata and give height 0
+float sample_height(vec2 uv, out float nodata)
+{
+  ivec2 size = textureSize(height_field, 0);
+  ivec2 pixel = min(ivec2(uv * vec2(size)), size - 1);
+  vec2 tile = texelFetch(height_field_tiles, pixel / tile_size, 0).xy;
+  if (tile.y < 0.0)
+  {
+    int slot = int(tile.x);
+    ivec2 atlas = ivec2(slot % float_atlas_columns, slot / float_atlas_columns) * tile_size + pixel % tile_size;
+    float h = texelFetch(height_field_float_tiles, atlas, 0).x;
+    nodata = isnan(h) ? 1.0 : 0.0;
+    return isnan(h) ? 0.0 : h;
+  }
+  float code = round(texelFetch(height_field, pixel, 0).x * 65535.0);
+  nodata = code == 65535.0 ? 1.0 : 0.0;
+  return code == 65535.0 ? 0.0 : tile.x + tile.y * code;
+}
+
+out shader_data
+{
+  vec2 uv;
+  float nodata;
+} vs_out;
 
 void main()
 {
-  float height = texture(height_field, vertex_uv).x;
+  float nodata;
+  float height = sample_height(vertex_uv, nodata);
+  vs_out.uv = vertex_uv;
+  vs_out.nodata = nodata;
   gl_Position = vec4(vertex_position_modelspace + vec3(0.0, 0.0, height), 1.0);
 }
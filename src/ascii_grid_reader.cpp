@@ -0,0 +1,494 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "mapped_file.h"
+#include "ascii_grid_reader.h"
+
+namespace terrain
+{
+namespace
+{
+// chunks are at least this large, then extended to the next line break
+const std::size_t chunk_bytes = 1 << 20;
+
+const double powers_of_ten[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+bool is_digit(const char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+bool is_space(const char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+bool is_separator(const char c)
+{
+  return is_space(c) || c == ',' || c == ';';
+}
+
+bool starts_number(const char c)
+{
+  return is_digit(c) || c == '-' || c == '+' || c == '.';
+}
+
+// parses the number at [p, end) up to the next separator and returns the position behind it, nullptr if it is not one
+// decimals with at most 19 significant digits and a power of ten within 22 are exact: both factors are exact doubles
+// and one multiplication or division rounds once (Clinger's fast path), everything else goes to strtod
+const char* parse_double(const char* p, const char* end, double& out)
+{
+  const char* begin = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    negative = *p == '-';
+    ++p;
+  }
+
+  std::uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  bool exact = true;
+  for (; p < end && is_digit(*p); ++p)
+  {
+    any = true;
+    if (digits < 19)
+    {
+      mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+      digits += mantissa != 0 ? 1 : 0;
+    }
+    else
+    {
+      exact = exact && *p == '0';
+      ++exponent;
+    }
+  }
+  if (p < end && *p == '.')
+  {
+    for (++p; p < end && is_digit(*p); ++p)
+    {
+      any = true;
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+        digits += mantissa != 0 ? 1 : 0;
+        --exponent;
+      }
+      else
+      {
+        exact = exact && *p == '0';
+      }
+    }
+  }
+  if (any && p < end && (*p == 'e' || *p == 'E'))
+  {
+    const char* e = p + 1;
+    bool negative_exponent = false;
+    if (e < end && (*e == '-' || *e == '+'))
+    {
+      negative_exponent = *e == '-';
+      ++e;
+    }
+    if (e < end && is_digit(*e))
+    {
+      int value = 0;
+      for (; e < end && is_digit(*e); ++e)
+      {
+        value = std::min(value * 10 + (*e - '0'), 100000);
+      }
+      exponent += negative_exponent ? -value : value;
+      p = e;
+    }
+  }
+
+  if (any && exact && (p == end || is_separator(*p)) && mantissa <= (std::uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+  {
+    const double m = static_cast<double>(mantissa);
+    const double value = exponent < 0 ? m / powers_of_ten[-exponent] : m * powers_of_ten[exponent];
+    out = negative ? -value : value;
+    return p;
+  }
+
+  // long, unusual or special (nan, inf) numbers
+  const char* token_end = begin;
+  while (token_end < end && !is_separator(*token_end))
+  {
+    ++token_end;
+  }
+  char buffer[128];
+  const std::size_t length = static_cast<std::size_t>(token_end - begin);
+  if (length == 0 || length >= sizeof(buffer))
+  {
+    return nullptr;
+  }
+  std::memcpy(buffer, begin, length);
+  buffer[length] = '\0';
+  char* parsed = nullptr;
+  out = std::strtod(buffer, &parsed);
+  return parsed == buffer + length ? token_end : nullptr;
+}
+
+const char* skip_spaces(const char* p, const char* end)
+{
+  while (p < end && is_space(*p))
+  {
+    ++p;
+  }
+  return p;
+}
+
+const char* skip_separators(const char* p, const char* end)
+{
+  while (p < end && is_separator(*p))
+  {
+    ++p;
+  }
+  return p;
+}
+
+const char* next_line(const char* p, const char* end)
+{
+  const char* newline = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+  return newline ? newline + 1 : end;
+}
+
+// [begin, end) cut into chunks that start at the beginning of a line
+std::vector<const char*> split_lines(const char* begin, const char* end)
+{
+  std::vector<const char*> bounds(1, begin);
+  while (static_cast<std::size_t>(end - bounds.back()) > chunk_bytes)
+  {
+    const char* next = next_line(bounds.back() + chunk_bytes, end);
+    if (next == end)
+    {
+      break;
+    }
+    bounds.push_back(next);
+  }
+  bounds.push_back(end);
+  return bounds;
+}
+
+std::string lower(std::string s)
+{
+  std::transform(s.begin(), s.end(), s.begin(), [](const char c) { return static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c); });
+  return s;
+}
+
+io::mapped_file::ptr map(const std::string& path)
+{
+  io::mapped_file::ptr file(new io::mapped_file(path, io::mapped_file::mode::read_only));
+  if (file->size() == 0)
+  {
+    throw std::runtime_error(std::string("empty elevation file: ") + path);
+  }
+  return file;
+}
+
+struct xyz_point
+{
+  double x;
+  double y;
+  float z;
+};
+
+// points of one chunk with their bounds and the smallest steps between consecutive points
+struct xyz_chunk
+{
+  xyz_chunk()
+    : min(std::numeric_limits<double>::max())
+    , max(-std::numeric_limits<double>::max())
+    , step(std::numeric_limits<double>::max())
+  { }
+
+  std::vector<xyz_point> points;
+  dvec2 min;
+  dvec2 max;
+  dvec2 step;
+};
+}
+
+height_field::ptr read_ascii_grid(const std::string& path, double* geo_transform, parallel::thread_pool& pool)
+{
+  const io::mapped_file::ptr file = map(path);
+  const char* p = file->data();
+  const char* const end = p + file->size();
+
+  // keyword value lines until the first line that starts with a number
+  unsigned columns = 0;
+  unsigned rows = 0;
+  dvec2 lower_left(0.0);
+  bool centered = false;
+  dvec2 cell(0.0);
+  bool has_nodata = false;
+  double nodata = 0.0;
+  for (p = skip_spaces(p, end); p < end && !starts_number(*p); p = skip_spaces(p, end))
+  {
+    const char* key_end = p;
+    while (key_end < end && !is_space(*key_end))
+    {
+      ++key_end;
+    }
+    const std::string key = lower(std::string(p, key_end));
+    double value = 0.0;
+    const char* value_end = parse_double(skip_spaces(key_end, next_line(p, end)), end, value);
+    if (!value_end)
+    {
+      throw std::runtime_error(std::string("invalid ascii grid header line '") + key + "': " + path);
+    }
+    p = value_end;
+
+    if (key == "ncols")
+    {
+      columns = static_cast<unsigned>(value);
+    }
+    else if (key == "nrows")
+    {
+      rows = static_cast<unsigned>(value);
+    }
+    else if (key == "xllcorner" || key == "xllcenter")
+    {
+      lower_left.x = value;
+      centered = key == "xllcenter";
+    }
+    else if (key == "yllcorner" || key == "yllcenter")
+    {
+      lower_left.y = value;
+      centered = key == "yllcenter";
+    }
+    else if (key == "cellsize")
+    {
+      cell = dvec2(value);
+    }
+    else if (key == "dx")
+    {
+      cell.x = value;
+    }
+    else if (key == "dy")
+    {
+      cell.y = value;
+    }
+    else if (key == "nodata_value")
+    {
+      has_nodata = true;
+      nodata = value;
+    }
+  }
+  if (columns == 0 || rows == 0 || !(cell.x > 0.0) || !(cell.y > 0.0))
+  {
+    throw std::runtime_error(std::string("incomplete ascii grid header: ") + path);
+  }
+
+  if (geo_transform)
+  {
+    const dvec2 corner(centered ? lower_left - cell * 0.5 : lower_left);
+    const double transform[6] = { corner.x, cell.x, 0.0, corner.y + rows * cell.y, 0.0, -cell.y };
+    std::copy(transform, transform + 6, geo_transform);
+  }
+
+  // the values need not be one row per line, so the chunks first count their values to know where they start
+  const std::vector<const char*> bounds = split_lines(p, end);
+  const unsigned chunk_count = static_cast<unsigned>(bounds.size() - 1);
+  std::vector<std::uint64_t> first(chunk_count + 1, 0);
+  pool.parallel_for(chunk_count, [&](const unsigned c)
+  {
+    std::uint64_t count = 0;
+    bool in_token = false;
+    for (const char* q = bounds[c]; q < bounds[c + 1]; ++q)
+    {
+      const bool token = !is_space(*q);
+      count += token && !in_token ? 1 : 0;
+      in_token = token;
+    }
+    first[c + 1] = count;
+  });
+  for (unsigned c = 0; c < chunk_count; ++c)
+  {
+    first[c + 1] += first[c];
+  }
+  if (first.back() != static_cast<std::uint64_t>(columns) * rows)
+  {
+    throw std::runtime_error(std::string("ascii grid value count does not match ncols * nrows: ") + path);
+  }
+
+  height_field::ptr heights(new height_field(uvec2(columns, rows), vec2(cell)));
+  pool.parallel_for(chunk_count, [&](const unsigned c)
+  {
+    unsigned x = static_cast<unsigned>(first[c] % columns);
+    unsigned y = static_cast<unsigned>(first[c] / columns);
+    if (y == rows)
+    {
+      return;
+    }
+    float* row = &(*heights)(uvec2(0, y));
+    for (const char* q = skip_spaces(bounds[c], bounds[c + 1]); q < bounds[c + 1]; q = skip_spaces(q, bounds[c + 1]))
+    {
+      double value = 0.0;
+      q = parse_double(q, bounds[c + 1], value);
+      if (!q)
+      {
+        throw std::runtime_error(std::string("invalid number in ascii grid: ") + path);
+      }
+      row[x] = has_nodata && value == nodata ? std::numeric_limits<float>::quiet_NaN() : static_cast<float>(value);
+      if (++x == columns && ++y < rows)
+      {
+        x = 0;
+        row = &(*heights)(uvec2(0, y));
+      }
+    }
+  });
+  return heights;
+}
+
+height_field::ptr read_xyz(const std::string& path, double* geo_transform, parallel::thread_pool& pool)
+{
+  const io::mapped_file::ptr file = map(path);
+  const char* begin = file->data();
+  const char* const end = begin + file->size();
+
+  const char* first_line = skip_spaces(begin, end);
+  if (first_line < end && !starts_number(*first_line))
+  {
+    begin = next_line(first_line, end);
+  }
+
+  const std::vector<const char*> bounds = split_lines(begin, end);
+  const unsigned chunk_count = static_cast<unsigned>(bounds.size() - 1);
+  std::vector<xyz_chunk> chunks(chunk_count);
+  pool.parallel_for(chunk_count, [&](const unsigned c)
+  {
+    xyz_chunk& chunk = chunks[c];
+    chunk.points.reserve(static_cast<std::size_t>(bounds[c + 1] - bounds[c]) / 16);
+    for (const char* line = bounds[c]; line < bounds[c + 1]; line = next_line(line, bounds[c + 1]))
+    {
+      const char* q = skip_spaces(line, bounds[c + 1]);
+      if (q == bounds[c + 1] || (q != line && q[-1] == '\n'))
+      {
+        continue;
+      }
+
+      // the values must all be on this line, the separators include the line break
+      const char* line_end = next_line(line, bounds[c + 1]);
+      double v[3];
+      for (unsigned i = 0; i < 3; ++i)
+      {
+        q = q ? parse_double(skip_separators(q, line_end), line_end, v[i]) : nullptr;
+      }
+      if (!q)
+      {
+        throw std::runtime_error(std::string("invalid xyz line: ") + std::string(line, line_end) + " in " + path);
+      }
+
+      xyz_point point;
+      point.x = v[0];
+      point.y = v[1];
+      point.z = static_cast<float>(v[2]);
+      if (!chunk.points.empty())
+      {
+        const dvec2 step(glm::abs(dvec2(point.x, point.y) - dvec2(chunk.points.back().x, chunk.points.back().y)));
+        chunk.step.x = step.x > 0.0 ? std::min(chunk.step.x, step.x) : chunk.step.x;
+        chunk.step.y = step.y > 0.0 ? std::min(chunk.step.y, step.y) : chunk.step.y;
+      }
+      chunk.min = glm::min(chunk.min, dvec2(point.x, point.y));
+      chunk.max = glm::max(chunk.max, dvec2(point.x, point.y));
+      chunk.points.push_back(point);
+    }
+  });
+
+  xyz_chunk all;
+  for (const xyz_chunk& chunk : chunks)
+  {
+    all.min = glm::min(all.min, chunk.min);
+    all.max = glm::max(all.max, chunk.max);
+    all.step = glm::min(all.step, chunk.step);
+  }
+  if (all.min.x > all.max.x)
+  {
+    throw std::runtime_error(std::string("no points in xyz file: ") + path);
+  }
+
+  // a single row or column takes the spacing of the other axis
+  const double no_step = std::numeric_limits<double>::max();
+  dvec2 cell(all.step);
+  cell.x = cell.x == no_step ? (cell.y == no_step ? 1.0 : cell.y) : cell.x;
+  cell.y = cell.y == no_step ? cell.x : cell.y;
+
+  const dvec2 extent(glm::floor((all.max - all.min) / cell + 0.5) + 1.0);
+  if (extent.x * extent.y > static_cast<double>(std::numeric_limits<std::int32_t>::max()))
+  {
+    throw std::runtime_error(std::string("xyz points do not form a regular grid: ") + path);
+  }
+  const uvec2 size(extent);
+
+  if (geo_transform)
+  {
+    const double transform[6] = { all.min.x - cell.x * 0.5, cell.x, 0.0, all.max.y + cell.y * 0.5, 0.0, -cell.y };
+    std::copy(transform, transform + 6, geo_transform);
+  }
+
+  // of duplicate points the last one in file order wins: every cell keeps the highest ordinal (file order + 1)
+  // of its points, 0 for none, then each point writes only the cells it won
+  std::vector<std::uint64_t> first_ordinal(chunk_count + 1, 1);
+  for (unsigned c = 0; c < chunk_count; ++c)
+  {
+    first_ordinal[c + 1] = first_ordinal[c] + chunks[c].points.size();
+  }
+  auto cell_of = [&](const xyz_point& point)
+  {
+    return glm::min(uvec2(
+      static_cast<unsigned>(std::floor((point.x - all.min.x) / cell.x + 0.5))
+      , static_cast<unsigned>(std::floor((all.max.y - point.y) / cell.y + 0.5))), size - 1u);
+  };
+
+  std::vector<std::atomic<std::uint64_t>> winners(static_cast<std::size_t>(size.x) * size.y);
+  pool.parallel_for(size.y, [&](const unsigned y)
+  {
+    for (std::size_t i = static_cast<std::size_t>(size.x) * y; i < static_cast<std::size_t>(size.x) * (y + 1); ++i)
+    {
+      winners[i].store(0, std::memory_order_relaxed);
+    }
+  });
+  pool.parallel_for(chunk_count, [&](const unsigned c)
+  {
+    for (std::size_t i = 0; i < chunks[c].points.size(); ++i)
+    {
+      const std::uint64_t ordinal = first_ordinal[c] + i;
+      const uvec2 pos(cell_of(chunks[c].points[i]));
+      std::atomic<std::uint64_t>& winner = winners[pos.x + static_cast<std::size_t>(size.x) * pos.y];
+      std::uint64_t current = winner.load(std::memory_order_relaxed);
+      while (current < ordinal && !winner.compare_exchange_weak(current, ordinal, std::memory_order_relaxed))
+      { }
+    }
+  });
+
+  height_field::ptr heights(new height_field(size, vec2(cell)));
+  pool.parallel_for(size.y, [&](const unsigned y)
+  {
+    float* row = &(*heights)(uvec2(0, y));
+    std::fill(row, row + size.x, std::numeric_limits<float>::quiet_NaN());
+  });
+  pool.parallel_for(chunk_count, [&](const unsigned c)
+  {
+    for (std::size_t i = 0; i < chunks[c].points.size(); ++i)
+    {
+      const uvec2 pos(cell_of(chunks[c].points[i]));
+      if (winners[pos.x + static_cast<std::size_t>(size.x) * pos.y].load(std::memory_order_relaxed) == first_ordinal[c] + i)
+      {
+        (*heights)(pos) = chunks[c].points[i].z;
+      }
+    }
+  });
+  return heights;
+}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+#include "types.h"
+#include "height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// text elevation formats, the file is mapped and cut into line aligned chunks that are parsed in parallel
+// numbers are parsed without locale or streams, short decimals (up to 19 digits, exponent within 22) are exact
+// in a fast path and anything else goes through strtod
+// geo_transform, if not null, receives the gdal style transform of the corner of the first pixel
+// the resolution of the height field is the cell size, like geotiff_reader
+
+  // ESRI ASCII grid: ncols, nrows, xllcorner or xllcenter, yllcorner or yllcenter, cellsize (or dx and dy),
+  // optional NODATA_value, then nrows * ncols values from the north row down, in any line layout
+  // nodata samples are read as NaN
+  height_field::ptr read_ascii_grid(const std::string& path, double* geo_transform = nullptr, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+  // x y z points of a regular grid, one per line, separated by spaces, tabs, commas or semicolons
+  // a first line that does not start with a number is taken as a column header and skipped
+  // the spacing is the smallest step between consecutive points, points may come in any order
+  // cells without a point are NaN, of duplicate points the last one in the file is kept
+  height_field::ptr read_xyz(const std::string& path, double* geo_transform = nullptr, parallel::thread_pool& pool = parallel::thread_pool::instance());
+}
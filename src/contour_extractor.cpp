@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+#include "contour_extractor.h"
+
+namespace terrain
+{
+namespace
+{
+const std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+// orders the pieces (anything with from and to edge ids) into chains where the to of one is the from of the next
+// calls emit(order, closed) per chain, open chains first, items must have unique from ids
+template<class T, class F>
+void link(std::vector<T>& items, const F& emit)
+{
+  std::sort(items.begin(), items.end(), [](const T& a, const T& b) { return a.from < b.from; });
+  std::vector<std::uint64_t> targets;
+  targets.reserve(items.size());
+  for (const T& item : items)
+  {
+    targets.push_back(item.to);
+  }
+  std::sort(targets.begin(), targets.end());
+
+  auto find = [&](const std::uint64_t from) -> std::size_t
+  {
+    const auto it = std::lower_bound(items.begin(), items.end(), from, [](const T& a, const std::uint64_t id) { return a.from < id; });
+    return it != items.end() && it->from == from ? static_cast<std::size_t>(it - items.begin()) : npos;
+  };
+
+  std::vector<bool> visited(items.size(), false);
+  std::vector<std::size_t> order;
+  auto walk = [&](const std::size_t first)
+  {
+    order.clear();
+    std::size_t i = first;
+    while (i != npos && !visited[i])
+    {
+      visited[i] = true;
+      order.push_back(i);
+      i = find(items[i].to);
+    }
+    emit(order, i == first);
+  };
+
+  // heads are the pieces nothing leads into
+  for (std::size_t i = 0; i < items.size(); ++i)
+  {
+    if (!std::binary_search(targets.begin(), targets.end(), items[i].from))
+    {
+      walk(i);
+    }
+  }
+  // the rest are loops
+  for (std::size_t i = 0; i < items.size(); ++i)
+  {
+    if (!visited[i])
+    {
+      walk(i);
+    }
+  }
+}
+}
+
+void contour_lines::add(const contour_polyline& polyline)
+{
+  const unsigned base = static_cast<unsigned>(vertices.size());
+  const unsigned count = static_cast<unsigned>(polyline.points.size());
+  vertices.insert(vertices.end(), polyline.points.begin(), polyline.points.end());
+  for (unsigned i = 1; i < count; ++i)
+  {
+    indices.push_back(base + i - 1);
+    indices.push_back(base + i);
+  }
+  if (polyline.closed && count > 2)
+  {
+    indices.push_back(base + count - 1);
+    indices.push_back(base);
+  }
+}
+
+contour_extractor::contour_extractor(const height_field& heights, std::vector<float> levels, const uvec2& tile_size)
+  : m_heights(heights)
+  , m_levels(std::move(levels))
+  , m_tile_size(glm::max(tile_size, uvec2(1)))
+{
+  std::sort(m_levels.begin(), m_levels.end());
+  m_levels.erase(std::unique(m_levels.begin(), m_levels.end()), m_levels.end());
+}
+
+std::vector<float> contour_extractor::even_levels(const float interval, const vec2& bounds)
+{
+  if (!(interval > 0.0f))
+  {
+    throw std::runtime_error(std::string("contour interval must be positive"));
+  }
+
+  std::vector<float> result;
+  const double first = std::ceil(static_cast<double>(bounds.x) / interval);
+  const double last = std::floor(static_cast<double>(bounds.y) / interval);
+  for (double k = first; k <= last; k += 1.0)
+  {
+    result.push_back(static_cast<float>(k * interval));
+  }
+  return result;
+}
+
+void contour_extractor::extract(const sink& out, parallel::thread_pool& pool) const
+{
+  const uvec2 size(m_heights.size());
+  if (size.x < 2 || size.y < 2 || m_levels.empty())
+  {
+    return;
+  }
+
+  std::mutex mutex;
+  const sink locked_out = [&](const contour_polyline& polyline)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    out(polyline);
+  };
+
+  std::vector<fragment> fragments;
+  parallel::for_each_tile(pool, size - 1u, m_tile_size, [&](const uvec2& begin, const uvec2& end)
+  {
+    std::vector<fragment> tile_fragments;
+    extract_tile(begin, end, locked_out, tile_fragments);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::move(tile_fragments.begin(), tile_fragments.end(), std::back_inserter(fragments));
+  });
+
+  stitch(fragments, out);
+}
+
+std::vector<contour_polyline> contour_extractor::extract(parallel::thread_pool& pool) const
+{
+  std::vector<contour_polyline> result;
+  extract([&](const contour_polyline& polyline) { result.push_back(polyline); }, pool);
+  return result;
+}
+
+contour_lines contour_extractor::extract_lines(parallel::thread_pool& pool) const
+{
+  contour_lines result;
+  extract([&](const contour_polyline& polyline) { result.add(polyline); }, pool);
+  return result;
+}
+
+void contour_extractor::extract_tile(const uvec2& begin, const uvec2& end, const sink& out, std::vector<fragment>& fragments) const
+{
+  std::vector<std::vector<segment>> segments(m_levels.size());
+
+  for (unsigned y = begin.y; y < end.y; ++y)
+  {
+    for (unsigned x = begin.x; x < end.x; ++x)
+    {
+      // corners counter clockwise, edge i runs from corner i to corner i + 1
+      const float h[4] = { m_heights(uvec2(x, y)), m_heights(uvec2(x + 1, y)), m_heights(uvec2(x + 1, y + 1)), m_heights(uvec2(x, y + 1)) };
+      if (std::isnan(h[0]) || std::isnan(h[1]) || std::isnan(h[2]) || std::isnan(h[3]))
+      {
+        continue;
+      }
+
+      // only the levels with corners on both sides cross the cell
+      const float low = std::min(std::min(h[0], h[1]), std::min(h[2], h[3]));
+      const float high = std::max(std::max(h[0], h[1]), std::max(h[2], h[3]));
+      const auto first = std::upper_bound(m_levels.begin(), m_levels.end(), low);
+      const auto last = std::upper_bound(first, m_levels.end(), high);
+      if (first == last)
+      {
+        continue;
+      }
+
+      const std::uint64_t e[4] = { edge_id(x, y, false), edge_id(x + 1, y, true), edge_id(x, y + 1, false), edge_id(x, y, true) };
+      for (auto it = first; it != last; ++it)
+      {
+        const float level = *it;
+        std::vector<segment>& out_segments = segments[static_cast<std::size_t>(it - m_levels.begin())];
+        const unsigned above = (h[0] >= level ? 1u : 0u) | (h[1] >= level ? 2u : 0u) | (h[2] >= level ? 4u : 0u) | (h[3] >= level ? 8u : 0u);
+
+        if (above == 5 || above == 10)
+        {
+          // saddle, the centre decides which diagonal pair is connected
+          const bool centre_above = (h[0] + h[1] + h[2] + h[3]) * 0.25f >= level;
+          if (above == 5)
+          {
+            out_segments.push_back(centre_above ? segment{ e[1], e[0] } : segment{ e[3], e[0] });
+            out_segments.push_back(centre_above ? segment{ e[3], e[2] } : segment{ e[1], e[2] });
+          }
+          else
+          {
+            out_segments.push_back(centre_above ? segment{ e[0], e[3] } : segment{ e[0], e[1] });
+            out_segments.push_back(centre_above ? segment{ e[2], e[1] } : segment{ e[2], e[3] });
+          }
+          continue;
+        }
+
+        // the line enters where the corners go from below to above and leaves where they go back
+        std::uint64_t from = 0;
+        std::uint64_t to = 0;
+        for (unsigned i = 0; i < 4; ++i)
+        {
+          const bool a = ((above >> i) & 1u) != 0;
+          const bool b = ((above >> ((i + 1) & 3u)) & 1u) != 0;
+          if (!a && b)
+          {
+            from = e[i];
+          }
+          else if (a && !b)
+          {
+            to = e[i];
+          }
+        }
+        out_segments.push_back(segment{ from, to });
+      }
+    }
+  }
+
+  for (unsigned l = 0; l < m_levels.size(); ++l)
+  {
+    const float level = m_levels[l];
+    std::vector<segment>& level_segments = segments[l];
+    link(level_segments, [&](const std::vector<std::size_t>& order, const bool closed)
+    {
+      const std::uint64_t from = level_segments[order.front()].from;
+      const std::uint64_t to = level_segments[order.back()].to;
+
+      contour_polyline polyline;
+      polyline.level = level;
+      polyline.closed = closed;
+      polyline.points.reserve(order.size() + 1);
+      polyline.points.push_back(edge_point(from, level));
+      for (std::size_t i = 0; i + (closed ? 1 : 0) < order.size(); ++i)
+      {
+        polyline.points.push_back(edge_point(level_segments[order[i]].to, level));
+      }
+
+      if (!closed && (!border_edge(from) || !border_edge(to)))
+      {
+        fragment piece;
+        piece.level = l;
+        piece.from = from;
+        piece.to = to;
+        piece.points.swap(polyline.points);
+        fragments.push_back(std::move(piece));
+        return;
+      }
+      out(polyline);
+    });
+  }
+}
+
+void contour_extractor::stitch(std::vector<fragment>& fragments, const sink& out) const
+{
+  std::sort(fragments.begin(), fragments.end(), [](const fragment& a, const fragment& b) { return a.level < b.level; });
+
+  for (std::size_t begin = 0; begin < fragments.size();)
+  {
+    std::size_t end = begin;
+    while (end < fragments.size() && fragments[end].level == fragments[begin].level)
+    {
+      ++end;
+    }
+
+    std::vector<fragment> level_fragments(std::make_move_iterator(fragments.begin() + begin), std::make_move_iterator(fragments.begin() + end));
+    const float level = m_levels[fragments[begin].level];
+    link(level_fragments, [&](const std::vector<std::size_t>& order, const bool closed)
+    {
+      contour_polyline polyline;
+      polyline.level = level;
+      polyline.closed = closed;
+      for (const std::size_t i : order)
+      {
+        // the seam point ends one piece and starts the next
+        const std::vector<vec3>& points = level_fragments[i].points;
+        polyline.points.insert(polyline.points.end(), points.begin() + (polyline.points.empty() ? 0 : 1), points.end());
+      }
+      if (closed)
+      {
+        polyline.points.pop_back();
+      }
+      out(polyline);
+    });
+
+    begin = end;
+  }
+  fragments.clear();
+}
+
+bool contour_extractor::border_edge(const std::uint64_t id) const
+{
+  const uvec2 size(m_heights.size());
+  const std::uint64_t cell = id / 2;
+  const unsigned x = static_cast<unsigned>(cell % size.x);
+  const unsigned y = static_cast<unsigned>(cell / size.x);
+  return (id & 1) ? (x == 0 || x == size.x - 1) : (y == 0 || y == size.y - 1);
+}
+
+vec3 contour_extractor::edge_point(const std::uint64_t id, const float level) const
+{
+  const std::uint64_t cell = id / 2;
+  const uvec2 p0(static_cast<unsigned>(cell % m_heights.size().x), static_cast<unsigned>(cell / m_heights.size().x));
+  const uvec2 p1((id & 1) ? uvec2(p0.x, p0.y + 1) : uvec2(p0.x + 1, p0.y));
+
+  // the corners are on different sides of the level, so they differ
+  const float h0 = m_heights(p0);
+  const float t = (level - h0) / (m_heights(p1) - h0);
+  const vec2 pos((vec2(p0) + t * (vec2(p1) - vec2(p0))) * m_heights.resolution());
+  return vec3(pos, level);
+}
+
+contour_writer::contour_writer(const std::string& path)
+  : m_file(path.c_str())
+  , m_count(0)
+{
+  if (!m_file.is_open())
+  {
+    throw std::runtime_error(std::string("Could not open file: ") + path);
+  }
+  m_file.precision(std::numeric_limits<float>::max_digits10);
+}
+
+void contour_writer::write(const contour_polyline& polyline)
+{
+  m_file << polyline.level << ' ' << (polyline.closed ? 1 : 0) << ' ' << polyline.points.size();
+  for (const vec3& p : polyline.points)
+  {
+    m_file << ' ' << p.x << ' ' << p.y;
+  }
+  m_file << '\n';
+  if (!m_file)
+  {
+    throw std::runtime_error(std::string("cannot write contour file"));
+  }
+  ++m_count;
+}
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+  struct contour_polyline
+  {
+    float level;
+    bool closed;              // the last point connects to the first
+    std::vector<vec3> points; // x, y in world units of the height field, z is the level
+  };
+
+  // indexed GL_LINES buffers for opengl::mesh
+  struct contour_lines
+  {
+    std::vector<vec3> vertices;
+    std::vector<unsigned> indices;
+
+    void add(const contour_polyline& polyline);
+  };
+
+// isolines by marching squares, higher ground is on the right of the line direction
+// saddle cells are resolved with the mean of their four corners
+// cells are processed in tiles on the pool, lines inside a tile go to the sink when the tile is done,
+// only the pieces ending on a tile seam are kept and stitched together at the end through their seam edge
+  class contour_extractor
+  {
+  public:
+    using sink = std::function<void(const contour_polyline&)>;
+
+  public:
+    // tile_size in cells, bounds the per tile working memory
+    contour_extractor(const height_field& heights, std::vector<float> levels, const uvec2& tile_size = uvec2(256));
+
+    // levels every interval inside [bounds.x, bounds.y]
+    static std::vector<float> even_levels(const float interval, const vec2& bounds);
+
+    const std::vector<float>& levels() const
+    {
+      return m_levels;
+    }
+
+    // sink is called once per polyline, one call at a time, in no particular order
+    void extract(const sink& out, parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+    std::vector<contour_polyline> extract(parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+    contour_lines extract_lines(parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+  private:
+    struct segment
+    {
+      std::uint64_t from;
+      std::uint64_t to;
+    };
+
+    struct fragment
+    {
+      unsigned level;
+      std::uint64_t from;
+      std::uint64_t to;
+      std::vector<vec3> points;
+    };
+
+    void extract_tile(const uvec2& begin, const uvec2& end, const sink& out, std::vector<fragment>& fragments) const;
+    void stitch(std::vector<fragment>& fragments, const sink& out) const;
+
+    std::uint64_t edge_id(const unsigned x, const unsigned y, const bool vertical) const
+    {
+      return (static_cast<std::uint64_t>(y) * m_heights.size().x + x) * 2 + (vertical ? 1 : 0);
+    }
+
+    bool border_edge(const std::uint64_t id) const;
+    vec3 edge_point(const std::uint64_t id, const float level) const;
+
+  private:
+    const height_field& m_heights;
+    std::vector<float> m_levels; // ascending, no duplicates
+    uvec2 m_tile_size;
+  };
+
+// streams polylines to a text file, one per line: level closed point_count x0 y0 x1 y1 ...
+  class contour_writer
+  {
+  public:
+    contour_writer(const std::string& path);
+
+    void write(const contour_polyline& polyline);
+
+    std::uint64_t polyline_count() const
+    {
+      return m_count;
+    }
+
+  private:
+    std::ofstream m_file;
+    std::uint64_t m_count;
+  };
+}
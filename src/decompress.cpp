@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "decompress.h"
+
+namespace io
+{
+namespace
+{
+const unsigned max_code_length = 15;
+
+// codes up to this length decode with one table lookup
+const unsigned fast_bits = 10;
+
+const std::uint16_t length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const std::uint8_t length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const std::uint16_t distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const std::uint8_t distance_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+const std::uint8_t code_length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+void corrupt(const char* what)
+{
+  throw std::runtime_error(std::string("corrupt compressed data: ") + what);
+}
+
+// lsb first bits, reads past the end as zeros and fails once those are consumed
+class bit_reader
+{
+public:
+  bit_reader(const std::uint8_t* data, const std::size_t size)
+    : m_data(data)
+    , m_end(data + size)
+    , m_bits(0)
+    , m_count(0)
+    , m_padding(0)
+  { }
+
+  unsigned peek(const unsigned n)
+  {
+    if (m_count < n)
+    {
+      refill();
+    }
+    return static_cast<unsigned>(m_bits & ((1u << n) - 1));
+  }
+
+  void consume(const unsigned n)
+  {
+    m_bits >>= n;
+    m_count -= n;
+  }
+
+  unsigned bits(const unsigned n)
+  {
+    const unsigned v = peek(n);
+    consume(n);
+    return v;
+  }
+
+  void align()
+  {
+    consume(m_count & 7u);
+  }
+
+  // after align, hands out the buffered bytes first
+  void copy(std::uint8_t* out, std::size_t n)
+  {
+    for (; n > 0 && m_count >= 8; --n)
+    {
+      *out++ = static_cast<std::uint8_t>(bits(8));
+    }
+    if (n == 0)
+    {
+      // the block fit in the buffer, as long as none of the padding was handed out
+      check();
+      return;
+    }
+    // the buffer is drained, any padding in it was consumed by the block
+    if (m_padding > 0 || n > static_cast<std::size_t>(m_end - m_data))
+    {
+      corrupt("stored block past the end");
+    }
+    std::memcpy(out, m_data, n);
+    m_data += n;
+  }
+
+  void check() const
+  {
+    if (m_padding * 8 > m_count)
+    {
+      corrupt("unexpected end");
+    }
+  }
+
+private:
+  void refill()
+  {
+    while (m_count <= 56)
+    {
+      std::uint64_t b = 0;
+      if (m_data < m_end)
+      {
+        b = *m_data++;
+      }
+      else
+      {
+        ++m_padding;
+      }
+      m_bits |= b << m_count;
+      m_count += 8;
+    }
+  }
+
+private:
+  const std::uint8_t* m_data;
+  const std::uint8_t* m_end;
+  std::uint64_t m_bits;
+  unsigned m_count;
+  unsigned m_padding; // zero bytes added past the end
+};
+
+// canonical huffman code, one lookup for the short codes, bit by bit for the rest
+class huffman
+{
+public:
+  void build(const std::uint8_t* lengths, const unsigned n)
+  {
+    std::fill(m_count, m_count + max_code_length + 1, static_cast<std::uint16_t>(0));
+    std::fill(m_fast, m_fast + (1u << fast_bits), static_cast<std::uint16_t>(0));
+    for (unsigned s = 0; s < n; ++s)
+    {
+      ++m_count[lengths[s]];
+    }
+    m_count[0] = 0;
+
+    int left = 1;
+    for (unsigned len = 1; len <= max_code_length; ++len)
+    {
+      left = (left << 1) - m_count[len];
+      if (left < 0)
+      {
+        corrupt("over-subscribed code");
+      }
+    }
+
+    std::uint16_t offsets[max_code_length + 2] = { 0 };
+    unsigned next_code[max_code_length + 1] = { 0 };
+    unsigned code = 0;
+    for (unsigned len = 1; len <= max_code_length; ++len)
+    {
+      offsets[len + 1] = static_cast<std::uint16_t>(offsets[len] + m_count[len]);
+      code = (code + m_count[len - 1]) << 1;
+      next_code[len] = code;
+    }
+
+    for (unsigned s = 0; s < n; ++s)
+    {
+      const unsigned len = lengths[s];
+      if (len == 0)
+      {
+        continue;
+      }
+      m_symbols[offsets[len]++] = static_cast<std::uint16_t>(s);
+
+      if (len <= fast_bits)
+      {
+        // codes are sent msb first, the reader is lsb first
+        const unsigned c = next_code[len];
+        unsigned reversed = 0;
+        for (unsigned i = 0; i < len; ++i)
+        {
+          reversed |= ((c >> i) & 1u) << (len - 1 - i);
+        }
+        for (unsigned i = reversed; i < (1u << fast_bits); i += 1u << len)
+        {
+          m_fast[i] = static_cast<std::uint16_t>((s << 4) | len);
+        }
+      }
+      ++next_code[len];
+    }
+  }
+
+  unsigned decode(bit_reader& in) const
+  {
+    const unsigned entry = m_fast[in.peek(fast_bits)];
+    if (entry != 0)
+    {
+      in.consume(entry & 15u);
+      return entry >> 4;
+    }
+
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (unsigned len = 1; len <= max_code_length; ++len)
+    {
+      code |= static_cast<int>(in.bits(1));
+      const int count = m_count[len];
+      if (code - count < first)
+      {
+        return m_symbols[index + (code - first)];
+      }
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+    corrupt("invalid code");
+    return 0;
+  }
+
+private:
+  std::uint16_t m_fast[1u << fast_bits]; // symbol << 4 | length, 0 for longer codes
+  std::uint16_t m_count[max_code_length + 1];
+  std::uint16_t m_symbols[288];
+};
+
+void fixed_tables(huffman& literals, huffman& distances)
+{
+  std::uint8_t lengths[288];
+  std::fill(lengths, lengths + 144, static_cast<std::uint8_t>(8));
+  std::fill(lengths + 144, lengths + 256, static_cast<std::uint8_t>(9));
+  std::fill(lengths + 256, lengths + 280, static_cast<std::uint8_t>(7));
+  std::fill(lengths + 280, lengths + 288, static_cast<std::uint8_t>(8));
+  literals.build(lengths, 288);
+  std::fill(lengths, lengths + 30, static_cast<std::uint8_t>(5));
+  distances.build(lengths, 30);
+}
+
+void dynamic_tables(bit_reader& in, huffman& literals, huffman& distances)
+{
+  const unsigned literal_count = in.bits(5) + 257;
+  const unsigned distance_count = in.bits(5) + 1;
+  const unsigned code_length_count = in.bits(4) + 4;
+  if (literal_count > 286 || distance_count > 30)
+  {
+    corrupt("too many codes");
+  }
+
+  std::uint8_t lengths[286 + 30] = { 0 };
+  for (unsigned i = 0; i < code_length_count; ++i)
+  {
+    lengths[code_length_order[i]] = static_cast<std::uint8_t>(in.bits(3));
+  }
+  huffman code_lengths;
+  code_lengths.build(lengths, 19);
+
+  std::fill(lengths, lengths + 19, static_cast<std::uint8_t>(0));
+  for (unsigned i = 0; i < literal_count + distance_count;)
+  {
+    const unsigned symbol = code_lengths.decode(in);
+    if (symbol < 16)
+    {
+      lengths[i++] = static_cast<std::uint8_t>(symbol);
+      continue;
+    }
+
+    std::uint8_t value = 0;
+    unsigned repeat;
+    if (symbol == 16)
+    {
+      if (i == 0)
+      {
+        corrupt("repeat without a length");
+      }
+      value = lengths[i - 1];
+      repeat = 3 + in.bits(2);
+    }
+    else if (symbol == 17)
+    {
+      repeat = 3 + in.bits(3);
+    }
+    else
+    {
+      repeat = 11 + in.bits(7);
+    }
+    if (i + repeat > literal_count + distance_count)
+    {
+      corrupt("too many lengths");
+    }
+    std::fill(lengths + i, lengths + i + repeat, value);
+    i += repeat;
+  }
+
+  if (lengths[256] == 0)
+  {
+    corrupt("no end of block code");
+  }
+  literals.build(lengths, literal_count);
+  distances.build(lengths + literal_count, distance_count);
+}
+}
+
+std::size_t inflate(const std::uint8_t* in, const std::size_t in_size, std::uint8_t* out, const std::size_t out_size)
+{
+  // zlib header: deflate method and a multiple of 31
+  std::size_t skip = 0;
+  if (in_size >= 2 && (in[0] & 0x0f) == 8 && ((in[0] << 8) | in[1]) % 31 == 0)
+  {
+    skip = 2;
+  }
+
+  bit_reader bits(in + skip, in_size - skip);
+  huffman literals;
+  huffman distances;
+  std::size_t pos = 0;
+  bool last = false;
+  while (!last)
+  {
+    last = bits.bits(1) != 0;
+    const unsigned type = bits.bits(2);
+    if (type == 0)
+    {
+      bits.align();
+      const unsigned length = bits.bits(16);
+      if ((length ^ bits.bits(16)) != 0xffffu)
+      {
+        corrupt("stored block length");
+      }
+      if (length > out_size - pos)
+      {
+        corrupt("output too small");
+      }
+      bits.copy(out + pos, length);
+      pos += length;
+      continue;
+    }
+
+    if (type == 1)
+    {
+      fixed_tables(literals, distances);
+    }
+    else if (type == 2)
+    {
+      dynamic_tables(bits, literals, distances);
+    }
+    else
+    {
+      corrupt("block type");
+    }
+
+    while (true)
+    {
+      const unsigned symbol = literals.decode(bits);
+      if (symbol < 256)
+      {
+        if (pos == out_size)
+        {
+          corrupt("output too small");
+        }
+        out[pos++] = static_cast<std::uint8_t>(symbol);
+        continue;
+      }
+      if (symbol == 256)
+      {
+        break;
+      }
+      if (symbol > 285)
+      {
+        corrupt("length code");
+      }
+
+      const unsigned length = length_base[symbol - 257] + bits.bits(length_extra[symbol - 257]);
+      const unsigned distance_symbol = distances.decode(bits);
+      if (distance_symbol >= 30)
+      {
+        corrupt("distance code");
+      }
+      const std::size_t distance = distance_base[distance_symbol] + bits.bits(distance_extra[distance_symbol]);
+      if (distance > pos)
+      {
+        corrupt("distance too far back");
+      }
+      if (length > out_size - pos)
+      {
+        corrupt("output too small");
+      }
+
+      // the source may overlap the destination, byte by byte
+      const std::uint8_t* from = out + pos - distance;
+      std::uint8_t* to = out + pos;
+      for (unsigned i = 0; i < length; ++i)
+      {
+        to[i] = from[i];
+      }
+      pos += length;
+    }
+    bits.check();
+  }
+  return pos;
+}
+
+std::size_t lzw_decode(const std::uint8_t* in, const std::size_t in_size, std::uint8_t* out, const std::size_t out_size)
+{
+  const unsigned clear_code = 256;
+  const unsigned end_code = 257;
+  const unsigned max_codes = 4096;
+
+  if (in_size >= 2 && in[0] == 0 && (in[1] & 1) != 0)
+  {
+    throw std::runtime_error(std::string("old style lzw is not supported"));
+  }
+
+  // string of a code: its last byte, the code without it, its first byte and its length
+  std::uint16_t prefix[max_codes];
+  std::uint8_t suffix[max_codes];
+  std::uint8_t first[max_codes];
+  std::uint16_t length[max_codes];
+  for (unsigned i = 0; i < 256; ++i)
+  {
+    prefix[i] = 0;
+    suffix[i] = static_cast<std::uint8_t>(i);
+    first[i] = static_cast<std::uint8_t>(i);
+    length[i] = 1;
+  }
+
+  std::size_t pos = 0;
+  std::size_t byte = 0;
+  std::uint32_t buffer = 0;
+  unsigned buffered = 0;
+  unsigned width = 9;
+  unsigned next = 258;
+  unsigned previous = max_codes;
+
+  // writes the string of code, cut at the end of out
+  auto emit = [&](const unsigned code)
+  {
+    const std::size_t n = length[code];
+    std::size_t i = n;
+    for (unsigned c = code; i > 0; c = prefix[c])
+    {
+      --i;
+      if (pos + i < out_size)
+      {
+        out[pos + i] = suffix[c];
+      }
+    }
+    pos = std::min(pos + n, out_size);
+  };
+
+  while (pos < out_size)
+  {
+    while (buffered < width && byte < in_size)
+    {
+      buffer = (buffer << 8) | in[byte++];
+      buffered += 8;
+    }
+    if (buffered < width)
+    {
+      break;
+    }
+    const unsigned code = (buffer >> (buffered - width)) & ((1u << width) - 1);
+    buffered -= width;
+
+    if (code == end_code)
+    {
+      break;
+    }
+    if (code == clear_code)
+    {
+      width = 9;
+      next = 258;
+      previous = max_codes;
+      continue;
+    }
+
+    if (previous == max_codes)
+    {
+      if (code >= 256)
+      {
+        corrupt("lzw code after clear");
+      }
+      emit(code);
+      previous = code;
+      continue;
+    }
+
+    if (code > next || (code == next && next >= max_codes))
+    {
+      corrupt("lzw code");
+    }
+    if (next < max_codes)
+    {
+      // the new string is the previous one plus the first byte of the current, which is itself when code is new
+      prefix[next] = static_cast<std::uint16_t>(previous);
+      suffix[next] = code == next ? first[previous] : first[code];
+      first[next] = first[previous];
+      length[next] = static_cast<std::uint16_t>(length[previous] + 1);
+      ++next;
+    }
+    emit(code);
+    previous = code;
+
+    if (next + 1 >= (1u << width) && width < 12)
+    {
+      ++width;
+    }
+  }
+  return pos;
+}
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace io
+{
+// the decoders write at most out_size bytes and return the count written, corrupt input throws
+
+// deflate (rfc 1951), with or without the zlib wrapper (rfc 1950), the checksum is not verified
+std::size_t inflate(const std::uint8_t* in, const std::size_t in_size, std::uint8_t* out, const std::size_t out_size);
+
+// tiff flavour of lzw: msb first codes of 9 to 12 bits, the code width grows one code early
+std::size_t lzw_decode(const std::uint8_t* in, const std::size_t in_size, std::uint8_t* out, const std::size_t out_size);
+}
@@ -0,0 +1,520 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "geotiff_reader.h"
+#include "dem_catalog.h"
+
+namespace terrain
+{
+namespace
+{
+// catalog index file, little endian
+// header, then per file: name length, name, file_size, modified, width, height, geo transform
+struct catalog_header
+{
+  char magic[4];            // "DMC1"
+  std::uint32_t version;
+  std::uint32_t count;
+  std::uint32_t reserved;
+};
+
+const char catalog_magic[4] = { 'D', 'M', 'C', '1' };
+const std::uint32_t catalog_version = 1;
+
+// r-tree fan out
+const unsigned node_capacity = 16;
+
+// source pixels read around a mosaic window, enough for the bicubic taps
+const unsigned window_margin = 2;
+
+struct file_info
+{
+  std::string name;
+  std::uint64_t size;
+  std::uint64_t modified;
+};
+
+bool is_tiff(const std::string& name)
+{
+  const std::size_t dot = name.rfind('.');
+  if (dot == std::string::npos)
+  {
+    return false;
+  }
+  std::string extension = name.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](const char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+  return extension == "tif" || extension == "tiff";
+}
+
+std::string join(const std::string& directory, const std::string& name)
+{
+  if (directory.empty() || directory.back() == '/' || directory.back() == '\\')
+  {
+    return directory + name;
+  }
+  return directory + "/" + name;
+}
+
+// the tiff files of directory, sorted by name
+std::vector<file_info> list_tiffs(const std::string& directory)
+{
+  std::vector<file_info> files;
+#ifdef _WIN32
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA(join(directory, "*").c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE)
+  {
+    throw std::runtime_error(std::string("Could not list directory: ") + directory);
+  }
+  do
+  {
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 || !is_tiff(data.cFileName))
+    {
+      continue;
+    }
+    file_info info;
+    info.name = data.cFileName;
+    info.size = (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    info.modified = (static_cast<std::uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+    files.push_back(info);
+  } while (FindNextFileA(find, &data));
+  FindClose(find);
+#else
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+  {
+    throw std::runtime_error(std::string("Could not list directory: ") + directory);
+  }
+  while (const dirent* e = readdir(dir))
+  {
+    const std::string name(e->d_name);
+    struct stat st;
+    if (!is_tiff(name) || stat(join(directory, name).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      continue;
+    }
+    file_info info;
+    info.name = name;
+    info.size = static_cast<std::uint64_t>(st.st_size);
+    info.modified = static_cast<std::uint64_t>(st.st_mtime);
+    files.push_back(info);
+  }
+  closedir(dir);
+#endif
+
+  std::sort(files.begin(), files.end(), [](const file_info& a, const file_info& b) { return a.name < b.name; });
+  return files;
+}
+
+// footprint of the raster, rotated transforms give the box around the four corners
+geo_box footprint(const geo_reference& reference)
+{
+  const dvec2 size(reference.getPixelCount());
+  const dvec2 corners[4] = { dvec2(0.0), dvec2(size.x, 0.0), dvec2(0.0, size.y), size };
+  geo_box box;
+  for (unsigned i = 0; i < 4; ++i)
+  {
+    const dvec2 p = reference.imgToGeoFractional(corners[i]);
+    box.min = i == 0 ? p : glm::min(box.min, p);
+    box.max = i == 0 ? p : glm::max(box.max, p);
+  }
+  return box;
+}
+
+// an unreadable or outdated index is treated as empty, the files are scanned again
+std::vector<dem_catalog::entry> load_index(const std::string& path)
+{
+  std::vector<dem_catalog::entry> entries;
+  std::ifstream stream(path.c_str(), std::ios::binary | std::ios::in);
+  if (!stream.is_open())
+  {
+    return entries;
+  }
+
+  stream.seekg(0, std::ios::end);
+  const std::uint64_t file_size = static_cast<std::uint64_t>(stream.tellg());
+  stream.seekg(0, std::ios::beg);
+
+  catalog_header header;
+  stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!stream || std::memcmp(header.magic, catalog_magic, sizeof(catalog_magic)) != 0 || header.version != catalog_version)
+  {
+    return entries;
+  }
+
+  // every entry takes at least its fixed fields, a count the file cannot hold is corrupt
+  const std::uint64_t min_entry_size = sizeof(std::uint32_t) + 2 * sizeof(std::uint64_t) + 2 * sizeof(std::uint32_t) + sizeof(dem_catalog::entry().geo_transform);
+  if (header.count > (file_size - sizeof(header)) / min_entry_size)
+  {
+    return entries;
+  }
+
+  entries.resize(header.count);
+  for (dem_catalog::entry& e : entries)
+  {
+    std::uint32_t name_length = 0;
+    stream.read(reinterpret_cast<char*>(&name_length), sizeof(name_length));
+    if (!stream || name_length > 4096)
+    {
+      return std::vector<dem_catalog::entry>();
+    }
+    e.name.resize(name_length);
+    std::uint32_t size[2];
+    stream.read(&e.name[0], name_length);
+    stream.read(reinterpret_cast<char*>(&e.file_size), sizeof(e.file_size));
+    stream.read(reinterpret_cast<char*>(&e.modified), sizeof(e.modified));
+    stream.read(reinterpret_cast<char*>(size), sizeof(size));
+    stream.read(reinterpret_cast<char*>(e.geo_transform), sizeof(e.geo_transform));
+    if (!stream)
+    {
+      return std::vector<dem_catalog::entry>();
+    }
+    e.size = uvec2(size[0], size[1]);
+    e.bounds = footprint(geo_reference(e.geo_transform, static_cast<int>(size[0]), static_cast<int>(size[1])));
+  }
+  return entries;
+}
+
+// sorts items by x, cuts them into vertical slices and sorts each slice by y
+// consecutive runs of node_capacity items then form compact groups
+template<typename T, typename B>
+void str_sort(std::vector<T>& items, const B& bounds)
+{
+  const std::size_t groups = (items.size() + node_capacity - 1) / node_capacity;
+  const std::size_t slices = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(groups))));
+  const std::size_t slice_size = std::max<std::size_t>(1, (groups + slices - 1) / slices) * node_capacity;
+
+  std::sort(items.begin(), items.end(), [&](const T& a, const T& b) { return bounds(a).center().x < bounds(b).center().x; });
+  for (std::size_t begin = 0; begin < items.size(); begin += slice_size)
+  {
+    const std::size_t end = std::min(items.size(), begin + slice_size);
+    std::sort(items.begin() + begin, items.begin() + end, [&](const T& a, const T& b) { return bounds(a).center().y < bounds(b).center().y; });
+  }
+}
+}
+
+dem_catalog::ptr dem_catalog::open(const std::string& directory, const std::string& index_path, parallel::thread_pool& pool)
+{
+  const std::vector<file_info> files = list_tiffs(directory);
+
+  std::vector<entry> indexed;
+  if (!index_path.empty())
+  {
+    indexed = load_index(index_path);
+  }
+  std::unordered_map<std::string, const entry*> by_name;
+  for (const entry& e : indexed)
+  {
+    by_name[e.name] = &e;
+  }
+
+  // entries that are still current are taken over, the others are parsed in parallel
+  std::vector<entry> entries(files.size());
+  std::vector<unsigned> stale;
+  for (unsigned i = 0; i < files.size(); ++i)
+  {
+    auto it = by_name.find(files[i].name);
+    if (it != by_name.end() && it->second->file_size == files[i].size && it->second->modified == files[i].modified)
+    {
+      entries[i] = *it->second;
+      continue;
+    }
+    entries[i].name = files[i].name;
+    entries[i].file_size = files[i].size;
+    entries[i].modified = files[i].modified;
+    stale.push_back(i);
+  }
+
+  pool.parallel_for(static_cast<unsigned>(stale.size()), [&](const unsigned i)
+  {
+    entry& e = entries[stale[i]];
+    const geotiff_reader reader(join(directory, e.name));
+    e.size = reader.size();
+    std::copy(reader.geo_transform(), reader.geo_transform() + 6, e.geo_transform);
+    e.bounds = footprint(reader.geo());
+  });
+
+  ptr catalog(new dem_catalog(directory, std::move(entries)));
+  if (!index_path.empty() && (!stale.empty() || indexed.size() != files.size()))
+  {
+    catalog->save(index_path);
+  }
+  return catalog;
+}
+
+dem_catalog::dem_catalog(const std::string& directory, std::vector<entry>&& entries)
+  : m_directory(directory)
+  , m_entries(std::move(entries))
+{
+  build();
+}
+
+std::string dem_catalog::path(const entry& e) const
+{
+  return join(m_directory, e.name);
+}
+
+const geo_box& dem_catalog::bounds() const
+{
+  static const geo_box empty;
+  return m_nodes.empty() ? empty : m_nodes.back().bounds;
+}
+
+void dem_catalog::build()
+{
+  m_items.resize(m_entries.size());
+  for (unsigned i = 0; i < m_items.size(); ++i)
+  {
+    m_items[i] = i;
+  }
+  m_nodes.clear();
+  if (m_items.empty())
+  {
+    return;
+  }
+
+  // leaves over the entries
+  str_sort(m_items, [&](const unsigned i) -> const geo_box& { return m_entries[i].bounds; });
+  for (unsigned first = 0; first < m_items.size(); first += node_capacity)
+  {
+    node n;
+    n.first = first;
+    n.count = std::min<unsigned>(node_capacity, static_cast<unsigned>(m_items.size()) - first);
+    n.leaf = true;
+    n.bounds = m_entries[m_items[first]].bounds;
+    for (unsigned i = 1; i < n.count; ++i)
+    {
+      n.bounds.extend(m_entries[m_items[first + i]].bounds);
+    }
+    m_nodes.push_back(n);
+  }
+
+  // each level is sorted in place, then packed into the parents appended behind it
+  unsigned level_begin = 0;
+  while (m_nodes.size() - level_begin > 1)
+  {
+    const unsigned level_end = static_cast<unsigned>(m_nodes.size());
+    std::vector<node> level(m_nodes.begin() + level_begin, m_nodes.end());
+    str_sort(level, [](const node& n) -> const geo_box& { return n.bounds; });
+    std::copy(level.begin(), level.end(), m_nodes.begin() + level_begin);
+
+    for (unsigned first = level_begin; first < level_end; first += node_capacity)
+    {
+      node n;
+      n.first = first;
+      n.count = std::min(node_capacity, level_end - first);
+      n.leaf = false;
+      n.bounds = m_nodes[first].bounds;
+      for (unsigned i = 1; i < n.count; ++i)
+      {
+        n.bounds.extend(m_nodes[first + i].bounds);
+      }
+      m_nodes.push_back(n);
+    }
+    level_begin = level_end;
+  }
+}
+
+std::vector<unsigned> dem_catalog::query(const geo_box& box) const
+{
+  std::vector<unsigned> result;
+  if (m_nodes.empty())
+  {
+    return result;
+  }
+
+  std::vector<unsigned> stack(1, static_cast<unsigned>(m_nodes.size() - 1));
+  while (!stack.empty())
+  {
+    const node& n = m_nodes[stack.back()];
+    stack.pop_back();
+    if (!n.bounds.intersects(box))
+    {
+      continue;
+    }
+
+    for (unsigned i = n.first; i < n.first + n.count; ++i)
+    {
+      if (!n.leaf)
+      {
+        stack.push_back(i);
+      }
+      else if (m_entries[m_items[i]].bounds.intersects(box))
+      {
+        result.push_back(m_items[i]);
+      }
+    }
+  }
+
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+height_field::ptr dem_catalog::mosaic(const geo_box& box, const uvec2& size, const height_field::filter::Enum f, parallel::thread_pool& pool) const
+{
+  if (size.x == 0 || size.y == 0 || !(box.max.x > box.min.x) || !(box.max.y > box.min.y))
+  {
+    throw std::runtime_error(std::string("invalid mosaic extent"));
+  }
+
+  const dvec2 pixel((box.max.x - box.min.x) / size.x, (box.max.y - box.min.y) / size.y);
+  height_field::ptr result(new height_field(size, vec2(pixel)));
+
+  // priority in the high half, the height bits in the low half, the lowest priority wins
+  // no matter in which order the sources finish
+  // where files overlap, samples that need the border clamp of their source rank behind interior ones
+  const std::uint64_t unclaimed = std::numeric_limits<std::uint64_t>::max();
+  std::vector<std::atomic<std::uint64_t>> cells(static_cast<std::size_t>(size.x) * size.y);
+  for (std::atomic<std::uint64_t>& c : cells)
+  {
+    c.store(unclaimed, std::memory_order_relaxed);
+  }
+
+  const std::vector<unsigned> sources = query(box);
+  pool.parallel_for(static_cast<unsigned>(sources.size()), [&](const unsigned s)
+  {
+    const entry& e = m_entries[sources[s]];
+    const geotiff_reader reader(path(e));
+    const geo_reference reference = reader.geo();
+
+    // output pixels under the footprint
+    const uvec2 begin(
+      static_cast<unsigned>(glm::clamp(std::floor((e.bounds.min.x - box.min.x) / pixel.x), 0.0, static_cast<double>(size.x)))
+      , static_cast<unsigned>(glm::clamp(std::floor((box.max.y - e.bounds.max.y) / pixel.y), 0.0, static_cast<double>(size.y))));
+    const uvec2 end(
+      static_cast<unsigned>(glm::clamp(std::ceil((e.bounds.max.x - box.min.x) / pixel.x), 0.0, static_cast<double>(size.x)))
+      , static_cast<unsigned>(glm::clamp(std::ceil((box.max.y - e.bounds.min.y) / pixel.y), 0.0, static_cast<double>(size.y))));
+    if (begin.x >= end.x || begin.y >= end.y)
+    {
+      return;
+    }
+
+    // only the source pixels under these output pixels are decoded, with a margin for the filter taps
+    // so the window edge clamps only where the file edge does
+    const dvec2 source_size(e.size);
+    std::vector<dvec2> corners(4);
+    corners[0] = dvec2(box.min.x + begin.x * pixel.x, box.max.y - begin.y * pixel.y);
+    corners[1] = dvec2(box.min.x + end.x * pixel.x, box.max.y - begin.y * pixel.y);
+    corners[2] = dvec2(box.min.x + begin.x * pixel.x, box.max.y - end.y * pixel.y);
+    corners[3] = dvec2(box.min.x + end.x * pixel.x, box.max.y - end.y * pixel.y);
+    reference.geoToImg(corners, corners);
+    dvec2 low(corners[0]);
+    dvec2 high(corners[0]);
+    for (const dvec2& c : corners)
+    {
+      low = glm::min(low, c);
+      high = glm::max(high, c);
+    }
+    const dvec2 window_begin(glm::clamp(glm::floor(low) - static_cast<double>(window_margin), dvec2(0.0), source_size));
+    const dvec2 window_end(glm::clamp(glm::ceil(high) + static_cast<double>(window_margin), dvec2(0.0), source_size));
+    if (!(window_begin.x < window_end.x) || !(window_begin.y < window_end.y))
+    {
+      return;
+    }
+    const uvec2 window_offset(window_begin);
+    const height_field::ptr heights = reader.read(window_offset, uvec2(window_end), pool);
+
+    const std::uint64_t interior = static_cast<std::uint64_t>(sources[s]) << 32;
+    const std::uint64_t border = interior | (std::uint64_t(1) << 63);
+    std::vector<dvec2> positions(end.x - begin.x);
+    for (unsigned y = begin.y; y < end.y; ++y)
+    {
+      for (unsigned x = begin.x; x < end.x; ++x)
+      {
+        positions[x - begin.x] = dvec2(box.min.x + (x + 0.5) * pixel.x, box.max.y - (y + 0.5) * pixel.y);
+      }
+      reference.geoToImg(positions, positions);
+
+      for (unsigned x = begin.x; x < end.x; ++x)
+      {
+        const dvec2& p = positions[x - begin.x];
+        if (p.x < 0.0 || p.y < 0.0 || p.x > source_size.x || p.y > source_size.y)
+        {
+          continue;
+        }
+
+        // pixel corner coordinates to sample coordinates of the window
+        const float height = heights->sample(vec2(p - 0.5 - dvec2(window_offset)) * heights->resolution(), f);
+        if (std::isnan(height))
+        {
+          continue;
+        }
+
+        std::uint32_t bits;
+        std::memcpy(&bits, &height, sizeof(bits));
+        const bool clamped = p.x < 0.5 || p.y < 0.5 || p.x > source_size.x - 0.5 || p.y > source_size.y - 0.5;
+        const std::uint64_t claim = (clamped ? border : interior) | bits;
+        std::atomic<std::uint64_t>& cell = cells[static_cast<std::size_t>(y) * size.x + x];
+        std::uint64_t current = cell.load(std::memory_order_relaxed);
+        while (current > claim && !cell.compare_exchange_weak(current, claim, std::memory_order_relaxed))
+        { }
+      }
+    }
+  });
+
+  for (unsigned y = 0; y < size.y; ++y)
+  {
+    float* row = &(*result)(uvec2(0, y));
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const std::uint64_t c = cells[static_cast<std::size_t>(y) * size.x + x].load(std::memory_order_relaxed);
+      if (c == unclaimed)
+      {
+        row[x] = std::numeric_limits<float>::quiet_NaN();
+        continue;
+      }
+      const std::uint32_t bits = static_cast<std::uint32_t>(c);
+      std::memcpy(&row[x], &bits, sizeof(bits));
+    }
+  }
+  return result;
+}
+
+void dem_catalog::save(const std::string& index_path) const
+{
+  catalog_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, catalog_magic, sizeof(catalog_magic));
+  header.version = catalog_version;
+  header.count = static_cast<std::uint32_t>(m_entries.size());
+
+  std::ofstream stream(index_path.c_str(), std::ios::binary | std::ios::out);
+  if (!stream.is_open())
+  {
+    throw std::runtime_error(std::string("could not open catalog index: ") + index_path);
+  }
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const entry& e : m_entries)
+  {
+    const std::uint32_t name_length = static_cast<std::uint32_t>(e.name.size());
+    const std::uint32_t size[2] = { e.size.x, e.size.y };
+    stream.write(reinterpret_cast<const char*>(&name_length), sizeof(name_length));
+    stream.write(e.name.data(), name_length);
+    stream.write(reinterpret_cast<const char*>(&e.file_size), sizeof(e.file_size));
+    stream.write(reinterpret_cast<const char*>(&e.modified), sizeof(e.modified));
+    stream.write(reinterpret_cast<const char*>(size), sizeof(size));
+    stream.write(reinterpret_cast<const char*>(e.geo_transform), sizeof(e.geo_transform));
+  }
+
+  if (!stream)
+  {
+    throw std::runtime_error(std::string("could not write catalog index: ") + index_path);
+  }
+}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "height_field.h"
+#include "elevation_reader.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+  // axis aligned box in geo coordinates, x = lon, y = lat
+  struct geo_box
+  {
+    geo_box()
+      : min(0.0)
+      , max(0.0)
+    { }
+
+    geo_box(const dvec2& low, const dvec2& high)
+      : min(low)
+      , max(high)
+    { }
+
+    bool intersects(const geo_box& other) const
+    {
+      return min.x < other.max.x && other.min.x < max.x && min.y < other.max.y && other.min.y < max.y;
+    }
+
+    void extend(const geo_box& other)
+    {
+      min = glm::min(min, other.min);
+      max = glm::max(max, other.max);
+    }
+
+    dvec2 center() const
+    {
+      return (min + max) * 0.5;
+    }
+
+    dvec2 min;
+    dvec2 max;
+  };
+
+// the GeoTIFF elevation files of a directory, with their footprints in a static R-tree
+// the footprints are persisted in an index file, reopening only parses the headers of new or changed files
+// mosaics read the windows of the covering files in parallel and resample them into one height field
+  class dem_catalog
+  {
+  public:
+    using ptr = std::shared_ptr<dem_catalog>;
+
+    struct entry
+    {
+      std::string name;            // file name inside the directory
+      std::uint64_t file_size;
+      std::uint64_t modified;      // platform file time, only compared for equality
+      uvec2 size;
+      double geo_transform[6];     // gdal order
+      geo_box bounds;
+    };
+
+  public:
+    // lists *.tif and *.tiff in directory (not recursive), reuses the entries of index_path that are
+    // still current and rewrites it when anything changed, an empty index_path skips the index
+    static ptr open(const std::string& directory, const std::string& index_path, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+    const std::string& directory() const
+    {
+      return m_directory;
+    }
+
+    const std::vector<entry>& entries() const
+    {
+      return m_entries;
+    }
+
+    std::string path(const entry& e) const;
+
+    // bounds of all files
+    const geo_box& bounds() const;
+
+    // indices into entries() of the files whose footprint intersects box, in catalog order
+    std::vector<unsigned> query(const geo_box& box) const;
+
+    // box sampled at size pixel centers, row 0 is the north edge like in the source rasters
+    // where files overlap the one that comes first in entries() wins, cells no file covers are NaN
+    // the resolution is the pixel size in geo units
+    height_field::ptr mosaic(const geo_box& box, const uvec2& size, const height_field::filter::Enum f = height_field::filter::bilinear, parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+    void save(const std::string& index_path) const;
+
+  private:
+    // sort tile recursive packed, children of a node are contiguous
+    struct node
+    {
+      geo_box bounds;
+      unsigned first;   // first child node, or first item for leaves
+      unsigned count;
+      bool leaf;
+    };
+
+    dem_catalog(const std::string& directory, std::vector<entry>&& entries);
+
+    void build();
+
+  private:
+    std::string m_directory;
+    std::vector<entry> m_entries;
+    std::vector<unsigned> m_items;  // entry indices in leaf order
+    std::vector<node> m_nodes;      // the root is the last node
+  };
+}
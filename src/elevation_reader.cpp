@@ -1,9 +1,92 @@
 #pragma once
 
+#include <algorithm>
 #include <stdexcept>
 #include "elevation_reader.h"
+#include "geotiff_reader.h"
 #include "height_field.h"
 
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
+
+namespace
+{
+// out = t[0] + t[1] * x + t[2] * y, t[3] + t[4] * x + t[5] * y for count interleaved points
+// the sse2 path does two points per step and rounds exactly like the scalar one
+void transform(const double* t, const double* in, double* out, const std::size_t count)
+{
+  std::size_t i = 0;
+#ifdef TERRAIN_SSE2
+  const __m128d t0 = _mm_set1_pd(t[0]), t1 = _mm_set1_pd(t[1]), t2 = _mm_set1_pd(t[2]);
+  const __m128d t3 = _mm_set1_pd(t[3]), t4 = _mm_set1_pd(t[4]), t5 = _mm_set1_pd(t[5]);
+  for (; i + 2 <= count; i += 2)
+  {
+    const __m128d p0 = _mm_loadu_pd(in + 2 * i);
+    const __m128d p1 = _mm_loadu_pd(in + 2 * i + 2);
+    const __m128d x = _mm_unpacklo_pd(p0, p1);
+    const __m128d y = _mm_unpackhi_pd(p0, p1);
+    const __m128d u = _mm_add_pd(_mm_add_pd(t0, _mm_mul_pd(t1, x)), _mm_mul_pd(t2, y));
+    const __m128d v = _mm_add_pd(_mm_add_pd(t3, _mm_mul_pd(t4, x)), _mm_mul_pd(t5, y));
+    _mm_storeu_pd(out + 2 * i, _mm_unpacklo_pd(u, v));
+    _mm_storeu_pd(out + 2 * i + 2, _mm_unpackhi_pd(u, v));
+  }
+#endif
+  for (; i < count; ++i)
+  {
+    const double x = in[2 * i];
+    const double y = in[2 * i + 1];
+    out[2 * i] = t[0] + t[1] * x + t[2] * y;
+    out[2 * i + 1] = t[3] + t[4] * x + t[5] * y;
+  }
+}
+
+// float points are widened, transformed in double and rounded once on the way out
+void transform(const double* t, const float* in, float* out, const std::size_t count)
+{
+  std::size_t i = 0;
+#ifdef TERRAIN_SSE2
+  const __m128d t0 = _mm_set1_pd(t[0]), t1 = _mm_set1_pd(t[1]), t2 = _mm_set1_pd(t[2]);
+  const __m128d t3 = _mm_set1_pd(t[3]), t4 = _mm_set1_pd(t[4]), t5 = _mm_set1_pd(t[5]);
+  for (; i + 2 <= count; i += 2)
+  {
+    const __m128 p = _mm_loadu_ps(in + 2 * i);
+    const __m128d p0 = _mm_cvtps_pd(p);
+    const __m128d p1 = _mm_cvtps_pd(_mm_movehl_ps(p, p));
+    const __m128d x = _mm_unpacklo_pd(p0, p1);
+    const __m128d y = _mm_unpackhi_pd(p0, p1);
+    const __m128d u = _mm_add_pd(_mm_add_pd(t0, _mm_mul_pd(t1, x)), _mm_mul_pd(t2, y));
+    const __m128d v = _mm_add_pd(_mm_add_pd(t3, _mm_mul_pd(t4, x)), _mm_mul_pd(t5, y));
+    const __m128 r0 = _mm_cvtpd_ps(_mm_unpacklo_pd(u, v));
+    const __m128 r1 = _mm_cvtpd_ps(_mm_unpackhi_pd(u, v));
+    _mm_storeu_ps(out + 2 * i, _mm_movelh_ps(r0, r1));
+  }
+#endif
+  for (; i < count; ++i)
+  {
+    const double x = in[2 * i];
+    const double y = in[2 * i + 1];
+    out[2 * i] = static_cast<float>(t[0] + t[1] * x + t[2] * y);
+    out[2 * i + 1] = static_cast<float>(t[3] + t[4] * x + t[5] * y);
+  }
+}
+
+// glm vectors are plain interleaved x, y pairs
+template<typename T>
+void transform(const double* t, const span<const T>& in, const span<T>& out)
+{
+  if (out.size() < in.size())
+  {
+    throw std::runtime_error(std::string("geo_reference: output span is smaller than the input."));
+  }
+  if (!in.empty())
+  {
+    transform(t, &in.data()->x, &out.data()->x, in.size());
+  }
+}
+}
+
 namespace terrain
 {
 geo_reference::geo_reference(double* geo, double* inv, const int w, const int h)
@@ -16,9 +99,44 @@ geo_reference::geo_reference(double* geo, double* inv, const int w, const int h)
     throw std::runtime_error(std::string("invalid geo_reference creation parameter(s)."));
   }
 
-  mImageToGeoTransform = glm::dmat3x2(geo[1], geo[2], geo[4],
+  std::copy(geo, geo + 6, mGeoTransform);
+  std::copy(inv, inv + 6, mInverseTransform);
+  mImageToGeoTransform = glm::dmat3x2(geo[1], geo[4], geo[2],
+    geo[5], geo[0], geo[3]);
+  mGeoToImageTransform = glm::dmat3x2(inv[1], inv[4], inv[2],
+    inv[5], inv[0], inv[3]);
+}
+
+geo_reference::geo_reference(const double* geo, const int w, const int h)
+  : mGeoToImageTransform(1.0)
+  , mImageToGeoTransform(1.0)
+  , mImageSize(w, h)
+{
+  if (!geo || w < 0 || h < 0)
+  {
+    throw std::runtime_error(std::string("invalid geo_reference creation parameter(s)."));
+  }
+
+  const double det = geo[1] * geo[5] - geo[2] * geo[4];
+  if (det == 0.0)
+  {
+    throw std::runtime_error(std::string("geo transform is not invertible."));
+  }
+
+  const double inv_det = 1.0 / det;
+  double inv[6];
+  inv[1] = geo[5] * inv_det;
+  inv[4] = -geo[4] * inv_det;
+  inv[2] = -geo[2] * inv_det;
+  inv[5] = geo[1] * inv_det;
+  inv[0] = (geo[2] * geo[3] - geo[0] * geo[5]) * inv_det;
+  inv[3] = (-geo[1] * geo[3] + geo[0] * geo[4]) * inv_det;
+
+  std::copy(geo, geo + 6, mGeoTransform);
+  std::copy(inv, inv + 6, mInverseTransform);
+  mImageToGeoTransform = glm::dmat3x2(geo[1], geo[4], geo[2],
     geo[5], geo[0], geo[3]);
-  mGeoToImageTransform = glm::dmat3x2(inv[1], inv[2], inv[4],
+  mGeoToImageTransform = glm::dmat3x2(inv[1], inv[4], inv[2],
     inv[5], inv[0], inv[3]);
 }
 
@@ -30,6 +148,34 @@ geo geo_reference::imgToGeo(const uvec2& img) const
 {
   return geo(mImageToGeoTransform * vec3(img, 1.0));
 }
+dvec2 geo_reference::geoToImgFractional(const dvec2& geo) const
+{
+  dvec2 img;
+  transform(mInverseTransform, &geo.x, &img.x, 1);
+  return img;
+}
+dvec2 geo_reference::imgToGeoFractional(const dvec2& img) const
+{
+  dvec2 geo;
+  transform(mGeoTransform, &img.x, &geo.x, 1);
+  return geo;
+}
+void geo_reference::geoToImg(span<const dvec2> geo, span<dvec2> img) const
+{
+  transform(mInverseTransform, geo, img);
+}
+void geo_reference::geoToImg(span<const vec2> geo, span<vec2> img) const
+{
+  transform(mInverseTransform, geo, img);
+}
+void geo_reference::imgToGeo(span<const dvec2> img, span<dvec2> geo) const
+{
+  transform(mGeoTransform, img, geo);
+}
+void geo_reference::imgToGeo(span<const vec2> img, span<vec2> geo) const
+{
+  transform(mGeoTransform, img, geo);
+}
 const uvec2& geo_reference::getPixelCount() const
 {
   return mImageSize;
@@ -46,10 +192,13 @@ void geo_reference::clear()
 {
   mGeoToImageTransform = mat32(1.0);
   mImageToGeoTransform = mat32(1.0);
+  const double identity[6] = { 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 };
+  std::copy(identity, identity + 6, mGeoTransform);
+  std::copy(identity, identity + 6, mInverseTransform);
   mImageSize = glm::ivec2(0, 0);
 }
-//geo_reference geo_reference::read(const std::string& /*tiffPath*/)
-//{
-//  return geo_reference();
-//}
+geo_reference geo_reference::read(const std::string& tiffPath)
+{
+  return geotiff_reader(tiffPath).geo();
+}
 }
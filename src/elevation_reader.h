@@ -2,6 +2,7 @@
 
 #include <stdexcept>
 #include "height_field.h"
+#include "span.h"
 
 namespace terrain
 {
@@ -11,11 +12,24 @@ namespace terrain
   {
   public:
     geo_reference(double* geo, double* inv, const int w, const int h);
+    // geo is the gdal style geo transform, the inverse is computed
+    geo_reference(const double* geo, const int w, const int h);
 
   public:
     uvec2 geoToImg(const geo& geo) const;
     geo imgToGeo(const uvec2& img) const;
 
+    // fractional pixel positions, in double precision
+    dvec2 geoToImgFractional(const dvec2& geo) const;
+    dvec2 imgToGeoFractional(const dvec2& img) const;
+
+    // batches, out must hold in.size() points and may be the same memory as in
+    // the float variants are computed in double and rounded once
+    void geoToImg(span<const dvec2> geo, span<dvec2> img) const;
+    void geoToImg(span<const vec2> geo, span<vec2> img) const;
+    void imgToGeo(span<const dvec2> img, span<dvec2> geo) const;
+    void imgToGeo(span<const vec2> img, span<vec2> geo) const;
+
     const uvec2& getPixelCount() const;
     const geo getOrigin() const;
     const vec2 getResolution() const;
@@ -27,6 +41,8 @@ namespace terrain
   private:
     mat32 mGeoToImageTransform;
     mat32 mImageToGeoTransform;
+    double mGeoTransform[6];     // gdal order
+    double mInverseTransform[6];
     uvec2 mImageSize;
   };
 }
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "erosion.h"
+
+namespace terrain
+{
+namespace
+{
+// rows per task, a band and its halo rows of all fields stay in L2
+const unsigned band_rows = 16;
+
+template<class F>
+void for_each_band(parallel::thread_pool& pool, const unsigned rows, const F& fn)
+{
+  pool.parallel_for((rows + band_rows - 1) / band_rows, [&](const unsigned band)
+  {
+    fn(band * band_rows, std::min((band + 1) * band_rows, rows));
+  });
+}
+}
+
+erosion::erosion(height_field& heights, const erosion_settings& settings)
+  : m_heights(heights)
+  , m_settings(settings)
+  , m_water(heights.size())
+  , m_sediment{ field<float>(heights.size()), field<float>(heights.size()) }
+  , m_current(0)
+  , m_flux(heights.size())
+  , m_velocity(heights.size())
+  , m_capacity(heights.size())
+  , m_thermal(heights.size())
+{ }
+
+erosion_stats erosion::run(const unsigned iterations, parallel::thread_pool& pool)
+{
+  const auto start = std::chrono::steady_clock::now();
+  const unsigned rows = m_heights.size().y;
+  for (unsigned i = 0; i < iterations; ++i)
+  {
+    for_each_band(pool, rows, [this](const unsigned y_begin, const unsigned y_end) { rain_and_flux(y_begin, y_end); });
+    for_each_band(pool, rows, [this](const unsigned y_begin, const unsigned y_end) { water_and_velocity(y_begin, y_end); });
+    for_each_band(pool, rows, [this](const unsigned y_begin, const unsigned y_end) { erode_and_deposit(y_begin, y_end); });
+    for_each_band(pool, rows, [this](const unsigned y_begin, const unsigned y_end) { transport_sediment(y_begin, y_end); });
+    m_current = 1 - m_current;
+    for_each_band(pool, rows, [this](const unsigned y_begin, const unsigned y_end) { thermal_outflow(y_begin, y_end); });
+    for_each_band(pool, rows, [this](const unsigned y_begin, const unsigned y_end) { thermal_apply(y_begin, y_end); });
+  }
+  m_heights.mark_dirty(uvec2(0), m_heights.size());
+
+  erosion_stats stats;
+  stats.iterations = iterations;
+  stats.cells = static_cast<std::uint64_t>(iterations) * m_heights.size().x * m_heights.size().y;
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+// accelerates the flux through the pipes by the difference of the water surface
+// the outflow is scaled down so a cell never loses more water than it has
+void erosion::rain_and_flux(const unsigned y_begin, const unsigned y_end)
+{
+  const uvec2 size(m_heights.size());
+  const vec2 cell(m_heights.resolution());
+  const float dt = m_settings.time_step;
+  const float acceleration = dt * m_settings.pipe_area * m_settings.gravity;
+
+  for (unsigned y = y_begin; y < y_end; ++y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const uvec2 pos(x, y);
+      // the rain is the same everywhere, it only counts for the volume, the water phase adds it
+      const float water = m_water(pos) + m_settings.rain_rate * dt;
+      const float surface = m_heights(pos) + m_water(pos);
+
+      // the border is closed
+      vec4 flux(m_flux(pos));
+      flux.x = x > 0 ? std::max(0.0f, flux.x + acceleration * (surface - m_heights(uvec2(x - 1, y)) - m_water(uvec2(x - 1, y))) / cell.x) : 0.0f;
+      flux.y = x + 1 < size.x ? std::max(0.0f, flux.y + acceleration * (surface - m_heights(uvec2(x + 1, y)) - m_water(uvec2(x + 1, y))) / cell.x) : 0.0f;
+      flux.z = y > 0 ? std::max(0.0f, flux.z + acceleration * (surface - m_heights(uvec2(x, y - 1)) - m_water(uvec2(x, y - 1))) / cell.y) : 0.0f;
+      flux.w = y + 1 < size.y ? std::max(0.0f, flux.w + acceleration * (surface - m_heights(uvec2(x, y + 1)) - m_water(uvec2(x, y + 1))) / cell.y) : 0.0f;
+
+      const float outflow = (flux.x + flux.y + flux.z + flux.w) * dt;
+      const float volume = water * cell.x * cell.y;
+      if (outflow > volume)
+      {
+        flux *= volume / outflow;
+      }
+      m_flux(pos) = flux;
+    }
+  }
+}
+
+// adds the rain and moves the water by the flux, derives the velocity from the flux through the cell
+// and the sediment capacity from velocity, tilt and depth
+void erosion::water_and_velocity(const unsigned y_begin, const unsigned y_end)
+{
+  const uvec2 size(m_heights.size());
+  const vec2 cell(m_heights.resolution());
+  const float dt = m_settings.time_step;
+  const vec4 none(0.0f);
+
+  for (unsigned y = y_begin; y < y_end; ++y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const uvec2 pos(x, y);
+      const vec4& out = m_flux(pos);
+      const vec4& left = x > 0 ? m_flux(uvec2(x - 1, y)) : none;
+      const vec4& right = x + 1 < size.x ? m_flux(uvec2(x + 1, y)) : none;
+      const vec4& top = y > 0 ? m_flux(uvec2(x, y - 1)) : none;
+      const vec4& bottom = y + 1 < size.y ? m_flux(uvec2(x, y + 1)) : none;
+
+      const float inflow = left.y + right.x + top.w + bottom.z;
+      const float outflow = out.x + out.y + out.z + out.w;
+      float& water = m_water(pos);
+      const float old_water = water;
+      water = std::max(0.0f, water + m_settings.rain_rate * dt + dt * (inflow - outflow) / (cell.x * cell.y));
+
+      const float mean_water = 0.5f * (old_water + water);
+      vec2 velocity(0.0f);
+      if (mean_water > 1e-4f)
+      {
+        velocity.x = 0.5f * (left.y - out.x + out.y - right.x) / (cell.y * mean_water);
+        velocity.y = 0.5f * (top.w - out.z + out.w - bottom.z) / (cell.x * mean_water);
+      }
+      m_velocity(pos) = velocity;
+
+      // sine of the tilt from the central differences of the terrain
+      const float dx = (m_heights(uvec2(x + 1 < size.x ? x + 1 : x, y)) - m_heights(uvec2(x > 0 ? x - 1 : x, y))) / (2.0f * cell.x);
+      const float dy = (m_heights(uvec2(x, y + 1 < size.y ? y + 1 : y)) - m_heights(uvec2(x, y > 0 ? y - 1 : y))) / (2.0f * cell.y);
+      const float slope2 = dx * dx + dy * dy;
+      const float sin_tilt = std::max(std::sqrt(slope2 / (1.0f + slope2)), m_settings.min_tilt);
+      // the water carries the sediment, a film of water carries little however fast it is
+      m_capacity(pos) = m_settings.capacity * sin_tilt * std::sqrt(velocity.x * velocity.x + velocity.y * velocity.y) * water;
+    }
+  }
+}
+
+// cell local, takes terrain up below capacity and drops sediment above it
+void erosion::erode_and_deposit(const unsigned y_begin, const unsigned y_end)
+{
+  const uvec2 size(m_heights.size());
+  const float dt = m_settings.time_step;
+  field<float>& sediment(m_sediment[m_current]);
+
+  for (unsigned y = y_begin; y < y_end; ++y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const uvec2 pos(x, y);
+      const float capacity = m_capacity(pos);
+      float& s = sediment(pos);
+      const float amount = capacity > s
+        ? dt * m_settings.dissolving * (capacity - s)
+        : -std::min(dt * m_settings.deposition * (s - capacity), s);
+      m_heights(pos) -= amount;
+      s += amount;
+
+      m_water(pos) *= 1.0f - m_settings.evaporation * dt;
+    }
+  }
+}
+
+// every cell moves its sediment one step along its velocity and splats it bilinearly on the cells there
+// the step is at most a cell, so a cell gathers what it receives from its 3x3 neighbourhood
+// the splat weights of a source sum to one, the sediment is conserved
+void erosion::transport_sediment(const unsigned y_begin, const unsigned y_end)
+{
+  const uvec2 size(m_heights.size());
+  const vec2 cell(m_heights.resolution());
+  const float dt = m_settings.time_step;
+  const field<float>& from(m_sediment[m_current]);
+  field<float>& to(m_sediment[1 - m_current]);
+  const vec2 last(size - 1u);
+
+  for (unsigned y = y_begin; y < y_end; ++y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const vec2 pos(static_cast<float>(x), static_cast<float>(y));
+      float received = 0.0f;
+      for (unsigned sy = y > 0 ? y - 1 : y; sy <= std::min(y + 1, size.y - 1); ++sy)
+      {
+        for (unsigned sx = x > 0 ? x - 1 : x; sx <= std::min(x + 1, size.x - 1); ++sx)
+        {
+          const uvec2 source(sx, sy);
+          const vec2 step(glm::clamp(m_velocity(source) * dt / cell, vec2(-1.0f), vec2(1.0f)));
+          const vec2 target(glm::clamp(vec2(source) + step, vec2(0.0f), last));
+          const vec2 weight(glm::max(vec2(1.0f) - glm::abs(target - pos), vec2(0.0f)));
+          received += weight.x * weight.y * from(source);
+        }
+      }
+      to(uvec2(x, y)) = received;
+    }
+  }
+}
+
+// material above the talus slope slides to the lower neighbours, in proportion to their excess
+void erosion::thermal_outflow(const unsigned y_begin, const unsigned y_end)
+{
+  const uvec2 size(m_heights.size());
+  const vec2 cell(m_heights.resolution());
+  const float dt = m_settings.time_step;
+  const float talus = std::tan(m_settings.talus_angle);
+  const vec4 talus_height(talus * cell.x, talus * cell.x, talus * cell.y, talus * cell.y);
+
+  for (unsigned y = y_begin; y < y_end; ++y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const uvec2 pos(x, y);
+      const float h = m_heights(pos);
+      const vec4 drop(x > 0 ? h - m_heights(uvec2(x - 1, y)) : 0.0f
+                      , x + 1 < size.x ? h - m_heights(uvec2(x + 1, y)) : 0.0f
+                      , y > 0 ? h - m_heights(uvec2(x, y - 1)) : 0.0f
+                      , y + 1 < size.y ? h - m_heights(uvec2(x, y + 1)) : 0.0f);
+      const vec4 excess(glm::max(drop - talus_height, vec4(0.0f)));
+      const float total = excess.x + excess.y + excess.z + excess.w;
+      if (total <= 0.0f)
+      {
+        m_thermal(pos) = vec4(0.0f);
+        continue;
+      }
+
+      // half the largest excess levels that pair, moving more would overshoot
+      const float largest = std::max(std::max(excess.x, excess.y), std::max(excess.z, excess.w));
+      const float moved = std::min(dt * m_settings.thermal_rate, 1.0f) * 0.5f * largest;
+      m_thermal(pos) = excess * (moved / total);
+    }
+  }
+}
+
+void erosion::thermal_apply(const unsigned y_begin, const unsigned y_end)
+{
+  const uvec2 size(m_heights.size());
+
+  for (unsigned y = y_begin; y < y_end; ++y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const uvec2 pos(x, y);
+      const vec4& out = m_thermal(pos);
+      float inflow = 0.0f;
+      inflow += x > 0 ? m_thermal(uvec2(x - 1, y)).y : 0.0f;
+      inflow += x + 1 < size.x ? m_thermal(uvec2(x + 1, y)).x : 0.0f;
+      inflow += y > 0 ? m_thermal(uvec2(x, y - 1)).w : 0.0f;
+      inflow += y + 1 < size.y ? m_thermal(uvec2(x, y + 1)).z : 0.0f;
+      m_heights(pos) += inflow - (out.x + out.y + out.z + out.w);
+    }
+  }
+}
+}
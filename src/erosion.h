@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+
+#include "types.h"
+#include "field.h"
+#include "height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+  struct erosion_settings
+  {
+    erosion_settings()
+      : time_step(0.02f)
+      , rain_rate(0.012f)
+      , evaporation(0.015f)
+      , pipe_area(1.0f)
+      , gravity(9.81f)
+      , capacity(1.0f)
+      , dissolving(0.5f)
+      , deposition(1.0f)
+      , min_tilt(0.05f)
+      , talus_angle(0.6f)
+      , thermal_rate(0.5f)
+    { }
+
+    float time_step;
+    float rain_rate;    // water height per second on every cell
+    float evaporation;  // fraction of the water per second
+    float pipe_area;    // cross section of the virtual pipes between cells
+    float gravity;
+    float capacity;     // sediment the water can carry per unit of speed, tilt and depth
+    float dissolving;   // rate of taking up terrain below capacity
+    float deposition;   // rate of dropping sediment above capacity
+    float min_tilt;     // keeps flat water eroding a little
+    float talus_angle;  // radians, steeper slopes collapse in thermal erosion
+    float thermal_rate; // fraction of the excess slope moved per second
+  };
+
+  struct erosion_stats
+  {
+    erosion_stats()
+      : iterations(0)
+      , cells(0)
+      , seconds(0.0)
+    { }
+
+    double cells_per_second() const
+    {
+      return seconds > 0.0 ? static_cast<double>(cells) / seconds : 0.0;
+    }
+
+    unsigned iterations;
+    std::uint64_t cells; // cell updates, iterations * cell count
+    double seconds;
+  };
+
+// grid based hydraulic erosion with the virtual pipe model (Mei et al. 2007) followed by thermal erosion
+// works in place on the heights, water, sediment and outflow flux are kept between runs
+// every iteration runs in phases over bands of rows, a phase only reads fields of the phases before
+// and writes its own cells, so the bands read their halo rows without locks and the result
+// does not depend on the thread count
+  class erosion
+  {
+  public:
+    // the field must outlive the simulation
+    erosion(height_field& heights, const erosion_settings& settings = erosion_settings());
+
+    // marks the whole height field dirty
+    erosion_stats run(const unsigned iterations, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+    const erosion_settings& settings() const
+    {
+      return m_settings;
+    }
+
+    const field<float>& water() const
+    {
+      return m_water;
+    }
+
+    const field<float>& sediment() const
+    {
+      return m_sediment[m_current];
+    }
+
+  private:
+    void rain_and_flux(const unsigned y_begin, const unsigned y_end);
+    void water_and_velocity(const unsigned y_begin, const unsigned y_end);
+    void erode_and_deposit(const unsigned y_begin, const unsigned y_end);
+    void transport_sediment(const unsigned y_begin, const unsigned y_end);
+    void thermal_outflow(const unsigned y_begin, const unsigned y_end);
+    void thermal_apply(const unsigned y_begin, const unsigned y_end);
+
+  private:
+    height_field& m_heights;
+    erosion_settings m_settings;
+
+    field<float> m_water;
+    field<float> m_sediment[2]; // double buffered for the advection
+    unsigned m_current;
+    field<vec4> m_flux;         // outflow to x-, x+, y-, y+
+    field<vec2> m_velocity;
+    field<float> m_capacity;
+    field<vec4> m_thermal;      // material leaving to x-, x+, y-, y+
+  };
+}
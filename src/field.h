@@ -1,32 +1,117 @@
 #pragma once
 
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "types.h"
+#include "thread_pool.h"
+#include "field_layout.h"
+
 namespace terrain
 {
+// [begin, end) in samples
+  struct region
+  {
+    uvec2 begin;
+    uvec2 end;
+  };
+
 // field specialized for discrete 2d values
 // maps x,y to T
 // T is nullable
-  template<typename T>
+// Layout decides the order of the values in the buffer, see field_layout.h
+  template<typename T, typename Layout = row_major_layout>
   class field
   {
   public:
     using value_t = T;
+    using layout_t = Layout;
     using ptr = std::shared_ptr<field>;
     using buffer_t = std::vector<value_t>;
 
   public:
-    class perpixel_generator
+    // fills a contiguous run of a row per call
+    // the virtual dispatch is paid once per run instead of once per pixel
+    class perrow_generator
     {
     public:
-      perpixel_generator(field<value_t>& f)
+      perrow_generator(field& f)
         : m_field(f)
       { }
+
+      virtual ~perrow_generator()
+      { }
+
+    public:
+      // writes the values of [pos.x, pos.x + count) in row pos.y to out
+      virtual void operator ()(const uvec2& pos, const unsigned count, value_t* out) const = 0;
+
+    public:
+      void generate()
+      {
+        generate(parallel::thread_pool::instance(), m_field.size());
+      }
+
+      // tiles are generated in parallel, every pixel is computed by the same call as in the serial path
+      // so the result is identical to generate()
+      void generate(parallel::thread_pool& pool, const uvec2& tile_size = default_tile_size())
+      {
+        parallel::for_each_tile(pool, m_field.size(), tile_size, [this](const uvec2& begin, const uvec2& end)
+        {
+          buffer_t row;
+          for (unsigned y = begin.y; y < end.y; ++y)
+          {
+            const uvec2 pos(begin.x, y);
+            const unsigned count = end.x - begin.x;
+            if (m_field.layout().row_run(pos) >= count)
+            {
+              (*this)(pos, count, &m_field(pos));
+              continue;
+            }
+
+            // the row is split in the storage, generate it aside and scatter
+            row.resize(count);
+            (*this)(pos, count, &row[0]);
+            for (unsigned i = 0; i < count; ++i)
+            {
+              m_field(uvec2(pos.x + i, y)) = row[i];
+            }
+          }
+        });
+      }
+
+      // 128x128 floats, a tile fits in L2
+      static uvec2 default_tile_size()
+      {
+        return uvec2(128, 128);
+      }
+
+    protected:
+      field& m_field;
+    };
+
+    class perpixel_generator : public perrow_generator
+    {
+    public:
+      perpixel_generator(field& f)
+        : perrow_generator(f)
+      { }
     public:
       virtual value_t operator ()(const uvec2& pos) const = 0;
 
+      void operator ()(const uvec2& pos, const unsigned count, value_t* out) const override
+      {
+        uvec2 p(pos);
+        for (unsigned i = 0; i < count; ++i, ++p.x)
+          out[i] = (*this)(p);
+      }
+
     public:
+      using perrow_generator::generate;
+
       void generate()
       {
         uvec2 pos;
@@ -36,23 +121,56 @@ namespace terrain
       }
 
     protected:
-      field<value_t>& m_field;
+      using perrow_generator::m_field;
     };
 
   public:
     field(const uvec2& size)
       : m_size(size)
-      , m_buffer(m_size.s * m_size.t, static_cast<value_t>(0))
+      , m_layout(size)
+      , m_buffer(m_layout.storage_size(), static_cast<value_t>(0))
+      , m_data(m_buffer.data())
+    { }
+
+    // copies own the values, also when other views external storage
+    field(const field& other)
+      : m_size(other.m_size)
+      , m_layout(other.m_layout)
+      , m_buffer(other.m_data, other.m_data + other.m_layout.storage_size())
+      , m_data(m_buffer.data())
+    { }
+
+    field(field&& other)
+      : m_size(other.m_size)
+      , m_layout(other.m_layout)
+      , m_buffer(std::move(other.m_buffer))
+      , m_data(other.m_storage ? other.m_data : m_buffer.data())
+      , m_storage(std::move(other.m_storage))
+    {
+      other.m_data = other.m_buffer.data();
+    }
+
+    field& operator = (field other)
+    {
+      std::swap(m_size, other.m_size);
+      std::swap(m_layout, other.m_layout);
+      m_buffer.swap(other.m_buffer);
+      m_data = other.m_storage ? other.m_data : m_buffer.data();
+      m_storage.swap(other.m_storage);
+      return *this;
+    }
+
+    virtual ~field()
     { }
 
     const value_t& operator()(const uvec2& pos) const
     {
-      return m_buffer[index(pos)];
+      return m_data[index(pos)];
     }
 
     value_t& operator()(const uvec2& pos)
     {
-      return m_buffer[index(pos)];
+      return m_data[index(pos)];
     }
 
     const uvec2& size() const
@@ -60,24 +178,73 @@ namespace terrain
       return m_size;
     }
 
+    const layout_t& layout() const
+    {
+      return m_layout;
+    }
+
+    // values in storage order, that is row-major only with row_major_layout
+    // use copy_row_major() for texture upload from the other layouts
     const value_t* data() const
     {
-      return &m_buffer[0];
+      return m_data;
     }
 
+    // data must be in storage order
+    // detaches external storage, data receives the owned buffer (empty in that case)
     void swap_data(buffer_t& data)
     {
       m_buffer.swap(data);
+      m_data = m_buffer.data();
+      m_storage.reset();
     }
 
+    // writes size().x * size().y values to out in row-major order
+    void copy_row_major(value_t* out, parallel::thread_pool& pool = parallel::thread_pool::instance()) const
+    {
+      const row_major_layout out_layout(m_size);
+      parallel::for_each_tile(pool, m_size, uvec2(64, 64), [&](const uvec2& begin, const uvec2& end)
+      {
+        copy_layout_region(m_layout, data(), out_layout, out, begin, end);
+      });
+    }
+
+    // converts other into this layout, the sizes must match
+    template<typename OtherLayout>
+    void assign(const field<value_t, OtherLayout>& other, parallel::thread_pool& pool = parallel::thread_pool::instance())
+    {
+      if (other.size() != m_size)
+      {
+        throw std::runtime_error(std::string("field size mismatch"));
+      }
+
+      parallel::for_each_tile(pool, m_size, uvec2(64, 64), [&](const uvec2& begin, const uvec2& end)
+      {
+        copy_layout_region(other.layout(), other.data(), m_layout, m_data, begin, end);
+      });
+    }
+
+  protected:
+    // views data owned by storage (e.g. a file mapping) instead of allocating a buffer
+    // data must hold layout_t(size).storage_size() values
+    field(const uvec2& size, value_t* data, const std::shared_ptr<void>& storage)
+      : m_size(size)
+      , m_layout(size)
+      , m_data(data)
+      , m_storage(storage)
+    { }
+
   private:
     unsigned index(const uvec2& pos) const
     {
-      return pos.s + m_size.s * pos.t;
+      return m_layout.index(pos);
     }
 
   private:
     uvec2 m_size;
+    layout_t m_layout;
     buffer_t m_buffer;
+    value_t* m_data;
+    std::shared_ptr<void> m_storage;
   };
 }
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+
+#include "types.h"
+
+namespace terrain
+{
+// storage layout policies for field
+// a layout maps x,y to the position of the value in the buffer
+// row_run(pos) is the number of values starting at pos along x that are stored next to each other
+
+// x + width * y
+  class row_major_layout
+  {
+  public:
+    row_major_layout(const uvec2& size)
+      : m_width(size.x)
+      , m_storage_size(size.x * size.y)
+    { }
+
+    unsigned storage_size() const
+    {
+      return m_storage_size;
+    }
+
+    unsigned index(const uvec2& pos) const
+    {
+      return pos.x + m_width * pos.y;
+    }
+
+    unsigned row_run(const uvec2& pos) const
+    {
+      return m_width - pos.x;
+    }
+
+  private:
+    unsigned m_width;
+    unsigned m_storage_size;
+  };
+
+// square tiles of 2^tile_bits, tiles and the pixels inside the tiles are row-major
+// the size is padded up to whole tiles
+  template<unsigned tile_bits = 6>
+  class tiled_layout
+  {
+  public:
+    static const unsigned tile_size = 1u << tile_bits;
+
+  public:
+    tiled_layout(const uvec2& size)
+      : m_tiles_x((size.x + tile_size - 1) >> tile_bits)
+      , m_storage_size(m_tiles_x * ((size.y + tile_size - 1) >> tile_bits) * tile_size * tile_size)
+    { }
+
+    unsigned storage_size() const
+    {
+      return m_storage_size;
+    }
+
+    unsigned index(const uvec2& pos) const
+    {
+      const unsigned tile = (pos.x >> tile_bits) + m_tiles_x * (pos.y >> tile_bits);
+      return (tile << (2 * tile_bits)) + ((pos.y & (tile_size - 1)) << tile_bits) + (pos.x & (tile_size - 1));
+    }
+
+    unsigned row_run(const uvec2& pos) const
+    {
+      return tile_size - (pos.x & (tile_size - 1));
+    }
+
+  private:
+    unsigned m_tiles_x;
+    unsigned m_storage_size;
+  };
+
+// Z-order inside square blocks of 2^block_bits, the blocks are row-major
+// blocking keeps the padding small for fields that are far from square
+  template<unsigned block_bits = 8>
+  class morton_layout
+  {
+  public:
+    static const unsigned block_size = 1u << block_bits;
+
+  public:
+    morton_layout(const uvec2& size)
+      : m_blocks_x((size.x + block_size - 1) >> block_bits)
+      , m_storage_size(m_blocks_x * ((size.y + block_size - 1) >> block_bits) * block_size * block_size)
+    { }
+
+    unsigned storage_size() const
+    {
+      return m_storage_size;
+    }
+
+    unsigned index(const uvec2& pos) const
+    {
+      const unsigned block = (pos.x >> block_bits) + m_blocks_x * (pos.y >> block_bits);
+      return (block << (2 * block_bits)) + spread_bits(pos.x & (block_size - 1)) + (spread_bits(pos.y & (block_size - 1)) << 1);
+    }
+
+    unsigned row_run(const uvec2& pos) const
+    {
+      return 2 - (pos.x & 1);
+    }
+
+  private:
+    // 0b1011 -> 0b01000101
+    static unsigned spread_bits(unsigned v)
+    {
+      v = (v | (v << 8)) & 0x00ff00ffu;
+      v = (v | (v << 4)) & 0x0f0f0f0fu;
+      v = (v | (v << 2)) & 0x33333333u;
+      v = (v | (v << 1)) & 0x55555555u;
+      return v;
+    }
+
+  private:
+    unsigned m_blocks_x;
+    unsigned m_storage_size;
+  };
+
+// copies [begin, end) from src to dst, runs that are contiguous in both layouts are copied at once
+  template<typename T, typename SrcLayout, typename DstLayout>
+  void copy_layout_region(const SrcLayout& src_layout, const T* src, const DstLayout& dst_layout, T* dst, const uvec2& begin, const uvec2& end)
+  {
+    for (unsigned y = begin.y; y < end.y; ++y)
+    {
+      uvec2 pos(begin.x, y);
+      while (pos.x < end.x)
+      {
+        const unsigned run = std::min(end.x - pos.x, std::min(src_layout.row_run(pos), dst_layout.row_run(pos)));
+        const T* from = src + src_layout.index(pos);
+        std::copy(from, from + run, dst + dst_layout.index(pos));
+        pos.x += run;
+      }
+    }
+  }
+}
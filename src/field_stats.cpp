@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
+
+#include "field_stats.h"
+
+namespace terrain
+{
+namespace
+{
+// rows per task of compute()
+const unsigned band_rows = 64;
+
+// values per partial float sum, the partial sums are added in double
+const unsigned sum_block = 1024;
+
+// the smallest power of two >= v
+double ceil_pow2(const double v)
+{
+  int exponent;
+  const double mantissa = std::frexp(v, &exponent);
+  return mantissa == 0.5 ? v : std::ldexp(1.0, exponent);
+}
+}
+
+field_stats::field_stats(const unsigned bin_count, const value_t nodata)
+  : m_nodata(nodata)
+  , m_count(0)
+  , m_nodata_count(0)
+  , m_min(std::numeric_limits<value_t>::max())
+  , m_max(std::numeric_limits<value_t>::lowest())
+  , m_sum(0.0)
+  , m_bins(std::max(bin_count, 1u), 0)
+  , m_bin_width(0.0)
+  , m_first_bin(0.0)
+{ }
+
+void field_stats::add(const value_t* values, const unsigned count)
+{
+  value_t lo(std::numeric_limits<value_t>::max());
+  value_t hi(std::numeric_limits<value_t>::lowest());
+  std::uint64_t valid(0);
+
+  unsigned i = 0;
+#ifdef TERRAIN_SSE2
+  {
+    static const unsigned bit_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    const __m128 nodata = _mm_set1_ps(m_nodata);
+    const __m128 positive_max = _mm_set1_ps(lo);
+    const __m128 negative_max = _mm_set1_ps(hi);
+    __m128 lo4 = positive_max;
+    __m128 hi4 = negative_max;
+    while (i + 4 <= count)
+    {
+      const unsigned block_end = std::min(i + sum_block, count & ~3u);
+      __m128 sum4 = _mm_setzero_ps();
+      for (; i < block_end; i += 4)
+      {
+        const __m128 v = _mm_loadu_ps(values + i);
+        // NaN compares unordered with itself
+        const __m128 mask = _mm_andnot_ps(_mm_cmpeq_ps(v, nodata), _mm_cmpord_ps(v, v));
+        lo4 = _mm_min_ps(lo4, _mm_or_ps(_mm_and_ps(mask, v), _mm_andnot_ps(mask, positive_max)));
+        hi4 = _mm_max_ps(hi4, _mm_or_ps(_mm_and_ps(mask, v), _mm_andnot_ps(mask, negative_max)));
+        sum4 = _mm_add_ps(sum4, _mm_and_ps(mask, v));
+        valid += bit_count[_mm_movemask_ps(mask)];
+      }
+
+      float sums[4];
+      _mm_storeu_ps(sums, sum4);
+      m_sum += static_cast<double>(sums[0]) + sums[1] + sums[2] + sums[3];
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, lo4);
+    lo = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, hi4);
+    hi = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+  }
+#endif
+  for (; i < count; ++i)
+  {
+    const value_t v = values[i];
+    if (v == v && v != m_nodata)
+    {
+      lo = std::min(lo, v);
+      hi = std::max(hi, v);
+      m_sum += v;
+      ++valid;
+    }
+  }
+
+  m_nodata_count += count - valid;
+  if (valid == 0)
+  {
+    return;
+  }
+
+  // the run is usually a row or a tile that is still in cache for the second look
+  fit(lo, hi, 0.0);
+  m_count += valid;
+  m_min = std::min(m_min, lo);
+  m_max = std::max(m_max, hi);
+  add_to_bins(values, count);
+}
+
+void field_stats::merge(const field_stats& other)
+{
+  m_nodata_count += other.m_nodata_count;
+  if (other.m_count == 0)
+  {
+    return;
+  }
+
+  fit(other.m_min, other.m_max, other.m_bin_width);
+  const double factor = m_bin_width / other.m_bin_width;
+  for (unsigned i = 0; i < other.bin_count(); ++i)
+  {
+    if (other.m_bins[i] != 0)
+    {
+      const double bin = std::floor((other.m_first_bin + i) / factor) - m_first_bin;
+      m_bins[static_cast<std::size_t>(bin)] += other.m_bins[i];
+    }
+  }
+
+  m_count += other.m_count;
+  m_min = std::min(m_min, other.m_min);
+  m_max = std::max(m_max, other.m_max);
+  m_sum += other.m_sum;
+}
+
+field_stats::value_t field_stats::min() const
+{
+  return m_count > 0 ? m_min : 0.0f;
+}
+
+field_stats::value_t field_stats::max() const
+{
+  return m_count > 0 ? m_max : 0.0f;
+}
+
+double field_stats::mean() const
+{
+  return m_count > 0 ? m_sum / static_cast<double>(m_count) : 0.0;
+}
+
+field_stats::value_t field_stats::quantile(const float q) const
+{
+  if (m_count == 0)
+  {
+    return 0.0f;
+  }
+
+  const double target = std::min(std::max(static_cast<double>(q), 0.0), 1.0) * static_cast<double>(m_count);
+  double below = 0.0;
+  for (unsigned i = 0; i < bin_count(); ++i)
+  {
+    const double n = static_cast<double>(m_bins[i]);
+    if (n > 0.0 && below + n >= target)
+    {
+      const double v = bin_begin(i) + (target - below) / n * m_bin_width;
+      return std::min(std::max(static_cast<value_t>(v), m_min), m_max);
+    }
+    below += n;
+  }
+  return m_max;
+}
+
+void field_stats::fit(const value_t lo, const value_t hi, const double min_width)
+{
+  const double n = static_cast<double>(bin_count());
+  const double total_lo = m_bin_width > 0.0 ? std::min(m_min, lo) : lo;
+  const double total_hi = m_bin_width > 0.0 ? std::max(m_max, hi) : hi;
+
+  // floor on the width keeps the bin indices of constant runs far from the double mantissa limit
+  const double magnitude = std::max(std::abs(total_lo), std::abs(total_hi));
+  double width = ceil_pow2(std::max(std::max((total_hi - total_lo) / n, magnitude * 1e-6), 1e-12));
+  width = std::max(width, std::max(m_bin_width, min_width));
+  while (std::floor(total_hi / width) - std::floor(total_lo / width) >= n)
+  {
+    width *= 2.0;
+  }
+  const double first = std::floor(total_lo / width);
+
+  if (width == m_bin_width && first == m_first_bin)
+  {
+    return;
+  }
+
+  // fold the old bins into the new ones, both are aligned to their power of two width
+  std::vector<std::uint64_t> bins(m_bins.size(), 0);
+  if (m_bin_width > 0.0)
+  {
+    const double factor = width / m_bin_width;
+    for (unsigned i = 0; i < bin_count(); ++i)
+    {
+      if (m_bins[i] != 0)
+      {
+        const double bin = std::floor((m_first_bin + i) / factor) - first;
+        bins[static_cast<std::size_t>(bin)] += m_bins[i];
+      }
+    }
+  }
+
+  m_bins.swap(bins);
+  m_bin_width = width;
+  m_first_bin = first;
+}
+
+void field_stats::add_to_bins(const value_t* values, const unsigned count)
+{
+  const double origin = m_first_bin * m_bin_width;
+  const double inv_width = 1.0 / m_bin_width;
+  const int last_bin = static_cast<int>(bin_count()) - 1;
+
+  unsigned i = 0;
+#ifdef TERRAIN_SSE2
+  {
+    // float is exact enough here, a value on a bin edge may land in the neighbour bin
+    const __m128 nodata = _mm_set1_ps(m_nodata);
+    const __m128 origin4 = _mm_set1_ps(static_cast<float>(origin));
+    const __m128 inv_width4 = _mm_set1_ps(static_cast<float>(inv_width));
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 last4 = _mm_set1_ps(static_cast<float>(last_bin));
+    for (; i + 4 <= count; i += 4)
+    {
+      const __m128 v = _mm_loadu_ps(values + i);
+      const int mask = _mm_movemask_ps(_mm_andnot_ps(_mm_cmpeq_ps(v, nodata), _mm_cmpord_ps(v, v)));
+      const __m128 bin = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(v, origin4), inv_width4), zero), last4);
+      int bins[4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(bins), _mm_cvttps_epi32(bin));
+      for (int lane = 0; lane < 4; ++lane)
+      {
+        if (mask & (1 << lane))
+        {
+          ++m_bins[bins[lane]];
+        }
+      }
+    }
+  }
+#endif
+  for (; i < count; ++i)
+  {
+    const value_t v = values[i];
+    if (v == v && v != m_nodata)
+    {
+      const double bin = std::min(std::max(std::floor((v - origin) * inv_width), 0.0), static_cast<double>(last_bin));
+      ++m_bins[static_cast<std::size_t>(bin)];
+    }
+  }
+}
+
+// static
+field_stats field_stats::compute(const height_field& field, const unsigned bin_count, const value_t nodata, parallel::thread_pool& pool)
+{
+  const uvec2 size(field.size());
+  const unsigned band_count = (size.y + band_rows - 1) / band_rows;
+  std::vector<field_stats> bands(band_count, field_stats(bin_count, nodata));
+  pool.parallel_for(band_count, [&](const unsigned band)
+  {
+    const unsigned y_end = std::min((band + 1) * band_rows, size.y);
+    for (unsigned y = band * band_rows; y < y_end; ++y)
+    {
+      bands[band].add(&field(uvec2(0, y)), size.x);
+    }
+  });
+
+  field_stats result(bin_count, nodata);
+  for (const field_stats& band : bands)
+  {
+    result.merge(band);
+  }
+  return result;
+}
+
+// static
+field_stats field_stats::compute(const tiled_height_field& field, const unsigned bin_count, const value_t nodata, parallel::thread_pool& pool)
+{
+  const uvec2 tile_count(field.tile_count());
+  const unsigned tile_size(field.tile_size());
+  std::vector<field_stats> bands(tile_count.y, field_stats(bin_count, nodata));
+  pool.parallel_for(tile_count.y, [&](const unsigned band)
+  {
+    for (unsigned x = 0; x < tile_count.x; ++x)
+    {
+      const uvec2 tile_pos(x, band);
+      const tiled_height_field::tile_ptr tile(field.get_tile(tile_pos));
+      const uvec2 valid(glm::min(uvec2(tile_size), field.size() - tile_pos * tile_size));
+      for (unsigned y = 0; y < valid.y; ++y)
+      {
+        bands[band].add(&tile->values[y * tile_size], valid.x);
+      }
+    }
+  });
+
+  field_stats result(bin_count, nodata);
+  for (const field_stats& band : bands)
+  {
+    result.merge(band);
+  }
+  return result;
+}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "types.h"
+#include "height_field.h"
+#include "tiled_height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// min, max, mean, nodata count and a histogram of height values, gathered in one pass
+// the histogram bins are power of two wide and aligned to multiples of their width,
+// so results of different tiles merge exactly: the finer one is folded into the coarser bins
+// quantiles are interpolated inside a bin, their error is at most bin_width()
+  class field_stats
+  {
+  public:
+    using value_t = height_field::value_t;
+
+    static const unsigned default_bin_count = 1024;
+
+  public:
+    // NaN is always nodata, values equal to nodata as well
+    explicit field_stats(const unsigned bin_count = default_bin_count, const value_t nodata = std::numeric_limits<value_t>::quiet_NaN());
+
+    void add(const value_t* values, const unsigned count);
+    void merge(const field_stats& other);
+
+    // number of valid values
+    std::uint64_t count() const
+    {
+      return m_count;
+    }
+
+    std::uint64_t nodata_count() const
+    {
+      return m_nodata_count;
+    }
+
+    // of the valid values, 0 without any
+    value_t min() const;
+    value_t max() const;
+    double mean() const;
+
+    // q in [0, 1], e.g. quantile(0.02f) and quantile(0.98f) for a contrast stretch
+    value_t quantile(const float q) const;
+
+    unsigned bin_count() const
+    {
+      return static_cast<unsigned>(m_bins.size());
+    }
+
+    double bin_width() const
+    {
+      return m_bin_width;
+    }
+
+    // lower edge of bin i
+    double bin_begin(const unsigned i) const
+    {
+      return (m_first_bin + static_cast<double>(i)) * m_bin_width;
+    }
+
+    std::uint64_t bin(const unsigned i) const
+    {
+      return m_bins[i];
+    }
+
+  public:
+    // rows are split in bands over the pool, the band results are merged
+    static field_stats compute(const height_field& field, const unsigned bin_count = default_bin_count, const value_t nodata = std::numeric_limits<value_t>::quiet_NaN(), parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+    // one row of tiles per task through the tile cache, like the bands above, the padding of the edge tiles is skipped
+    static field_stats compute(const tiled_height_field& field, const unsigned bin_count = default_bin_count, const value_t nodata = std::numeric_limits<value_t>::quiet_NaN(), parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+  private:
+    // makes the histogram cover [lo, hi] with bins at least min_width wide
+    void fit(const value_t lo, const value_t hi, const double min_width);
+    void add_to_bins(const value_t* values, const unsigned count);
+
+  private:
+    value_t m_nodata;
+    std::uint64_t m_count;
+    std::uint64_t m_nodata_count;
+    value_t m_min;
+    value_t m_max;
+    double m_sum;
+
+    std::vector<std::uint64_t> m_bins;
+    double m_bin_width;     // 0 while empty
+    double m_first_bin;     // integer, the first bin covers [m_first_bin, m_first_bin + 1) * m_bin_width
+  };
+}
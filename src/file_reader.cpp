@@ -0,0 +1,114 @@
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "file_reader.h"
+
+namespace io
+{
+#ifdef _WIN32
+file_reader::file_reader(const std::string& path)
+  : m_path(path)
+  , m_size(0)
+  , m_file(INVALID_HANDLE_VALUE)
+{
+  m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+  if (m_file == INVALID_HANDLE_VALUE)
+  {
+    throw std::runtime_error(std::string("Could not open file: ") + path);
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(m_file, &size))
+  {
+    CloseHandle(m_file);
+    throw std::runtime_error(std::string("Could not get file size: ") + path);
+  }
+  m_size = static_cast<std::uint64_t>(size.QuadPart);
+}
+
+file_reader::~file_reader()
+{
+  CloseHandle(m_file);
+}
+
+void file_reader::read(const std::uint64_t offset, const std::size_t size, void* out) const
+{
+  char* dst = static_cast<char*>(out);
+  std::uint64_t position = offset;
+  std::size_t left = size;
+  while (left > 0)
+  {
+    // ReadFile takes at most 4GB per call, the offset goes in the OVERLAPPED
+    const DWORD chunk = static_cast<DWORD>(left < 0x40000000u ? left : 0x40000000u);
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(position);
+    overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+    DWORD read(0);
+    if (!ReadFile(m_file, dst, chunk, &read, &overlapped) || read == 0)
+    {
+      throw std::runtime_error(std::string("Could not read file: ") + m_path);
+    }
+    dst += read;
+    position += read;
+    left -= read;
+  }
+}
+#else
+file_reader::file_reader(const std::string& path)
+  : m_path(path)
+  , m_size(0)
+  , m_file(-1)
+{
+  m_file = open(path.c_str(), O_RDONLY);
+  if (m_file < 0)
+  {
+    throw std::runtime_error(std::string("Could not open file: ") + path);
+  }
+
+  struct stat st;
+  if (fstat(m_file, &st) != 0)
+  {
+    close(m_file);
+    throw std::runtime_error(std::string("Could not get file size: ") + path);
+  }
+  m_size = static_cast<std::uint64_t>(st.st_size);
+}
+
+file_reader::~file_reader()
+{
+  close(m_file);
+}
+
+void file_reader::read(const std::uint64_t offset, const std::size_t size, void* out) const
+{
+  char* dst = static_cast<char*>(out);
+  std::uint64_t position = offset;
+  std::size_t left = size;
+  while (left > 0)
+  {
+    const ssize_t read = pread(m_file, dst, left, static_cast<off_t>(position));
+    if (read <= 0)
+    {
+      throw std::runtime_error(std::string("Could not read file: ") + m_path);
+    }
+    dst += read;
+    position += static_cast<std::uint64_t>(read);
+    left -= static_cast<std::size_t>(read);
+  }
+}
+#endif
+
+std::uint64_t file_reader::size() const
+{
+  return m_size;
+}
+}
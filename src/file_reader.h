@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace io
+{
+// positioned reads, safe to call from several threads at once
+class file_reader
+{
+public:
+  using ptr = std::shared_ptr<file_reader>;
+
+public:
+  file_reader(const std::string& path);
+  ~file_reader();
+
+  std::uint64_t size() const;
+
+  // reads exactly size bytes at offset or throws
+  void read(const std::uint64_t offset, const std::size_t size, void* out) const;
+
+private:
+  const std::string m_path;
+  std::uint64_t m_size;
+#ifdef _WIN32
+  void* m_file;
+#else
+  int m_file;
+#endif
+
+private:
+  file_reader(const file_reader&) = delete;
+  file_reader& operator = (const file_reader&) = delete;
+};
+}
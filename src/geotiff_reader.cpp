@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "decompress.h"
+#include "geotiff_reader.h"
+
+namespace terrain
+{
+namespace
+{
+const unsigned tag_image_width = 256;
+const unsigned tag_image_length = 257;
+const unsigned tag_bits_per_sample = 258;
+const unsigned tag_compression = 259;
+const unsigned tag_strip_offsets = 273;
+const unsigned tag_samples_per_pixel = 277;
+const unsigned tag_rows_per_strip = 278;
+const unsigned tag_strip_byte_counts = 279;
+const unsigned tag_predictor = 317;
+const unsigned tag_tile_width = 322;
+const unsigned tag_tile_length = 323;
+const unsigned tag_tile_offsets = 324;
+const unsigned tag_tile_byte_counts = 325;
+const unsigned tag_sample_format = 339;
+const unsigned tag_model_pixel_scale = 33550;
+const unsigned tag_model_tiepoint = 33922;
+const unsigned tag_model_transformation = 34264;
+const unsigned tag_geo_key_directory = 34735;
+const unsigned tag_gdal_nodata = 42113;
+
+const unsigned compression_none = 1;
+const unsigned compression_lzw = 5;
+const unsigned compression_deflate = 8;
+const unsigned compression_adobe_deflate = 32946;
+
+const unsigned predictor_none = 1;
+const unsigned predictor_horizontal = 2;
+const unsigned predictor_floating_point = 3;
+
+const unsigned format_unsigned = 1;
+const unsigned format_signed = 2;
+const unsigned format_float = 3;
+
+const unsigned geo_key_raster_type = 1025;
+const unsigned raster_pixel_is_point = 2;
+
+unsigned type_size(const unsigned type)
+{
+  switch (type)
+  {
+  case 1: case 2: case 6: case 7:
+    return 1;
+  case 3: case 8:
+    return 2;
+  case 4: case 9: case 11:
+    return 4;
+  case 5: case 10: case 12: case 16: case 17: case 18:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+void swap_samples(std::uint8_t* data, const unsigned count, const unsigned bytes)
+{
+  for (unsigned i = 0; i < count; ++i, data += bytes)
+  {
+    std::reverse(data, data + bytes);
+  }
+}
+
+// predictor 2: every sample is the difference to the one on its left, wrapping around
+template<typename T>
+void undo_horizontal(std::uint8_t* row, const unsigned count)
+{
+  T previous;
+  std::memcpy(&previous, row, sizeof(T));
+  for (unsigned i = 1; i < count; ++i)
+  {
+    T v;
+    std::memcpy(&v, row + i * sizeof(T), sizeof(T));
+    v = static_cast<T>(v + previous);
+    std::memcpy(row + i * sizeof(T), &v, sizeof(T));
+    previous = v;
+  }
+}
+
+// predictor 3: byte differences over the row, the bytes are stored in planes from the most significant one
+void undo_floating_point(std::uint8_t* row, const unsigned count, const unsigned bytes, std::vector<std::uint8_t>& planes)
+{
+  const std::size_t n = static_cast<std::size_t>(count) * bytes;
+  for (std::size_t i = 1; i < n; ++i)
+  {
+    row[i] = static_cast<std::uint8_t>(row[i] + row[i - 1]);
+  }
+  planes.assign(row, row + n);
+
+  // to little endian samples
+  for (unsigned i = 0; i < count; ++i)
+  {
+    for (unsigned b = 0; b < bytes; ++b)
+    {
+      row[static_cast<std::size_t>(i) * bytes + b] = planes[static_cast<std::size_t>(bytes - 1 - b) * count + i];
+    }
+  }
+}
+
+template<typename T>
+double load(const std::uint8_t* p)
+{
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  return static_cast<double>(v);
+}
+
+double sample(const std::uint8_t* p, const unsigned format, const unsigned bits)
+{
+  if (format == format_float)
+  {
+    return bits == 32 ? load<float>(p) : load<double>(p);
+  }
+  if (format == format_signed)
+  {
+    switch (bits)
+    {
+    case 8: return load<std::int8_t>(p);
+    case 16: return load<std::int16_t>(p);
+    case 32: return load<std::int32_t>(p);
+    default: return load<std::int64_t>(p);
+    }
+  }
+  switch (bits)
+  {
+  case 8: return load<std::uint8_t>(p);
+  case 16: return load<std::uint16_t>(p);
+  case 32: return load<std::uint32_t>(p);
+  default: return load<std::uint64_t>(p);
+  }
+}
+}
+
+geotiff_reader::geotiff_reader(const std::string& path)
+  : m_path(path)
+  , m_file(new io::mapped_file(path, io::mapped_file::mode::read_only))
+  , m_big_endian(false)
+  , m_big_tiff(false)
+  , m_size(0)
+  , m_tiled(false)
+  , m_chunk_size(0)
+  , m_bits(0)
+  , m_format(format_unsigned)
+  , m_compression(compression_none)
+  , m_predictor(predictor_none)
+  , m_has_nodata(false)
+  , m_nodata(0.0)
+{
+  parse();
+}
+
+geo_reference geotiff_reader::geo() const
+{
+  return geo_reference(m_geo_transform, static_cast<int>(m_size.x), static_cast<int>(m_size.y));
+}
+
+height_field::ptr geotiff_reader::read(parallel::thread_pool& pool) const
+{
+  return read(uvec2(0), m_size, pool);
+}
+
+height_field::ptr geotiff_reader::read(const uvec2& begin, const uvec2& end, parallel::thread_pool& pool) const
+{
+  if (begin.x >= end.x || begin.y >= end.y || end.x > m_size.x || end.y > m_size.y)
+  {
+    throw std::runtime_error(std::string("tiff window out of range: ") + m_path);
+  }
+
+  const vec2 pixel(static_cast<float>(std::abs(m_geo_transform[1])), static_cast<float>(std::abs(m_geo_transform[5])));
+  height_field::ptr heights(new height_field(end - begin, vec2(pixel.x > 0.0f ? pixel.x : 1.0f, pixel.y > 0.0f ? pixel.y : 1.0f)));
+
+  // chunk columns and rows under the window, strips are a single column
+  const unsigned across = m_tiled ? (m_size.x + m_chunk_size.x - 1) / m_chunk_size.x : 1;
+  const uvec2 first(m_tiled ? begin.x / m_chunk_size.x : 0, begin.y / m_chunk_size.y);
+  const uvec2 last(m_tiled ? (end.x - 1) / m_chunk_size.x : 0, (end.y - 1) / m_chunk_size.y);
+  const uvec2 count(last - first + 1u);
+
+  pool.parallel_for(count.x * count.y, [&](const unsigned i)
+  {
+    buffers scratch;
+    read_chunk((first.y + i / count.x) * across + first.x + i % count.x, *heights, begin, scratch);
+  });
+  return heights;
+}
+
+void geotiff_reader::parse()
+{
+  const std::uint8_t* base = at(0, 8);
+  if (base[0] == 'I' && base[1] == 'I')
+  {
+    m_big_endian = false;
+  }
+  else if (base[0] == 'M' && base[1] == 'M')
+  {
+    m_big_endian = true;
+  }
+  else
+  {
+    throw std::runtime_error(std::string("not a tiff file: ") + m_path);
+  }
+
+  const unsigned version = read16(base + 2);
+  m_big_tiff = version == 43;
+  if (version != 42 && !(m_big_tiff && read16(base + 4) == 8))
+  {
+    throw std::runtime_error(std::string("not a tiff file: ") + m_path);
+  }
+
+  // the first image directory
+  const std::uint64_t ifd = m_big_tiff ? read64(at(8, 8)) : read32(base + 4);
+  const unsigned count_size = m_big_tiff ? 8 : 2;
+  const unsigned entry_size = m_big_tiff ? 20 : 12;
+  const unsigned inline_size = m_big_tiff ? 8 : 4;
+  const std::uint64_t entry_count = m_big_tiff ? read64(at(ifd, 8)) : read16(at(ifd, 2));
+  const std::uint8_t* p = at(ifd + count_size, entry_count * entry_size);
+
+  std::vector<entry> entries;
+  for (std::uint64_t i = 0; i < entry_count; ++i, p += entry_size)
+  {
+    entry e;
+    e.tag = read16(p);
+    e.type = read16(p + 2);
+    e.count = m_big_tiff ? read64(p + 4) : read32(p + 4);
+    const std::uint8_t* value = p + (m_big_tiff ? 12 : 8);
+    const std::uint64_t size = type_size(e.type) * e.count;
+    if (size == 0)
+    {
+      continue;
+    }
+    e.data = size <= inline_size ? value : at(m_big_tiff ? read64(value) : read32(value), size);
+    entries.push_back(e);
+  }
+
+  auto find = [&](const unsigned tag) -> const entry*
+  {
+    for (const entry& e : entries)
+    {
+      if (e.tag == tag)
+      {
+        return &e;
+      }
+    }
+    return nullptr;
+  };
+  auto first = [&](const unsigned tag, const std::uint64_t fallback) -> std::uint64_t
+  {
+    const entry* e = find(tag);
+    return e ? integers(*e).front() : fallback;
+  };
+
+  if (!find(tag_image_width) || !find(tag_image_length) || !find(tag_bits_per_sample))
+  {
+    throw std::runtime_error(std::string("tiff image without size or sample bits: ") + m_path);
+  }
+  m_size = uvec2(static_cast<unsigned>(first(tag_image_width, 0)), static_cast<unsigned>(first(tag_image_length, 0)));
+  m_bits = static_cast<unsigned>(first(tag_bits_per_sample, 0));
+  m_format = static_cast<unsigned>(first(tag_sample_format, format_unsigned));
+  m_compression = static_cast<unsigned>(first(tag_compression, compression_none));
+  m_predictor = static_cast<unsigned>(first(tag_predictor, predictor_none));
+  m_format = m_format == format_signed || m_format == format_float ? m_format : format_unsigned;
+
+  if (first(tag_samples_per_pixel, 1) != 1)
+  {
+    throw std::runtime_error(std::string("only single band tiff files are supported: ") + m_path);
+  }
+  if ((m_bits != 8 && m_bits != 16 && m_bits != 32 && m_bits != 64) || (m_format == format_float && m_bits < 32))
+  {
+    throw std::runtime_error(std::string("unsupported tiff sample type: ") + m_path);
+  }
+  if (m_compression != compression_none && m_compression != compression_lzw && m_compression != compression_deflate && m_compression != compression_adobe_deflate)
+  {
+    throw std::runtime_error(std::string("unsupported tiff compression: ") + m_path);
+  }
+  if (m_predictor != predictor_none
+      && !(m_predictor == predictor_horizontal && m_format != format_float)
+      && !(m_predictor == predictor_floating_point && m_format == format_float))
+  {
+    throw std::runtime_error(std::string("unsupported tiff predictor: ") + m_path);
+  }
+
+  m_tiled = find(tag_tile_width) != nullptr;
+  const entry* offsets = find(m_tiled ? tag_tile_offsets : tag_strip_offsets);
+  const entry* byte_counts = find(m_tiled ? tag_tile_byte_counts : tag_strip_byte_counts);
+  if (!offsets || !byte_counts)
+  {
+    throw std::runtime_error(std::string("tiff image without data offsets: ") + m_path);
+  }
+  m_offsets = integers(*offsets);
+  m_byte_counts = integers(*byte_counts);
+
+  std::uint64_t chunk_count;
+  if (m_tiled)
+  {
+    m_chunk_size = uvec2(static_cast<unsigned>(first(tag_tile_width, 0)), static_cast<unsigned>(first(tag_tile_length, 0)));
+    if (m_chunk_size.x == 0 || m_chunk_size.y == 0)
+    {
+      throw std::runtime_error(std::string("invalid tiff tile size: ") + m_path);
+    }
+    chunk_count = static_cast<std::uint64_t>((m_size.x + m_chunk_size.x - 1) / m_chunk_size.x) * ((m_size.y + m_chunk_size.y - 1) / m_chunk_size.y);
+  }
+  else
+  {
+    const std::uint64_t rows = std::max<std::uint64_t>(1, std::min<std::uint64_t>(first(tag_rows_per_strip, m_size.y), m_size.y));
+    m_chunk_size = uvec2(m_size.x, static_cast<unsigned>(rows));
+    chunk_count = (m_size.y + rows - 1) / rows;
+  }
+  if (m_offsets.size() < chunk_count || m_byte_counts.size() < chunk_count)
+  {
+    throw std::runtime_error(std::string("tiff image with missing chunks: ") + m_path);
+  }
+  m_offsets.resize(static_cast<std::size_t>(chunk_count));
+  m_byte_counts.resize(static_cast<std::size_t>(chunk_count));
+
+  // geo transform, gdal order: x origin, x per column, x per row, y origin, y per column, y per row
+  const double identity[6] = { 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 };
+  std::copy(identity, identity + 6, m_geo_transform);
+  const entry* transformation = find(tag_model_transformation);
+  const entry* tiepoint = find(tag_model_tiepoint);
+  const entry* scale = find(tag_model_pixel_scale);
+  if (transformation && transformation->count >= 16)
+  {
+    const std::vector<double> m(reals(*transformation));
+    const double geo[6] = { m[3], m[0], m[1], m[7], m[4], m[5] };
+    std::copy(geo, geo + 6, m_geo_transform);
+  }
+  else if (tiepoint && scale && tiepoint->count >= 6 && scale->count >= 2)
+  {
+    const std::vector<double> t(reals(*tiepoint));
+    const std::vector<double> s(reals(*scale));
+    const double geo[6] = { t[3] - t[0] * s[0], s[0], 0.0, t[4] + t[1] * s[1], 0.0, -s[1] };
+    std::copy(geo, geo + 6, m_geo_transform);
+  }
+
+  if (const entry* keys = find(tag_geo_key_directory))
+  {
+    const std::vector<std::uint64_t> k(integers(*keys));
+    for (std::size_t i = 4; i + 3 < k.size(); i += 4)
+    {
+      if (k[i] == geo_key_raster_type && k[i + 1] == 0 && k[i + 3] == raster_pixel_is_point)
+      {
+        m_geo_transform[0] -= 0.5 * (m_geo_transform[1] + m_geo_transform[2]);
+        m_geo_transform[3] -= 0.5 * (m_geo_transform[4] + m_geo_transform[5]);
+      }
+    }
+  }
+
+  if (const entry* nodata = find(tag_gdal_nodata))
+  {
+    const std::string text(reinterpret_cast<const char*>(nodata->data), static_cast<std::size_t>(nodata->count));
+    char* end = nullptr;
+    m_nodata = std::strtod(text.c_str(), &end);
+    m_has_nodata = end != text.c_str() && !std::isnan(m_nodata);
+  }
+}
+
+void geotiff_reader::read_chunk(const unsigned index, height_field& heights, const uvec2& window_begin, buffers& scratch) const
+{
+  const unsigned sample_bytes = m_bits / 8;
+  const unsigned across = m_tiled ? (m_size.x + m_chunk_size.x - 1) / m_chunk_size.x : 1;
+  const uvec2 origin((index % across) * m_chunk_size.x, (index / across) * m_chunk_size.y);
+
+  // strips end at the last row, tiles are always whole
+  const unsigned rows = m_tiled ? m_chunk_size.y : std::min(m_chunk_size.y, m_size.y - origin.y);
+  const std::size_t row_bytes = static_cast<std::size_t>(m_chunk_size.x) * sample_bytes;
+  const std::size_t bytes = row_bytes * rows;
+  const std::uint8_t* in = at(m_offsets[index], m_byte_counts[index]);
+  const std::size_t in_size = static_cast<std::size_t>(m_byte_counts[index]);
+
+  // float strips are full rows of the field already, if the window holds all of their rows
+  const bool in_place = !m_tiled && m_format == format_float && m_bits == 32 && heights.size().x == m_size.x
+    && origin.y >= window_begin.y && origin.y + rows <= window_begin.y + heights.size().y;
+  std::uint8_t* out;
+  if (in_place)
+  {
+    out = reinterpret_cast<std::uint8_t*>(&heights(uvec2(0, origin.y - window_begin.y)));
+  }
+  else
+  {
+    scratch.chunk.resize(bytes);
+    out = scratch.chunk.data();
+  }
+
+  std::size_t written;
+  if (m_compression == compression_lzw)
+  {
+    written = io::lzw_decode(in, in_size, out, bytes);
+  }
+  else if (m_compression == compression_deflate || m_compression == compression_adobe_deflate)
+  {
+    written = io::inflate(in, in_size, out, bytes);
+  }
+  else
+  {
+    written = std::min(in_size, bytes);
+    std::memcpy(out, in, written);
+  }
+  // short chunks are padded with zeros
+  std::fill(out + written, out + bytes, static_cast<std::uint8_t>(0));
+
+  for (unsigned r = 0; r < rows; ++r)
+  {
+    std::uint8_t* row = out + r * row_bytes;
+    if (m_predictor == predictor_floating_point)
+    {
+      undo_floating_point(row, m_chunk_size.x, sample_bytes, scratch.row);
+      continue;
+    }
+    if (m_big_endian && sample_bytes > 1)
+    {
+      swap_samples(row, m_chunk_size.x, sample_bytes);
+    }
+    if (m_predictor == predictor_horizontal)
+    {
+      switch (sample_bytes)
+      {
+      case 1: undo_horizontal<std::uint8_t>(row, m_chunk_size.x); break;
+      case 2: undo_horizontal<std::uint16_t>(row, m_chunk_size.x); break;
+      case 4: undo_horizontal<std::uint32_t>(row, m_chunk_size.x); break;
+      default: undo_horizontal<std::uint64_t>(row, m_chunk_size.x); break;
+      }
+    }
+  }
+
+  const float nodata = static_cast<float>(m_nodata);
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  if (in_place)
+  {
+    if (m_has_nodata)
+    {
+      float* samples = reinterpret_cast<float*>(out);
+      std::replace(samples, samples + static_cast<std::size_t>(m_chunk_size.x) * rows, nodata, nan);
+    }
+    return;
+  }
+
+  // the part of the chunk inside the window
+  const uvec2 window_end(window_begin + heights.size());
+  const uvec2 from(glm::max(origin, window_begin));
+  const uvec2 to(glm::min(origin + uvec2(m_chunk_size.x, rows), window_end));
+  for (unsigned y = from.y; y < to.y; ++y)
+  {
+    const std::uint8_t* row = out + (y - origin.y) * row_bytes + (from.x - origin.x) * sample_bytes;
+    float* target = &heights(uvec2(from.x, y) - window_begin);
+    for (unsigned x = 0; x < to.x - from.x; ++x)
+    {
+      const float v = static_cast<float>(sample(row + x * sample_bytes, m_format, m_bits));
+      target[x] = m_has_nodata && v == nodata ? nan : v;
+    }
+  }
+}
+
+std::uint16_t geotiff_reader::read16(const std::uint8_t* p) const
+{
+  return static_cast<std::uint16_t>(m_big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0]);
+}
+
+std::uint32_t geotiff_reader::read32(const std::uint8_t* p) const
+{
+  const std::uint32_t a = read16(p);
+  const std::uint32_t b = read16(p + 2);
+  return m_big_endian ? (a << 16) | b : (b << 16) | a;
+}
+
+std::uint64_t geotiff_reader::read64(const std::uint8_t* p) const
+{
+  const std::uint64_t a = read32(p);
+  const std::uint64_t b = read32(p + 4);
+  return m_big_endian ? (a << 32) | b : (b << 32) | a;
+}
+
+std::vector<std::uint64_t> geotiff_reader::integers(const entry& e) const
+{
+  std::vector<std::uint64_t> result(static_cast<std::size_t>(e.count));
+  const unsigned size = type_size(e.type);
+  for (std::size_t i = 0; i < result.size(); ++i)
+  {
+    const std::uint8_t* p = e.data + i * size;
+    result[i] = size == 1 ? p[0] : size == 2 ? read16(p) : size == 4 ? read32(p) : read64(p);
+  }
+  return result;
+}
+
+std::vector<double> geotiff_reader::reals(const entry& e) const
+{
+  std::vector<double> result(static_cast<std::size_t>(e.count));
+  if (e.type != 11 && e.type != 12)
+  {
+    const std::vector<std::uint64_t> values(integers(e));
+    std::copy(values.begin(), values.end(), result.begin());
+    return result;
+  }
+  for (std::size_t i = 0; i < result.size(); ++i)
+  {
+    if (e.type == 12)
+    {
+      const std::uint64_t bits = read64(e.data + i * 8);
+      std::memcpy(&result[i], &bits, sizeof(double));
+    }
+    else
+    {
+      const std::uint32_t bits = read32(e.data + i * 4);
+      float f;
+      std::memcpy(&f, &bits, sizeof(float));
+      result[i] = f;
+    }
+  }
+  return result;
+}
+
+const std::uint8_t* geotiff_reader::at(const std::uint64_t offset, const std::uint64_t size) const
+{
+  if (offset > m_file->size() || size > m_file->size() - offset)
+  {
+    throw std::runtime_error(std::string("truncated tiff file: ") + m_path);
+  }
+  return reinterpret_cast<const std::uint8_t*>(m_file->data()) + offset;
+}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "height_field.h"
+#include "elevation_reader.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// single band GeoTIFF elevation rasters, classic TIFF and BigTIFF, the first image of the file
+// strips or tiles, 8 to 64 bit integer or floating point samples
+// no compression, LZW or Deflate, with the horizontal or the floating point predictor
+// the file is mapped and the chunks are decoded in parallel into the rows of the height field,
+// float strips are decoded in place without a staging buffer
+  class geotiff_reader
+  {
+  public:
+    // parses the header and the tags, the samples are only touched by read
+    geotiff_reader(const std::string& path);
+
+    const uvec2& size() const
+    {
+      return m_size;
+    }
+
+    // gdal style pixel -> geo transform from ModelTransformation, or ModelTiepoint and ModelPixelScale
+    // identity without them, pixel-is-point rasters are moved to the pixel corner like gdal does
+    const double* geo_transform() const
+    {
+      return m_geo_transform;
+    }
+
+    geo_reference geo() const;
+
+    // the GDAL_NODATA tag, these samples are read as NaN
+    bool has_nodata() const
+    {
+      return m_has_nodata;
+    }
+
+    // the resolution is the pixel size of the geo transform
+    height_field::ptr read(parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+    // pixels [begin, end) only, sample (0, 0) is pixel begin, only the chunks that intersect the window are decoded
+    height_field::ptr read(const uvec2& begin, const uvec2& end, parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+  private:
+    struct entry
+    {
+      unsigned tag;
+      unsigned type;
+      std::uint64_t count;
+      const std::uint8_t* data;
+    };
+
+    // scratch of one chunk
+    struct buffers
+    {
+      std::vector<std::uint8_t> chunk;
+      std::vector<std::uint8_t> row;
+    };
+
+    void parse();
+    // heights holds the window starting at pixel window_begin
+    void read_chunk(const unsigned index, height_field& heights, const uvec2& window_begin, buffers& scratch) const;
+
+    std::uint16_t read16(const std::uint8_t* p) const;
+    std::uint32_t read32(const std::uint8_t* p) const;
+    std::uint64_t read64(const std::uint8_t* p) const;
+    std::vector<std::uint64_t> integers(const entry& e) const;
+    std::vector<double> reals(const entry& e) const;
+    const std::uint8_t* at(const std::uint64_t offset, const std::uint64_t size) const;
+
+  private:
+    std::string m_path;
+    io::mapped_file::ptr m_file;
+    bool m_big_endian;
+    bool m_big_tiff;
+
+    uvec2 m_size;
+    bool m_tiled;
+    uvec2 m_chunk_size;  // tile size, or the width and the rows per strip
+    unsigned m_bits;     // per sample
+    unsigned m_format;   // 1 unsigned, 2 signed, 3 floating point
+    unsigned m_compression;
+    unsigned m_predictor;
+    std::vector<std::uint64_t> m_offsets;
+    std::vector<std::uint64_t> m_byte_counts;
+
+    double m_geo_transform[6];
+    bool m_has_nodata;
+    double m_nodata;
+  };
+}
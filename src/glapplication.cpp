@@ -19,7 +19,8 @@ GLApplication& GLApplication::instance()
 }
 
 GLApplication::GLApplication()
-  : m_background_color(0)
+  : m_has_pick(false)
+  , m_background_color(0)
   , m_mouse_left_down(false)
   , m_mouse_position(0.0)
   , m_mouse_sensitivity(0.3f)
@@ -146,12 +147,18 @@ void GLApplication::create_scene()
 
     vec2 resolution(0.1f, 0.1f);
     height_field_pixels[0 + 0 * size.s] = 1.0f;
-    h_min = 0.0f;
-    h_max = 1.0f;
 
     m_height_field.reset(new terrain::height_field(size, vec2(1.1f, 1.1f)));
     m_height_field->swap_data(height_field_pixels);
 
+    m_height_pyramid.reset(new terrain::minmax_pyramid(*m_height_field));
+    m_ray_caster.reset(new terrain::ray_caster(*m_height_pyramid));
+
+    // 2nd / 98th percentile, a few outliers do not flatten the contrast of the export
+    const terrain::field_stats height_stats(terrain::field_stats::compute(*m_height_field));
+    h_min = height_stats.quantile(0.02f);
+    h_max = height_stats.quantile(0.98f);
+
     //{
     //  ppm img( m_height_field->size() );
     //  math::range_mapper<float, ppm::pixel::channel_t> rm( h_min, h_max, 0, 255 );
@@ -169,7 +176,12 @@ void GLApplication::create_scene()
   }
 
   // height field texture
+  // 16 bit samples plus a small offset/scale texture per tile, half the size of a float upload
   {
+    m_quantized_height_field.reset(new terrain::quantized_height_field(*m_height_field, 0.005f));
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
     glGenTextures(1, &m_height_field_texture_id);
     glBindTexture(GL_TEXTURE_2D, m_height_field_texture_id);
 
@@ -178,7 +190,77 @@ void GLApplication::create_scene()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, m_height_field->size().s, m_height_field->size().t, 0, GL_RED, GL_FLOAT, m_height_field->data());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, m_quantized_height_field->size().s, m_quantized_height_field->size().t, 0, GL_RED, GL_UNSIGNED_SHORT, m_quantized_height_field->data());
+
+    glGenTextures(1, &m_height_field_tiles_texture_id);
+    glBindTexture(GL_TEXTURE_2D, m_height_field_tiles_texture_id);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    const terrain::field<vec2>& tiles(m_quantized_height_field->tiles());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, tiles.size().s, tiles.size().t, 0, GL_RG, GL_FLOAT, tiles.data());
+
+    // tiles that cannot meet the error limit keep their float samples in an atlas
+    glGenTextures(1, &m_height_field_float_tiles_texture_id);
+    glBindTexture(GL_TEXTURE_2D, m_height_field_float_tiles_texture_id);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    m_float_atlas_size = uvec2(0);
+    upload_float_tiles(uvec2(0), tiles.size());
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  // normal field texture
+  // octahedral normals in two snorm16, filtered linearly for per pixel shading
+  {
+    m_normal_field = terrain::compute_normals(*m_height_field);
+    m_packed_normal_field = terrain::encode_octahedral(*m_normal_field);
+
+    glGenTextures(1, &m_normal_field_texture_id);
+    glBindTexture(GL_TEXTURE_2D, m_normal_field_texture_id);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16_SNORM, m_packed_normal_field->size().s, m_packed_normal_field->size().t, 0, GL_RG, GL_SHORT, m_packed_normal_field->data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  // shading field texture
+  // ambient occlusion and sun visibility from the horizon angles, computed once
+  // they are not refreshed by the edits of sync_height_field()
+  {
+    const vec3 sun_direction(0.4f, 0.6f, 0.7f); // in the height field frame, z up
+    const terrain::horizon_field horizons(*m_height_field, 16, 0.0f, m_height_pyramid.get());
+    const terrain::field<float>::ptr ambient_occlusion(horizons.ambient_occlusion());
+    const terrain::field<float>::ptr sun_visibility(horizons.sun_visibility(sun_direction));
+
+    const uvec2 shading_size(m_height_field->size());
+    std::vector<unsigned char> shading(2 * shading_size.x * shading_size.y);
+    for (unsigned i = 0; i < shading_size.x * shading_size.y; ++i)
+    {
+      shading[2 * i] = static_cast<unsigned char>(ambient_occlusion->data()[i] * 255.0f + 0.5f);
+      shading[2 * i + 1] = static_cast<unsigned char>(sun_visibility->data()[i] * 255.0f + 0.5f);
+    }
+
+    glGenTextures(1, &m_shading_field_texture_id);
+    glBindTexture(GL_TEXTURE_2D, m_shading_field_texture_id);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, shading_size.s, shading_size.t, 0, GL_RG, GL_UNSIGNED_BYTE, &shading[0]);
     glBindTexture(GL_TEXTURE_2D, 0);
   }
 
@@ -216,14 +298,12 @@ void GLApplication::create_scene()
     }
 
     {
-      std::string vs_code, gs_code, fs_code;
+      std::string vs_code, fs_code;
       io::read_text_file("shaders\\per_pixel_diffuse.vert", vs_code);
-      io::read_text_file("shaders\\per_pixel_diffuse.geom", gs_code);
       io::read_text_file("shaders\\per_pixel_diffuse.frag", fs_code);
 
       shader_program& prog = m_shader_manager.add("per_pixel_diffuse");
       prog.add_vertex_shader(vs_code);
-      prog.add_geometry_shader(gs_code);
       prog.add_fragment_shader(fs_code);
       prog.link();
 
@@ -231,6 +311,8 @@ void GLApplication::create_scene()
       prog.set_attribute_location(shader_program::attribute_kind::uv, 1);
 
       prog.set_need_height_field(true);  // TODO: pass here...
+      prog.set_need_normal_field(true);
+      prog.set_need_shading_field(true);
       prog.set_need_normal_matrix(true);
       prog.set_need_model_view_matrix(true);
       prog.set_need_light_position(true);
@@ -253,6 +335,7 @@ void GLApplication::create_scene()
 
       prog.set_need_normal_matrix(true);
       prog.set_need_height_field(true);  // TODO: pass here...
+      prog.set_need_normal_field(true);
     }
   }
 
@@ -358,7 +441,9 @@ void GLApplication::create_scene()
       m_meshes.push_back(mesh::ptr(new mesh(vertices, indices, GL_TRIANGLES)));
       mesh::ptr mesh = m_meshes.back();
       mesh->add_uvs(uvs);
-      mesh->set_height_field_texture(m_height_field_texture_id);
+      mesh->set_height_field_texture(m_height_field_texture_id, m_height_field_tiles_texture_id, m_height_field_float_tiles_texture_id);
+      mesh->set_normal_field_texture(m_normal_field_texture_id);
+      mesh->set_shading_field_texture(m_shading_field_texture_id);
       mesh->set_transformation(glm::rotate(glm::scale(mat4(1.0f), vec3(1.0f, -1.0f, 1.0f)), glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f)));
     }
   }
@@ -366,6 +451,8 @@ void GLApplication::create_scene()
 
 void GLApplication::render()
 {
+  sync_height_field();
+
   glClearColor(m_background_color.x, m_background_color.y, m_background_color.z, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -394,6 +481,129 @@ void GLApplication::render()
   }
 }
 
+// brings the derived fields and textures up to date with the edits of the height field
+// only the dirty regions are recomputed and uploaded
+void GLApplication::sync_height_field()
+{
+  if (!m_height_field || !m_height_field->dirty())
+  {
+    return;
+  }
+
+  const uvec2 size(m_height_field->size());
+  const unsigned tile_size(terrain::quantized_height_field::tile_size);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (const terrain::region& r : m_height_field->take_dirty_regions())
+  {
+    m_height_pyramid->update(r.begin, r.end);
+
+    // quantization works on whole tiles, upload the tiles touching the region
+    {
+      m_quantized_height_field->update(*m_height_field, r.begin, r.end);
+
+      const uvec2 tile_begin(r.begin / tile_size);
+      const uvec2 tile_end((r.end + (tile_size - 1)) / tile_size);
+      const uvec2 begin(tile_begin * tile_size);
+      const uvec2 end(glm::min(tile_end * tile_size, size));
+
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, size.x);
+      glBindTexture(GL_TEXTURE_2D, m_height_field_texture_id);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, begin.x, begin.y, end.x - begin.x, end.y - begin.y, GL_RED, GL_UNSIGNED_SHORT
+                      , m_quantized_height_field->data() + begin.x + size.x * begin.y);
+
+      const terrain::field<vec2>& tiles(m_quantized_height_field->tiles());
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, tiles.size().x);
+      glBindTexture(GL_TEXTURE_2D, m_height_field_tiles_texture_id);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, tile_begin.x, tile_begin.y, tile_end.x - tile_begin.x, tile_end.y - tile_begin.y, GL_RG, GL_FLOAT
+                      , &tiles(tile_begin));
+
+      upload_float_tiles(tile_begin, tile_end);
+    }
+
+    // the normals use the neighbours, so the samples around the region change as well
+    {
+      const uvec2 begin(glm::max(r.begin, uvec2(1)) - 1u);
+      const uvec2 end(glm::min(r.end + 1u, size));
+
+      terrain::compute_normals(*m_height_field, *m_normal_field, begin, end);
+      terrain::encode_octahedral(*m_normal_field, *m_packed_normal_field, begin, end);
+
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, size.x);
+      glBindTexture(GL_TEXTURE_2D, m_normal_field_texture_id);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, begin.x, begin.y, end.x - begin.x, end.y - begin.y, GL_RG, GL_SHORT
+                      , &(*m_packed_normal_field)(begin));
+    }
+  }
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// uploads the float tiles among [tile_begin, tile_end) to the atlas
+// the atlas is reallocated with all of its slots when the quantized height field grew it
+void GLApplication::upload_float_tiles(const uvec2& tile_begin, const uvec2& tile_end)
+{
+  const terrain::quantized_height_field& quantized(*m_quantized_height_field);
+  const unsigned tile_size(terrain::quantized_height_field::tile_size);
+  const unsigned columns(terrain::quantized_height_field::float_atlas_columns);
+
+  const auto upload_slot = [&](const unsigned slot)
+  {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % columns) * tile_size, (slot / columns) * tile_size, tile_size, tile_size, GL_RED, GL_FLOAT
+                    , quantized.float_tiles() + std::size_t(slot) * tile_size * tile_size);
+  };
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, tile_size);
+  glBindTexture(GL_TEXTURE_2D, m_height_field_float_tiles_texture_id);
+  if (quantized.float_atlas_size() != m_float_atlas_size)
+  {
+    m_float_atlas_size = quantized.float_atlas_size();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, m_float_atlas_size.x, m_float_atlas_size.y, 0, GL_RED, GL_FLOAT, nullptr);
+    for (unsigned slot = 0; slot < quantized.float_tile_slots(); ++slot)
+    {
+      upload_slot(slot);
+    }
+  }
+  else
+  {
+    for (unsigned y = tile_begin.y; y < tile_end.y; ++y)
+    {
+      for (unsigned x = tile_begin.x; x < tile_end.x; ++x)
+      {
+        const vec2& tile(quantized.tiles()(uvec2(x, y)));
+        if (terrain::quantized_height_field::is_float_tile(tile))
+        {
+          upload_slot(static_cast<unsigned>(tile.x));
+        }
+      }
+    }
+  }
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+// raises (or lowers) the samples around the picked cell, falling off linearly
+void GLApplication::sculpt(const float amount)
+{
+  if (!m_has_pick)
+  {
+    return;
+  }
+
+  const unsigned radius(8);
+  const uvec2 begin(glm::max(m_picked_cell, uvec2(radius)) - radius);
+  const uvec2 end(m_picked_cell + radius + 1u);
+  const vec2 center(m_picked_cell);
+  m_height_field->edit(begin, end, [&](const uvec2& pos, float& height)
+  {
+    const float d(glm::length(vec2(pos) - center) / radius);
+    if (d < 1.0f)
+    {
+      height += amount * (1.0f - d);
+    }
+  });
+}
+
 void GLApplication::request_update()
 {
   glutPostRedisplay();
@@ -401,11 +611,20 @@ void GLApplication::request_update()
 
 void GLApplication::destroy_scene() noexcept
 {
+  m_packed_normal_field.reset();
+  m_normal_field.reset();
+  m_quantized_height_field.reset();
+  m_ray_caster.reset();
+  m_height_pyramid.reset();
   m_height_field.reset();
   m_axis.reset();
   m_meshes.clear();
   m_shader_manager.clear();
   glDeleteTextures(1, &m_height_field_texture_id);
+  glDeleteTextures(1, &m_height_field_tiles_texture_id);
+  glDeleteTextures(1, &m_height_field_float_tiles_texture_id);
+  glDeleteTextures(1, &m_normal_field_texture_id);
+  glDeleteTextures(1, &m_shading_field_texture_id);
 }
 
 // static
@@ -495,6 +714,18 @@ void GLApplication::keyboard_callback(unsigned char character, int /*x*/, int /*
       need_redraw = true;
       break;
     }
+    case 'r':
+    {
+      app.sculpt(0.05f);
+      need_redraw = true;
+      break;
+    }
+    case 'f':
+    {
+      app.sculpt(-0.05f);
+      need_redraw = true;
+      break;
+    }
     case 'C':
     {
       const std::string settings_file_path("settings.xml");
@@ -550,6 +781,22 @@ void GLApplication::mouse_button_callback(int button, int state, int x, int y)
     app.m_mouse_position.x = static_cast<float>(x);
     app.m_mouse_position.y = static_cast<float>(y);
   }
+
+  // pick the terrain under the cursor
+  if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN && app.m_ray_caster && !app.m_meshes.empty())
+  {
+    const terrain::ray r(terrain::ray_caster::cursor_ray(vec2(static_cast<float>(x), static_cast<float>(y))
+                                                         , app.m_camera.window_size()
+                                                         , app.m_camera.view_matrix()
+                                                         , app.m_camera.projection_matrix()
+                                                         , app.m_meshes.front()->get_transformation()));
+    const terrain::ray_hit hit(app.m_ray_caster->intersect(r));
+    app.m_has_pick = hit.hit;
+    if (hit.hit)
+    {
+      app.m_picked_cell = hit.cell;
+    }
+  }
 }
 
 void GLApplication::mouse_move_callback(int x, int y)
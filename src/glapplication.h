@@ -6,6 +6,12 @@
 #include "io.h"
 #include "shader_manager.h"
 #include "height_field.h"
+#include "field_stats.h"
+#include "minmax_pyramid.h"
+#include "quantized_height_field.h"
+#include "normal_field.h"
+#include "horizon_field.h"
+#include "ray_caster.h"
 #include "camera.h"
 
 namespace opengl
@@ -53,6 +59,9 @@ public:
 private:
   void create_scene();
   void destroy_scene() noexcept;
+  void sync_height_field();
+  void upload_float_tiles(const uvec2& tile_begin, const uvec2& tile_end);
+  void sculpt(const float amount);
   void parse_settings(const std::string& path);
   void save_settings(const std::string& path);
 
@@ -65,7 +74,19 @@ private:
   std::vector<mesh::ptr> m_meshes;
   shader_manager m_shader_manager;
   terrain::height_field::ptr m_height_field;
+  terrain::minmax_pyramid::ptr m_height_pyramid;
+  terrain::ray_caster::ptr m_ray_caster;
+  terrain::quantized_height_field::ptr m_quantized_height_field;
   unsigned m_height_field_texture_id;
+  unsigned m_height_field_tiles_texture_id;
+  unsigned m_height_field_float_tiles_texture_id;
+  uvec2 m_float_atlas_size;
+  terrain::field<vec3>::ptr m_normal_field;
+  terrain::field<std::uint32_t>::ptr m_packed_normal_field;
+  unsigned m_normal_field_texture_id;
+  unsigned m_shading_field_texture_id;
+  bool m_has_pick;
+  uvec2 m_picked_cell;
 
   vec3 m_background_color;
 
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
+
+#include "height_field.h"
+
+namespace terrain
+{
+namespace
+{
+// batches above this are split over the pool
+const std::size_t sample_chunk = 16384;
+
+// above this many regions the upload calls cost more than the extra texels of a bounding box
+const std::size_t max_dirty_regions = 64;
+
+// into [0, last], NaN goes to 0 so the index casts stay defined
+float clamp_position(const float p, const float last)
+{
+  return p > 0.0f ? std::min(p, last) : 0.0f;
+}
+
+bool touching(const region& a, const region& b)
+{
+  return a.begin.x <= b.end.x && b.begin.x <= a.end.x && a.begin.y <= b.end.y && b.begin.y <= a.end.y;
+}
+
+region merge(const region& a, const region& b)
+{
+  return { glm::min(a.begin, b.begin), glm::max(a.end, b.end) };
+}
+
+float catmull_rom(const float p0, const float p1, const float p2, const float p3, const float t)
+{
+  return p1 + 0.5f * t * (p2 - p0 + t * (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3 + t * (3.0f * (p1 - p2) + p3 - p0)));
+}
+}
+
+void height_field::mark_dirty(const uvec2& begin, const uvec2& end)
+{
+  const region r = { begin, glm::min(end, size()) };
+  if (r.begin.x >= r.end.x || r.begin.y >= r.end.y)
+  {
+    return;
+  }
+
+  // strokes touch the previous region most of the time
+  if (!m_dirty_regions.empty() && touching(m_dirty_regions.back(), r))
+  {
+    m_dirty_regions.back() = merge(m_dirty_regions.back(), r);
+    return;
+  }
+  m_dirty_regions.push_back(r);
+}
+
+std::vector<region> height_field::take_dirty_regions()
+{
+  std::vector<region> regions;
+  regions.swap(m_dirty_regions);
+
+  bool merged(true);
+  while (merged)
+  {
+    merged = false;
+    for (std::size_t i = 0; i < regions.size(); ++i)
+    {
+      for (std::size_t j = i + 1; j < regions.size();)
+      {
+        if (touching(regions[i], regions[j]))
+        {
+          regions[i] = merge(regions[i], regions[j]);
+          regions.erase(regions.begin() + j);
+          merged = true;
+        }
+        else
+        {
+          ++j;
+        }
+      }
+    }
+  }
+
+  if (regions.size() > max_dirty_regions)
+  {
+    region bounds(regions.front());
+    for (const region& r : regions)
+    {
+      bounds = merge(bounds, r);
+    }
+    regions.assign(1, bounds);
+  }
+  return regions;
+}
+
+height_field::value_t height_field::sample(const vec2& world_pos, const filter::Enum f) const
+{
+  value_t out(0.0f);
+  sample_batch(&world_pos, &out, 1, f);
+  return out;
+}
+
+void height_field::sample(span<const vec2> world_pos, span<value_t> out, const filter::Enum f, parallel::thread_pool& pool) const
+{
+  if (out.size() < world_pos.size())
+  {
+    throw std::runtime_error(std::string("sample output is shorter than the input"));
+  }
+
+  const unsigned chunks = static_cast<unsigned>((world_pos.size() + sample_chunk - 1) / sample_chunk);
+  pool.parallel_for(chunks, [&](const unsigned chunk)
+  {
+    const std::size_t begin = chunk * sample_chunk;
+    const std::size_t count = std::min(sample_chunk, world_pos.size() - begin);
+    sample_batch(world_pos.data() + begin, out.data() + begin, count, f);
+  });
+}
+
+void height_field::sample_batch(const vec2* world_pos, value_t* out, const std::size_t count, const filter::Enum f) const
+{
+  if (size().x == 0 || size().y == 0)
+  {
+    throw std::runtime_error(std::string("cannot sample an empty field"));
+  }
+
+  const value_t* heights = data();
+  const unsigned width = size().x;
+  const vec2 inv_resolution(1.0f / m_resolution.x, 1.0f / m_resolution.y);
+  const vec2 last(static_cast<float>(size().x - 1), static_cast<float>(size().y - 1));
+  std::size_t i = 0;
+
+#ifdef TERRAIN_SSE2
+  // 4 positions per step, the positions are clamped to the field like the scalar path and are never negative,
+  // so truncation is floor, the corners are loaded one by one
+  if (f != filter::bicubic)
+  {
+    const __m128 v_inv_res_x = _mm_set1_ps(inv_resolution.x);
+    const __m128 v_inv_res_y = _mm_set1_ps(inv_resolution.y);
+    const __m128 v_last_x = _mm_set1_ps(last.x);
+    const __m128 v_last_y = _mm_set1_ps(last.y);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    alignas(16) int ix0[4], iy0[4], ix1[4], iy1[4];
+    for (; i + 4 <= count; i += 4)
+    {
+      // x0 y0 x1 y1 ... -> x0..x3, y0..y3
+      const __m128 a = _mm_loadu_ps(&world_pos[i].x);
+      const __m128 b = _mm_loadu_ps(&world_pos[i + 2].x);
+      const __m128 xs = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+      const __m128 ys = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+      // max_ps returns the second operand for NaN
+      const __m128 px = _mm_min_ps(_mm_max_ps(_mm_mul_ps(xs, v_inv_res_x), zero), v_last_x);
+      const __m128 py = _mm_min_ps(_mm_max_ps(_mm_mul_ps(ys, v_inv_res_y), zero), v_last_y);
+
+      if (f == filter::nearest)
+      {
+        _mm_store_si128(reinterpret_cast<__m128i*>(ix0), _mm_cvttps_epi32(_mm_add_ps(px, half)));
+        _mm_store_si128(reinterpret_cast<__m128i*>(iy0), _mm_cvttps_epi32(_mm_add_ps(py, half)));
+        for (unsigned k = 0; k < 4; ++k)
+        {
+          out[i + k] = heights[static_cast<unsigned>(ix0[k]) + width * static_cast<unsigned>(iy0[k])];
+        }
+        continue;
+      }
+
+      const __m128i x0 = _mm_cvttps_epi32(px);
+      const __m128i y0 = _mm_cvttps_epi32(py);
+      const __m128 fx = _mm_cvtepi32_ps(x0);
+      const __m128 fy = _mm_cvtepi32_ps(y0);
+      const __m128 tx = _mm_sub_ps(px, fx);
+      const __m128 ty = _mm_sub_ps(py, fy);
+      _mm_store_si128(reinterpret_cast<__m128i*>(ix0), x0);
+      _mm_store_si128(reinterpret_cast<__m128i*>(iy0), y0);
+      _mm_store_si128(reinterpret_cast<__m128i*>(ix1), _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(fx, one), v_last_x)));
+      _mm_store_si128(reinterpret_cast<__m128i*>(iy1), _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(fy, one), v_last_y)));
+
+      alignas(16) float c00[4], c10[4], c01[4], c11[4];
+      for (unsigned k = 0; k < 4; ++k)
+      {
+        const unsigned row0 = width * static_cast<unsigned>(iy0[k]);
+        const unsigned row1 = width * static_cast<unsigned>(iy1[k]);
+        c00[k] = heights[row0 + static_cast<unsigned>(ix0[k])];
+        c10[k] = heights[row0 + static_cast<unsigned>(ix1[k])];
+        c01[k] = heights[row1 + static_cast<unsigned>(ix0[k])];
+        c11[k] = heights[row1 + static_cast<unsigned>(ix1[k])];
+      }
+      const __m128 h00 = _mm_load_ps(c00);
+      const __m128 h10 = _mm_load_ps(c10);
+      const __m128 h01 = _mm_load_ps(c01);
+      const __m128 h11 = _mm_load_ps(c11);
+
+      const __m128 top = _mm_add_ps(h00, _mm_mul_ps(_mm_sub_ps(h10, h00), tx));
+      const __m128 bottom = _mm_add_ps(h01, _mm_mul_ps(_mm_sub_ps(h11, h01), tx));
+      _mm_storeu_ps(out + i, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), ty)));
+    }
+  }
+#endif
+
+  for (; i < count; ++i)
+  {
+    const float px = clamp_position(world_pos[i].x * inv_resolution.x, last.x);
+    const float py = clamp_position(world_pos[i].y * inv_resolution.y, last.y);
+
+    switch (f)
+    {
+      case filter::nearest:
+      {
+        out[i] = heights[static_cast<unsigned>(px + 0.5f) + width * static_cast<unsigned>(py + 0.5f)];
+        break;
+      }
+      case filter::bilinear:
+      {
+        const float fx = std::floor(px);
+        const float fy = std::floor(py);
+        const float tx = px - fx;
+        const float ty = py - fy;
+        const unsigned x0 = static_cast<unsigned>(fx);
+        const unsigned y0 = static_cast<unsigned>(fy);
+        const unsigned x1 = std::min(x0 + 1, size().x - 1);
+        const unsigned y1 = std::min(y0 + 1, size().y - 1);
+        const float top = heights[x0 + width * y0] + (heights[x1 + width * y0] - heights[x0 + width * y0]) * tx;
+        const float bottom = heights[x0 + width * y1] + (heights[x1 + width * y1] - heights[x0 + width * y1]) * tx;
+        out[i] = top + (bottom - top) * ty;
+        break;
+      }
+      case filter::bicubic:
+      {
+        const float fx = std::floor(px);
+        const float fy = std::floor(py);
+        const int x = static_cast<int>(fx);
+        const int y = static_cast<int>(fy);
+        const int max_x = static_cast<int>(size().x) - 1;
+        const int max_y = static_cast<int>(size().y) - 1;
+        float rows[4];
+        for (int j = 0; j < 4; ++j)
+        {
+          const unsigned row = static_cast<unsigned>(std::min(std::max(y + j - 1, 0), max_y)) * width;
+          float p[4];
+          for (int k = 0; k < 4; ++k)
+          {
+            p[k] = heights[row + static_cast<unsigned>(std::min(std::max(x + k - 1, 0), max_x))];
+          }
+          rows[j] = catmull_rom(p[0], p[1], p[2], p[3], px - fx);
+        }
+        out[i] = catmull_rom(rows[0], rows[1], rows[2], rows[3], py - fy);
+        break;
+      }
+    }
+  }
+}
+}
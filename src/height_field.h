@@ -1,7 +1,11 @@
 #pragma once
 
+#include <vector>
+
 #include "types.h"
 #include "field.h"
+#include "span.h"
+#include "thread_pool.h"
 
 namespace terrain
 {
@@ -10,6 +14,16 @@ namespace terrain
   public:
     using ptr = std::shared_ptr<height_field>;
 
+    struct filter
+    {
+      enum Enum
+      {
+        nearest
+        , bilinear
+        , bicubic // Catmull-Rom
+      };
+    };
+
     height_field(const uvec2& size, const vec2& resolution)
       : field<float>(size)
       , m_resolution(resolution)
@@ -20,7 +34,60 @@ namespace terrain
       return m_resolution;
     }
 
+    // edits, the changed samples are tracked until take_dirty_regions()
+    // not thread safe, edit from one thread
+    void set(const uvec2& pos, const value_t value)
+    {
+      (*this)(pos) = value;
+      mark_dirty(pos, pos + 1u);
+    }
+
+    // calls fn(pos, height&) for every sample of [begin, end)
+    template<class F>
+    void edit(const uvec2& begin, const uvec2& end, const F& fn)
+    {
+      const uvec2 clamped_end(glm::min(end, size()));
+      for (unsigned y = begin.y; y < clamped_end.y; ++y)
+      {
+        for (unsigned x = begin.x; x < clamped_end.x; ++x)
+        {
+          const uvec2 pos(x, y);
+          fn(pos, (*this)(pos));
+        }
+      }
+      mark_dirty(begin, clamped_end);
+    }
+
+    // for samples written through operator()
+    void mark_dirty(const uvec2& begin, const uvec2& end);
+
+    bool dirty() const
+    {
+      return !m_dirty_regions.empty();
+    }
+
+    // the changed regions since the last call, overlapping and touching ones merged
+    std::vector<region> take_dirty_regions();
+
+    // heights at world positions, sample (x, y) is at (x, y) * resolution()
+    // positions outside the field are clamped to the border
+    value_t sample(const vec2& world_pos, const filter::Enum f) const;
+
+    // batched version of the above, out must be as long as world_pos
+    // large batches are split over the pool
+    void sample(span<const vec2> world_pos, span<value_t> out, const filter::Enum f, parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+  protected:
+    height_field(const uvec2& size, const vec2& resolution, value_t* data, const std::shared_ptr<void>& storage)
+      : field<float>(size, data, storage)
+      , m_resolution(resolution)
+    { }
+
+  private:
+    void sample_batch(const vec2* world_pos, value_t* out, const std::size_t count, const filter::Enum f) const;
+
   private:
     const vec2 m_resolution;
+    std::vector<region> m_dirty_regions;
   };
 }
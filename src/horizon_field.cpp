@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <cmath>
+
+#include "horizon_field.h"
+
+namespace terrain
+{
+namespace
+{
+const float two_pi = 6.28318530718f;
+
+// steps between the pyramid checks
+const unsigned segment_steps = 16;
+
+// in samples, grows with the distance
+float next_step(const float t)
+{
+  return t + std::max(1.0f, t / 16.0f);
+}
+
+// t where origin + dir * t leaves [0, last], limited to max_t if that is not 0
+float ray_length(const vec2& origin, const vec2& dir, const vec2& last, const float max_t)
+{
+  float t = max_t > 0.0f ? max_t : 1e30f;
+  for (int axis = 0; axis < 2; ++axis)
+  {
+    if (dir[axis] > 1e-6f)
+    {
+      t = std::min(t, (last[axis] - origin[axis]) / dir[axis]);
+    }
+    else if (dir[axis] < -1e-6f)
+    {
+      t = std::min(t, -origin[axis] / dir[axis]);
+    }
+  }
+  return t;
+}
+
+float bilinear(const height_field& heights, const vec2& p)
+{
+  const uvec2 last(heights.size() - 1u);
+  const uvec2 p0(p);
+  const uvec2 p1(glm::min(p0 + 1u, last));
+  const vec2 f(p - vec2(p0));
+  const float a = heights(p0) + f.x * (heights(uvec2(p1.x, p0.y)) - heights(p0));
+  const float b = heights(uvec2(p0.x, p1.y)) + f.x * (heights(p1) - heights(uvec2(p0.x, p1.y)));
+  return a + f.y * (b - a);
+}
+}
+
+horizon_field::horizon_field(const height_field& heights, const unsigned direction_count, const float max_distance, const minmax_pyramid* pyramid, parallel::thread_pool& pool)
+  : m_size(heights.size())
+  , m_horizons(std::max(direction_count, 1u), field<float>(heights.size()))
+{
+  if (m_size.x == 0 || m_size.y == 0)
+  {
+    return;
+  }
+
+  float highest = pyramid ? pyramid->bounds().y : heights(uvec2(0));
+  if (!pyramid)
+  {
+    for (unsigned y = 0; y < m_size.y; ++y)
+    {
+      for (unsigned x = 0; x < m_size.x; ++x)
+      {
+        highest = std::max(highest, heights(uvec2(x, y)));
+      }
+    }
+  }
+
+  const vec2 last(m_size - 1u);
+  pool.parallel_for(m_size.y, [&](const unsigned y)
+  {
+    for (unsigned d = 0; d < this->direction_count(); ++d)
+    {
+      const vec2 dir(direction(d));
+      // world length of a step of one sample along dir
+      const float step_length = glm::length(dir * heights.resolution());
+
+      for (unsigned x = 0; x < m_size.x; ++x)
+      {
+        const vec2 origin(static_cast<float>(x), static_cast<float>(y));
+        const float h0 = heights(uvec2(x, y));
+
+        // march with steps growing with the distance, far away features only need coarse sampling
+        float best = 0.0f; // tangent of the horizon
+        float t = 1.0f;
+        const float ray_end = ray_length(origin, dir, last, max_distance > 0.0f ? max_distance / step_length : 0.0f);
+        unsigned steps_checked = 0;
+        while (true)
+        {
+          const vec2 p(origin + dir * t);
+          const float distance = t * step_length;
+          if (p.x < 0.0f || p.y < 0.0f || p.x > last.x || p.y > last.y || (max_distance > 0.0f && distance > max_distance))
+          {
+            break;
+          }
+          // nothing further away can be higher than the highest sample
+          if (highest - h0 <= best * distance)
+          {
+            break;
+          }
+
+          // the rest of the ray cannot rise above the horizon found so far, the pyramid bounds it
+          if (pyramid && steps_checked == 0)
+          {
+            const vec2 end(glm::clamp(origin + dir * ray_end, vec2(0.0f), last));
+            const uvec2 box_begin(glm::min(p, end));
+            const uvec2 box_end(glm::min(uvec2(glm::max(p, end)) + 2u, m_size));
+            if (pyramid->coarse_bounds(box_begin, box_end).y - h0 <= best * distance)
+            {
+              break;
+            }
+            steps_checked = segment_steps;
+          }
+
+          best = std::max(best, (bilinear(heights, p) - h0) / distance);
+          t = next_step(t);
+          steps_checked = steps_checked > 0 ? steps_checked - 1 : 0;
+        }
+
+        m_horizons[d](uvec2(x, y)) = best / std::sqrt(1.0f + best * best);
+      }
+    }
+  });
+}
+
+vec2 horizon_field::direction(const unsigned i) const
+{
+  const float angle = two_pi * static_cast<float>(i) / static_cast<float>(direction_count());
+  return vec2(std::cos(angle), std::sin(angle));
+}
+
+field<float>::ptr horizon_field::ambient_occlusion(parallel::thread_pool& pool) const
+{
+  field<float>::ptr result(new field<float>(m_size));
+  const float weight = 1.0f / static_cast<float>(direction_count());
+  pool.parallel_for(m_size.y, [&](const unsigned y)
+  {
+    for (unsigned x = 0; x < m_size.x; ++x)
+    {
+      // the sky below a horizon at angle a holds sin^2(a) of the cosine weighted hemisphere slice
+      const uvec2 pos(x, y);
+      float open = 0.0f;
+      for (unsigned d = 0; d < direction_count(); ++d)
+      {
+        const float s = m_horizons[d](pos);
+        open += 1.0f - s * s;
+      }
+      (*result)(pos) = open * weight;
+    }
+  });
+  return result;
+}
+
+field<float>::ptr horizon_field::sun_visibility(const vec3& sun_direction, const float softness, parallel::thread_pool& pool) const
+{
+  field<float>::ptr result(new field<float>(m_size));
+  const vec3 sun(glm::normalize(sun_direction));
+  const float elevation = std::asin(sun.z);
+
+  // the horizon towards the sun is interpolated between the two directions around it
+  float azimuth = std::atan2(sun.y, sun.x);
+  if (azimuth < 0.0f)
+  {
+    azimuth += two_pi;
+  }
+  const float slot = azimuth / two_pi * static_cast<float>(direction_count());
+  const unsigned d0 = static_cast<unsigned>(slot) % direction_count();
+  const unsigned d1 = (d0 + 1) % direction_count();
+  const float f = slot - std::floor(slot);
+  const float inv_softness = 1.0f / std::max(softness, 1e-6f);
+
+  pool.parallel_for(m_size.y, [&](const unsigned y)
+  {
+    for (unsigned x = 0; x < m_size.x; ++x)
+    {
+      const uvec2 pos(x, y);
+      const float horizon = std::asin(m_horizons[d0](pos) + f * (m_horizons[d1](pos) - m_horizons[d0](pos)));
+      (*result)(pos) = glm::clamp((elevation - horizon) * inv_softness + 0.5f, 0.0f, 1.0f);
+    }
+  });
+  return result;
+}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "types.h"
+#include "field.h"
+#include "height_field.h"
+#include "minmax_pyramid.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// horizon elevation of every sample in a fixed set of directions around it
+// stored as the sine of the angle above the horizontal, horizons below it are stored as 0
+// ambient occlusion and sun visibility are derived from it without touching the heights again
+  class horizon_field
+  {
+  public:
+    using ptr = std::shared_ptr<horizon_field>;
+
+  public:
+    // max_distance in world units limits the search, 0 searches up to the border
+    // with a pyramid (over the same heights) ray segments that cannot rise above the horizon found so far are skipped
+    horizon_field(const height_field& heights
+                  , const unsigned direction_count = 16
+                  , const float max_distance = 0.0f
+                  , const minmax_pyramid* pyramid = nullptr
+                  , parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+    const uvec2& size() const
+    {
+      return m_size;
+    }
+
+    unsigned direction_count() const
+    {
+      return static_cast<unsigned>(m_horizons.size());
+    }
+
+    // direction i is at angle 2 pi i / direction_count() from the x axis of the grid
+    vec2 direction(const unsigned i) const;
+
+    float horizon(const uvec2& pos, const unsigned direction) const
+    {
+      return m_horizons[direction](pos);
+    }
+
+    // visible fraction of the cosine weighted sky, 1 in the open
+    field<float>::ptr ambient_occlusion(parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+    // 1 where the sun is above the horizon, 0 where it is behind it
+    // sun_direction points to the sun in the height field frame (x, y along the grid, z up)
+    // softness is the angular width of the penumbra in radians
+    field<float>::ptr sun_visibility(const vec3& sun_direction, const float softness = 0.02f, parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+  private:
+    uvec2 m_size;
+    std::vector<field<float>> m_horizons; // one field per direction
+  };
+}
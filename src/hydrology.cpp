@@ -0,0 +1,496 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <vector>
+
+#include "hydrology.h"
+
+namespace terrain
+{
+namespace
+{
+const float two_pi = 6.28318530718f;
+
+const int offsets[8][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 } };
+
+// rows scanned for sources per task of the accumulation
+const unsigned band_rows = 64;
+
+// buckets of the priority-flood queue over the height range
+const unsigned bucket_count = 1u << 16;
+
+// in the in-degree of a cell that a thread took over
+const std::uint8_t claimed = 0xff;
+
+struct queued_cell
+{
+  float height;
+  unsigned index;
+};
+
+// min heap order, ties by index so the fill does not depend on the push order
+struct higher
+{
+  bool operator()(const queued_cell& a, const queued_cell& b) const
+  {
+    return a.height > b.height || (a.height == b.height && a.index > b.index);
+  }
+};
+
+// monotone priority queue: the priority-flood never pushes below the last pop,
+// so the lowest bucket only moves up and each bucket is a small heap
+class bucket_queue
+{
+public:
+  bucket_queue(const float low, const float high)
+    : m_buckets(bucket_count)
+    , m_low(low)
+    , m_scale(high > low ? static_cast<float>(bucket_count) / (high - low) : 0.0f)
+    , m_current(bucket_count)
+    , m_size(0)
+  { }
+
+  bool empty() const
+  {
+    return m_size == 0;
+  }
+
+  void push(const float height, const unsigned index)
+  {
+    const unsigned b = bucket(height);
+    std::vector<queued_cell>& cells = m_buckets[b];
+    cells.push_back(queued_cell{ height, index });
+    std::push_heap(cells.begin(), cells.end(), higher());
+    m_current = std::min(m_current, b);
+    ++m_size;
+  }
+
+  queued_cell pop()
+  {
+    while (m_buckets[m_current].empty())
+    {
+      ++m_current;
+    }
+    std::vector<queued_cell>& cells = m_buckets[m_current];
+    std::pop_heap(cells.begin(), cells.end(), higher());
+    const queued_cell result = cells.back();
+    cells.pop_back();
+    --m_size;
+    return result;
+  }
+
+private:
+  unsigned bucket(const float height) const
+  {
+    const float b = (height - m_low) * m_scale;
+    return b <= 0.0f ? 0 : b >= static_cast<float>(bucket_count - 1) ? bucket_count - 1 : static_cast<unsigned>(b);
+  }
+
+private:
+  std::vector<std::vector<queued_cell>> m_buckets;
+  float m_low;
+  float m_scale;
+  unsigned m_current; // no bucket below is used
+  std::size_t m_size;
+};
+
+bool inside(const uvec2& size, const int x, const int y)
+{
+  return x >= 0 && y >= 0 && x < static_cast<int>(size.x) && y < static_cast<int>(size.y);
+}
+
+// angles of the 8 neighbour directions in world space, angles[8] closes the circle
+struct neighbour_angles
+{
+  neighbour_angles(const vec2& resolution)
+  {
+    for (unsigned i = 0; i < 8; ++i)
+    {
+      const float a = std::atan2(static_cast<float>(offsets[i][1]) * resolution.y, static_cast<float>(offsets[i][0]) * resolution.x);
+      angles[i] = a < 0.0f ? a + two_pi : a;
+    }
+    angles[8] = two_pi;
+  }
+
+  float angles[9];
+};
+
+// calls receivers(x, y, targets, fractions) -> count for the cells a cell drains into, inside the field
+// weight(index) of every cell flows down to all receivers
+template<class R>
+field<float>::ptr accumulate(const uvec2& size, const R& receivers, const field<float>* weights, parallel::thread_pool& pool)
+{
+  field<float>::ptr result(new field<float>(size));
+  float* acc = &(*result)(uvec2(0));
+  const unsigned width = size.x;
+  const unsigned count = size.x * size.y;
+  if (count == 0)
+  {
+    return result;
+  }
+
+  // number of upstream neighbours not summed yet
+  std::vector<std::atomic<std::uint8_t>> in_degree(count);
+  for (std::atomic<std::uint8_t>& d : in_degree)
+  {
+    d.store(0, std::memory_order_relaxed);
+  }
+  pool.parallel_for(size.y, [&](const unsigned y)
+  {
+    unsigned targets[2];
+    float fractions[2];
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const unsigned n = receivers(x, y, targets, fractions);
+      for (unsigned i = 0; i < n; ++i)
+      {
+        in_degree[targets[i]].fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  });
+
+  // whoever finds the in-degree at 0 takes the cell, a scan of the sources or the walk that delivered the last neighbour
+  auto take = [&](const unsigned index)
+  {
+    std::uint8_t expected = 0;
+    return in_degree[index].compare_exchange_strong(expected, claimed, std::memory_order_acq_rel);
+  };
+
+  const unsigned band_count = (size.y + band_rows - 1) / band_rows;
+  pool.parallel_for(band_count, [&](const unsigned band)
+  {
+    std::vector<unsigned> pending;
+    unsigned targets[2];
+    float fractions[2];
+    const unsigned y_end = std::min((band + 1) * band_rows, size.y);
+    for (unsigned i = band * band_rows * width; i < y_end * width; ++i)
+    {
+      if (in_degree[i].load(std::memory_order_relaxed) != 0 || !take(i))
+      {
+        continue;
+      }
+
+      pending.push_back(i);
+      while (!pending.empty())
+      {
+        const unsigned c = pending.back();
+        pending.pop_back();
+        const unsigned cx = c % width;
+        const unsigned cy = c / width;
+
+        // everything upstream is summed, gather it in a fixed order
+        float sum = weights ? (*weights)(uvec2(cx, cy)) : 1.0f;
+        for (unsigned k = 0; k < 8; ++k)
+        {
+          const int ux = static_cast<int>(cx) + offsets[k][0];
+          const int uy = static_cast<int>(cy) + offsets[k][1];
+          if (!inside(size, ux, uy))
+          {
+            continue;
+          }
+          const unsigned n = receivers(static_cast<unsigned>(ux), static_cast<unsigned>(uy), targets, fractions);
+          for (unsigned r = 0; r < n; ++r)
+          {
+            if (targets[r] == c)
+            {
+              sum += acc[static_cast<unsigned>(ux) + width * static_cast<unsigned>(uy)] * fractions[r];
+            }
+          }
+        }
+        acc[c] = sum;
+
+        const unsigned n = receivers(cx, cy, targets, fractions);
+        for (unsigned r = 0; r < n; ++r)
+        {
+          if (in_degree[targets[r]].fetch_sub(1, std::memory_order_acq_rel) == 1 && take(targets[r]))
+          {
+            pending.push_back(targets[r]);
+          }
+        }
+      }
+    }
+  });
+  return result;
+}
+}
+
+void fill_depressions(height_field& heights, const fill_mode::Enum mode)
+{
+  const uvec2 size(heights.size());
+  const unsigned count = size.x * size.y;
+  if (count == 0)
+  {
+    return;
+  }
+  float* h = &heights(uvec2(0));
+
+  float low = std::numeric_limits<float>::max();
+  float high = -std::numeric_limits<float>::max();
+  for (unsigned i = 0; i < count; ++i)
+  {
+    if (!std::isnan(h[i]))
+    {
+      low = std::min(low, h[i]);
+      high = std::max(high, h[i]);
+    }
+  }
+
+  // the border and the cells next to nodata are the outlets
+  std::vector<std::uint8_t> closed(count, 0);
+  bucket_queue open(low, high);
+  for (unsigned y = 0; y < size.y; ++y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const unsigned i = x + size.x * y;
+      if (std::isnan(h[i]))
+      {
+        closed[i] = 1;
+        continue;
+      }
+      bool outlet = x == 0 || y == 0 || x + 1 == size.x || y + 1 == size.y;
+      for (unsigned k = 0; k < 8 && !outlet; ++k)
+      {
+        outlet = std::isnan(h[(x + offsets[k][0]) + size.x * (y + offsets[k][1])]);
+      }
+      if (outlet)
+      {
+        closed[i] = 1;
+        open.push(h[i], i);
+      }
+    }
+  }
+
+  std::queue<unsigned> pit;
+  while (!open.empty() || !pit.empty())
+  {
+    unsigned c;
+    if (!pit.empty())
+    {
+      c = pit.front();
+      pit.pop();
+    }
+    else
+    {
+      c = open.pop().index;
+    }
+
+    const float spill = mode == fill_mode::epsilon ? std::nextafter(h[c], std::numeric_limits<float>::infinity()) : h[c];
+    const int cx = static_cast<int>(c % size.x);
+    const int cy = static_cast<int>(c / size.x);
+    for (unsigned k = 0; k < 8; ++k)
+    {
+      const int x = cx + offsets[k][0];
+      const int y = cy + offsets[k][1];
+      if (!inside(size, x, y))
+      {
+        continue;
+      }
+      const unsigned n = static_cast<unsigned>(x) + size.x * static_cast<unsigned>(y);
+      if (closed[n])
+      {
+        continue;
+      }
+      closed[n] = 1;
+
+      // raised cells drain over c, they are done before anything higher
+      if (h[n] <= spill)
+      {
+        h[n] = spill;
+        pit.push(n);
+      }
+      else
+      {
+        open.push(h[n], n);
+      }
+    }
+  }
+
+  heights.mark_dirty(uvec2(0), size);
+}
+
+ivec2 d8_offset(const unsigned i)
+{
+  return ivec2(offsets[i][0], offsets[i][1]);
+}
+
+field<std::uint8_t>::ptr flow_direction_d8(const height_field& heights, parallel::thread_pool& pool)
+{
+  const uvec2 size(heights.size());
+  field<std::uint8_t>::ptr result(new field<std::uint8_t>(size));
+
+  float inv_distance[8];
+  for (unsigned k = 0; k < 8; ++k)
+  {
+    inv_distance[k] = 1.0f / glm::length(vec2(static_cast<float>(offsets[k][0]), static_cast<float>(offsets[k][1])) * heights.resolution());
+  }
+
+  pool.parallel_for(size.y, [&](const unsigned y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const float h = heights(uvec2(x, y));
+      std::uint8_t direction = d8_no_flow;
+      float steepest = 0.0f;
+      for (unsigned k = 0; k < 8 && !std::isnan(h); ++k)
+      {
+        const int nx = static_cast<int>(x) + offsets[k][0];
+        const int ny = static_cast<int>(y) + offsets[k][1];
+        if (!inside(size, nx, ny))
+        {
+          continue;
+        }
+        const float drop = (h - heights(uvec2(static_cast<unsigned>(nx), static_cast<unsigned>(ny)))) * inv_distance[k];
+        if (drop > steepest)
+        {
+          steepest = drop;
+          direction = static_cast<std::uint8_t>(k);
+        }
+      }
+      (*result)(uvec2(x, y)) = direction;
+    }
+  });
+  return result;
+}
+
+field<float>::ptr flow_direction_dinf(const height_field& heights, parallel::thread_pool& pool)
+{
+  const uvec2 size(heights.size());
+  field<float>::ptr result(new field<float>(size));
+  const neighbour_angles directions(heights.resolution());
+
+  vec2 steps[8];
+  for (unsigned k = 0; k < 8; ++k)
+  {
+    steps[k] = vec2(static_cast<float>(offsets[k][0]), static_cast<float>(offsets[k][1])) * heights.resolution();
+  }
+
+  pool.parallel_for(size.y, [&](const unsigned y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      const float h = heights(uvec2(x, y));
+      float steepest = 0.0f;
+      float angle = -1.0f;
+      for (unsigned k = 0; k < 8 && !std::isnan(h); ++k)
+      {
+        // facet between neighbour k and k + 1
+        const unsigned k1 = (k + 1) & 7u;
+        const int x0 = static_cast<int>(x) + offsets[k][0];
+        const int y0 = static_cast<int>(y) + offsets[k][1];
+        const int x1 = static_cast<int>(x) + offsets[k1][0];
+        const int y1 = static_cast<int>(y) + offsets[k1][1];
+        if (!inside(size, x0, y0) || !inside(size, x1, y1))
+        {
+          continue;
+        }
+        const float d0 = heights(uvec2(static_cast<unsigned>(x0), static_cast<unsigned>(y0))) - h;
+        const float d1 = heights(uvec2(static_cast<unsigned>(x1), static_cast<unsigned>(y1))) - h;
+        if (std::isnan(d0) || std::isnan(d1))
+        {
+          continue;
+        }
+
+        // gradient g of the facet plane from g . step = height difference along both edges
+        const vec2& v0 = steps[k];
+        const vec2& v1 = steps[k1];
+        const float det = v0.x * v1.y - v0.y * v1.x;
+        const vec2 g((d0 * v1.y - d1 * v0.y) / det, (v0.x * d1 - v1.x * d0) / det);
+
+        float a = std::atan2(-g.y, -g.x);
+        a = a < 0.0f ? a + two_pi : a;
+        a = k == 7 && a < directions.angles[7] ? a + two_pi : a;
+        if (a >= directions.angles[k] && a <= directions.angles[k + 1])
+        {
+          // downhill inside the facet
+          const float slope = glm::length(g);
+          if (slope > steepest)
+          {
+            steepest = slope;
+            angle = a;
+          }
+          continue;
+        }
+
+        // otherwise along the steeper edge
+        const float s0 = -d0 / glm::length(v0);
+        const float s1 = -d1 / glm::length(v1);
+        if (s0 > steepest && s0 >= s1)
+        {
+          steepest = s0;
+          angle = directions.angles[k];
+        }
+        else if (s1 > steepest)
+        {
+          steepest = s1;
+          angle = directions.angles[k + 1];
+        }
+      }
+      (*result)(uvec2(x, y)) = angle >= two_pi ? angle - two_pi : angle;
+    }
+  });
+  return result;
+}
+
+field<float>::ptr flow_accumulation_d8(const field<std::uint8_t>& directions, const field<float>* weights, parallel::thread_pool& pool)
+{
+  const uvec2 size(directions.size());
+  return accumulate(size, [&](const unsigned x, const unsigned y, unsigned* targets, float* fractions) -> unsigned
+  {
+    const std::uint8_t d = directions(uvec2(x, y));
+    if (d >= 8)
+    {
+      return 0;
+    }
+    const int tx = static_cast<int>(x) + offsets[d][0];
+    const int ty = static_cast<int>(y) + offsets[d][1];
+    if (!inside(size, tx, ty))
+    {
+      return 0;
+    }
+    targets[0] = static_cast<unsigned>(tx) + size.x * static_cast<unsigned>(ty);
+    fractions[0] = 1.0f;
+    return 1;
+  }, weights, pool);
+}
+
+field<float>::ptr flow_accumulation_dinf(const field<float>& angles, const vec2& resolution, const field<float>* weights, parallel::thread_pool& pool)
+{
+  const uvec2 size(angles.size());
+  const neighbour_angles directions(resolution);
+  return accumulate(size, [&](const unsigned x, const unsigned y, unsigned* targets, float* fractions) -> unsigned
+  {
+    const float a = angles(uvec2(x, y));
+    if (!(a >= 0.0f))
+    {
+      return 0;
+    }
+
+    // the facet holding the angle, split by the position inside it
+    unsigned k = 7;
+    while (k > 0 && directions.angles[k] > a)
+    {
+      --k;
+    }
+    const float f = (a - directions.angles[k]) / (directions.angles[k + 1] - directions.angles[k]);
+    const unsigned neighbours[2] = { k, (k + 1) & 7u };
+    const float shares[2] = { 1.0f - f, f };
+
+    unsigned n = 0;
+    for (unsigned i = 0; i < 2; ++i)
+    {
+      const int tx = static_cast<int>(x) + offsets[neighbours[i]][0];
+      const int ty = static_cast<int>(y) + offsets[neighbours[i]][1];
+      if (shares[i] > 0.0f && inside(size, tx, ty))
+      {
+        targets[n] = static_cast<unsigned>(tx) + size.x * static_cast<unsigned>(ty);
+        fractions[n] = shares[i];
+        ++n;
+      }
+    }
+    return n;
+  }, weights, pool);
+}
+}
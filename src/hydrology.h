@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "types.h"
+#include "field.h"
+#include "height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+  struct fill_mode
+  {
+    enum Enum
+    {
+      flat      // depressions become flat
+      , epsilon // depressions get the smallest float step per cell towards the outlet, so every cell drains
+    };
+  };
+
+// priority-flood (Barnes et al. 2014) from the border and the nodata (NaN) cells inwards
+// the open cells are kept in a bucket queue over the height range with a small heap per bucket,
+// cells raised inside a depression skip it through a plain fifo
+// marks the whole height field dirty
+  void fill_depressions(height_field& heights, const fill_mode::Enum mode = fill_mode::epsilon);
+
+// neighbour i of a cell is at the offset d8_offset(i), counter clockwise from +x
+  const std::uint8_t d8_no_flow = 255;
+  ivec2 d8_offset(const unsigned i);
+
+// index of the steepest downhill neighbour (drop over world distance), d8_no_flow for pits, flats, nodata
+// and border cells without a lower neighbour
+  field<std::uint8_t>::ptr flow_direction_d8(const height_field& heights, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+// D-infinity (Tarboton 1997): downhill angle of the steepest of the 8 triangular facets around the cell,
+// radians counter clockwise from +x in world space, -1 where nothing is lower
+// the flow is split between the two neighbours bounding the facet by the angle
+  field<float>::ptr flow_direction_dinf(const height_field& heights, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+// upstream sum of weights (1 per cell without weights) including the cell itself
+// topological order without recursion: the cells nothing flows into start a walk downstream,
+// a cell is summed by the thread that delivers its last upstream neighbour, the result does not depend on the thread count
+  field<float>::ptr flow_accumulation_d8(const field<std::uint8_t>& directions, const field<float>* weights = nullptr, parallel::thread_pool& pool = parallel::thread_pool::instance());
+  field<float>::ptr flow_accumulation_dinf(const field<float>& angles, const vec2& resolution, const field<float>* weights = nullptr, parallel::thread_pool& pool = parallel::thread_pool::instance());
+}
@@ -0,0 +1,128 @@
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+namespace io
+{
+#ifdef _WIN32
+mapped_file::mapped_file(const std::string& path, const mode::Enum m)
+  : m_data(nullptr)
+  , m_size(0)
+  , m_file(INVALID_HANDLE_VALUE)
+  , m_mapping(nullptr)
+{
+  m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_file == INVALID_HANDLE_VALUE)
+  {
+    throw std::runtime_error(std::string("Could not open file: ") + path);
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(m_file, &size))
+  {
+    CloseHandle(m_file);
+    throw std::runtime_error(std::string("Could not get file size: ") + path);
+  }
+  m_size = static_cast<std::size_t>(size.QuadPart);
+  if (m_size == 0)
+  {
+    return;
+  }
+
+  m_mapping = CreateFileMappingA(m_file, nullptr, m == mode::copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+  if (!m_mapping)
+  {
+    CloseHandle(m_file);
+    throw std::runtime_error(std::string("Could not map file: ") + path);
+  }
+
+  m_data = static_cast<char*>(MapViewOfFile(m_mapping, m == mode::copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+  if (!m_data)
+  {
+    CloseHandle(m_mapping);
+    CloseHandle(m_file);
+    throw std::runtime_error(std::string("Could not map file: ") + path);
+  }
+}
+
+mapped_file::~mapped_file()
+{
+  if (m_data)
+  {
+    UnmapViewOfFile(m_data);
+  }
+  if (m_mapping)
+  {
+    CloseHandle(m_mapping);
+  }
+  CloseHandle(m_file);
+}
+#else
+mapped_file::mapped_file(const std::string& path, const mode::Enum m)
+  : m_data(nullptr)
+  , m_size(0)
+  , m_file(-1)
+{
+  m_file = open(path.c_str(), O_RDONLY);
+  if (m_file < 0)
+  {
+    throw std::runtime_error(std::string("Could not open file: ") + path);
+  }
+
+  struct stat st;
+  if (fstat(m_file, &st) != 0)
+  {
+    close(m_file);
+    throw std::runtime_error(std::string("Could not get file size: ") + path);
+  }
+  m_size = static_cast<std::size_t>(st.st_size);
+  if (m_size == 0)
+  {
+    return;
+  }
+
+  void* data = mmap(nullptr, m_size, m == mode::copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, m_file, 0);
+  if (data == MAP_FAILED)
+  {
+    close(m_file);
+    throw std::runtime_error(std::string("Could not map file: ") + path);
+  }
+  m_data = static_cast<char*>(data);
+}
+
+mapped_file::~mapped_file()
+{
+  if (m_data)
+  {
+    munmap(m_data, m_size);
+  }
+  close(m_file);
+}
+#endif
+
+const char* mapped_file::data() const
+{
+  return m_data;
+}
+
+char* mapped_file::data()
+{
+  return m_data;
+}
+
+std::size_t mapped_file::size() const
+{
+  return m_size;
+}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace io
+{
+// maps a whole file into memory, pages are read on first access
+class mapped_file
+{
+public:
+  using ptr = std::shared_ptr<mapped_file>;
+
+  struct mode
+  {
+    enum Enum
+    {
+      read_only
+      , copy_on_write // writes are private to the process and never reach the file
+    };
+  };
+
+public:
+  mapped_file(const std::string& path, const mode::Enum m);
+  ~mapped_file();
+
+  const char* data() const;
+  char* data();
+  std::size_t size() const;
+
+private:
+  char* m_data;
+  std::size_t m_size;
+#ifdef _WIN32
+  void* m_file;
+  void* m_mapping;
+#else
+  int m_file;
+#endif
+
+private:
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator = (const mapped_file&) = delete;
+};
+}
@@ -0,0 +1,101 @@
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "mapped_height_field.h"
+
+namespace terrain
+{
+namespace
+{
+const char raw_height_magic[4] = { 'R', 'H', 'F', '1' };
+const std::uint32_t raw_height_version = 1;
+// samples start on a page boundary
+const std::uint64_t raw_height_data_offset = 4096;
+}
+
+mapped_height_field::ptr mapped_height_field::open(const std::string& path)
+{
+  // the header is checked before anything is mapped
+  raw_height_header header;
+  {
+    std::ifstream stream(path.c_str(), std::ios::binary | std::ios::in);
+    if (!stream.is_open())
+    {
+      throw std::runtime_error(std::string("could not open raw height file: ") + path);
+    }
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+      throw std::runtime_error(std::string("not a raw height file: ") + path);
+    }
+  }
+
+  if (std::memcmp(header.magic, raw_height_magic, sizeof(raw_height_magic)) != 0 || header.version != raw_height_version)
+  {
+    throw std::runtime_error(std::string("not a raw height file: ") + path);
+  }
+
+  // samples are addressed with unsigned indices
+  const std::uint64_t sample_count = static_cast<std::uint64_t>(header.width) * header.height;
+  if (sample_count > std::numeric_limits<unsigned>::max())
+  {
+    throw std::runtime_error(std::string("raw height file too large to index: ") + path);
+  }
+
+  io::mapped_file::ptr file(new io::mapped_file(path, io::mapped_file::mode::copy_on_write));
+  const std::uint64_t data_size = sample_count * sizeof(value_t);
+  if (header.data_offset % sizeof(value_t) != 0 || header.data_offset > file->size() || data_size > file->size() - header.data_offset)
+  {
+    throw std::runtime_error(std::string("truncated raw height file: ") + path);
+  }
+
+  return ptr(new mapped_height_field(header, file));
+}
+
+void mapped_height_field::write(const std::string& path, const height_field& field, const double* geo_transform)
+{
+  raw_height_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, raw_height_magic, sizeof(raw_height_magic));
+  header.version = raw_height_version;
+  header.width = field.size().x;
+  header.height = field.size().y;
+  header.resolution[0] = field.resolution().x;
+  header.resolution[1] = field.resolution().y;
+  if (geo_transform)
+  {
+    std::memcpy(header.geo_transform, geo_transform, sizeof(header.geo_transform));
+  }
+  else
+  {
+    header.geo_transform[1] = field.resolution().x;
+    header.geo_transform[5] = field.resolution().y;
+  }
+  header.data_offset = raw_height_data_offset;
+
+  std::ofstream stream(path.c_str(), std::ios::binary | std::ios::out);
+  if (!stream.is_open())
+  {
+    throw std::runtime_error(std::string("could not open raw height file: ") + path);
+  }
+
+  const std::vector<char> padding(static_cast<std::size_t>(header.data_offset) - sizeof(header), 0);
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  stream.write(&padding[0], padding.size());
+  stream.write(reinterpret_cast<const char*>(field.data()), static_cast<std::streamsize>(field.size().x) * field.size().y * sizeof(value_t));
+  if (!stream)
+  {
+    throw std::runtime_error(std::string("could not write raw height file: ") + path);
+  }
+}
+
+mapped_height_field::mapped_height_field(const raw_height_header& header, const io::mapped_file::ptr& file)
+  : height_field(uvec2(header.width, header.height)
+                 , vec2(header.resolution[0], header.resolution[1])
+                 , reinterpret_cast<value_t*>(file->data() + header.data_offset)
+                 , file)
+  , m_geo_reference(header.geo_transform, static_cast<int>(header.width), static_cast<int>(header.height))
+{ }
+}
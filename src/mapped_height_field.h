@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "height_field.h"
+#include "elevation_reader.h"
+#include "mapped_file.h"
+
+namespace terrain
+{
+// raw height file, little endian
+// header, zero padding up to data_offset, then width * height floats in row-major order
+  struct raw_height_header
+  {
+    char magic[4];            // "RHF1"
+    std::uint32_t version;
+    std::uint32_t width;
+    std::uint32_t height;
+    float resolution[2];
+    double geo_transform[6];  // gdal style, pixel -> geo
+    std::uint64_t data_offset;
+  };
+
+// height field viewing a mapped raw height file
+// opening is O(1), samples are paged in on first access
+// the mapping is copy-on-write, edits are kept in memory and never written back
+  class mapped_height_field : public height_field
+  {
+  public:
+    using ptr = std::shared_ptr<mapped_height_field>;
+
+  public:
+    static ptr open(const std::string& path);
+
+    // geo_transform may be null, then the pixel grid scaled by the resolution is used
+    static void write(const std::string& path, const height_field& field, const double* geo_transform);
+
+  public:
+    const geo_reference& geo() const
+    {
+      return m_geo_reference;
+    }
+
+  private:
+    mapped_height_field(const raw_height_header& header, const io::mapped_file::ptr& file);
+
+  private:
+    const geo_reference m_geo_reference;
+  };
+}
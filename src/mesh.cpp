@@ -17,6 +17,10 @@ mesh::mesh(const std::vector<vec3>& vertices, const std::vector<unsigned>& indic
   , m_uv_buffer_id(0)
   , m_index_buffer_id(0)
   , m_height_field_texture_id(0)
+  , m_height_field_tiles_texture_id(0)
+  , m_height_field_float_tiles_texture_id(0)
+  , m_normal_field_texture_id(0)
+  , m_shading_field_texture_id(0)
 {
   glGenVertexArrays(1, &m_vertex_array_id);
 
@@ -53,9 +57,21 @@ void mesh::add_uvs(const std::vector<vec2>& uvs)
   add_buffer(uvs, GL_ARRAY_BUFFER, m_uv_buffer_id);
 }
 
-void mesh::set_height_field_texture(const unsigned id)
+void mesh::set_height_field_texture(const unsigned id, const unsigned tiles_id, const unsigned float_tiles_id)
 {
   m_height_field_texture_id = id;
+  m_height_field_tiles_texture_id = tiles_id;
+  m_height_field_float_tiles_texture_id = float_tiles_id;
+}
+
+void mesh::set_normal_field_texture(const unsigned id)
+{
+  m_normal_field_texture_id = id;
+}
+
+void mesh::set_shading_field_texture(const unsigned id)
+{
+  m_shading_field_texture_id = id;
 }
 
 void mesh::set_transformation(const mat4& m)
@@ -111,6 +127,31 @@ void mesh::render(const shader_program& shader_program, const mat4& view, const
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, m_height_field_texture_id);
     shader_program.setUniform1i("height_field", 0); // TODO: 0 texture slot is used for the texture, store it instead
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_height_field_tiles_texture_id);
+    shader_program.setUniform1i("height_field_tiles", 1);
+
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, m_height_field_float_tiles_texture_id);
+    shader_program.setUniform1i("height_field_float_tiles", 4);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  if (m_normal_field_texture_id && shader_program.need_normal_field())
+  {
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, m_normal_field_texture_id);
+    shader_program.setUniform1i("normal_field", 2);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  if (m_shading_field_texture_id && shader_program.need_shading_field())
+  {
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, m_shading_field_texture_id);
+    shader_program.setUniform1i("shading_field", 3);
+    glActiveTexture(GL_TEXTURE0);
   }
 
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer_id);
@@ -22,8 +22,12 @@ public:
   void add_colors(const std::vector<vec3>& buffer);
   void add_normals(const std::vector<vec3>& buffer);
   void add_uvs(const std::vector<vec2>& buffer);
-  void set_height_field_texture(const unsigned id);
+  // tiles_id holds the offset/scale per tile of the quantized height samples in id
+  // float_tiles_id is the atlas of the tiles stored as floats
+  void set_height_field_texture(const unsigned id, const unsigned tiles_id, const unsigned float_tiles_id);
   void set_normal_field_texture(const unsigned id);
+  // ambient occlusion in red, sun visibility in green
+  void set_shading_field_texture(const unsigned id);
   void set_transformation(const mat4& m);
   const mat4& get_transformation() const;
 
@@ -56,6 +60,9 @@ private:
   unsigned m_index_buffer_id;
 
   unsigned m_height_field_texture_id;
+  unsigned m_height_field_tiles_texture_id;
+  unsigned m_height_field_float_tiles_texture_id;
   unsigned m_normal_field_texture_id;
+  unsigned m_shading_field_texture_id;
 };
 }
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <limits>
+
+#include "minmax_pyramid.h"
+
+namespace terrain
+{
+namespace
+{
+// NaN samples are skipped, like field_stats does, so the result does not depend on the child order
+vec2 merge(const vec2& a, const vec2& b)
+{
+  if (b.x != b.x)
+  {
+    return a;
+  }
+  return vec2(std::min(a.x, b.x), std::max(a.y, b.y));
+}
+
+vec2 empty_bounds()
+{
+  return vec2(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+}
+}
+
+minmax_pyramid::minmax_pyramid(const height_field& field, parallel::thread_pool& pool)
+  : m_field(field)
+{
+  uvec2 size(field.size());
+  while (size.x > 1 || size.y > 1)
+  {
+    size = (size + 1u) / 2u;
+    m_levels.push_back(terrain::field<vec2>(size));
+  }
+
+  for (unsigned level = 1; level < level_count(); ++level)
+  {
+    build_level(level, uvec2(0), level_size(level), pool);
+  }
+}
+
+unsigned minmax_pyramid::level_count() const
+{
+  return static_cast<unsigned>(m_levels.size()) + 1;
+}
+
+uvec2 minmax_pyramid::level_size(const unsigned level) const
+{
+  return level == 0 ? m_field.size() : m_levels[level - 1].size();
+}
+
+vec2 minmax_pyramid::node(const unsigned level, const uvec2& pos) const
+{
+  if (level == 0)
+  {
+    const float h = m_field(pos);
+    return vec2(h, h);
+  }
+  return m_levels[level - 1](pos);
+}
+
+vec2 minmax_pyramid::bounds() const
+{
+  if (m_field.size().x == 0 || m_field.size().y == 0)
+  {
+    return empty_bounds();
+  }
+  return merge(empty_bounds(), node(level_count() - 1, uvec2(0)));
+}
+
+vec2 minmax_pyramid::bounds(const uvec2& begin, const uvec2& end) const
+{
+  const uvec2 clamped_end(glm::min(end, m_field.size()));
+  vec2 result(empty_bounds());
+  if (begin.x >= clamped_end.x || begin.y >= clamped_end.y)
+  {
+    return result;
+  }
+
+  struct entry
+  {
+    unsigned level;
+    uvec2 pos;
+  };
+
+  std::vector<entry> stack;
+  stack.push_back({ level_count() - 1, uvec2(0) });
+  while (!stack.empty())
+  {
+    const entry e = stack.back();
+    stack.pop_back();
+
+    const uvec2 node_begin(e.pos.x << e.level, e.pos.y << e.level);
+    const uvec2 node_end(glm::min(uvec2((e.pos.x + 1) << e.level, (e.pos.y + 1) << e.level), m_field.size()));
+    if (node_end.x <= begin.x || node_end.y <= begin.y || node_begin.x >= clamped_end.x || node_begin.y >= clamped_end.y)
+    {
+      continue;
+    }
+
+    if (node_begin.x >= begin.x && node_begin.y >= begin.y && node_end.x <= clamped_end.x && node_end.y <= clamped_end.y)
+    {
+      result = merge(result, node(e.level, e.pos));
+      continue;
+    }
+
+    const unsigned child_level = e.level - 1;
+    const uvec2 child_size(level_size(child_level));
+    for (unsigned j = 0; j < 2; ++j)
+    {
+      for (unsigned i = 0; i < 2; ++i)
+      {
+        const uvec2 child(e.pos.x * 2 + i, e.pos.y * 2 + j);
+        if (child.x < child_size.x && child.y < child_size.y)
+        {
+          stack.push_back({ child_level, child });
+        }
+      }
+    }
+  }
+  return result;
+}
+
+vec2 minmax_pyramid::coarse_bounds(const uvec2& begin, const uvec2& end) const
+{
+  const uvec2 clamped_end(glm::min(end, m_field.size()));
+  if (begin.x >= clamped_end.x || begin.y >= clamped_end.y)
+  {
+    return empty_bounds();
+  }
+
+  const uvec2 last(clamped_end - 1u);
+  unsigned level = 0;
+  while ((last.x >> level) - (begin.x >> level) > 1 || (last.y >> level) - (begin.y >> level) > 1)
+  {
+    ++level;
+  }
+
+  vec2 result(empty_bounds());
+  for (unsigned y = begin.y >> level; y <= last.y >> level; ++y)
+  {
+    for (unsigned x = begin.x >> level; x <= last.x >> level; ++x)
+    {
+      result = merge(result, node(level, uvec2(x, y)));
+    }
+  }
+  return result;
+}
+
+void minmax_pyramid::update(const uvec2& begin, const uvec2& end, parallel::thread_pool& pool)
+{
+  const uvec2 clamped_end(glm::min(end, m_field.size()));
+  if (begin.x >= clamped_end.x || begin.y >= clamped_end.y)
+  {
+    return;
+  }
+
+  const uvec2 last(clamped_end - 1u);
+  for (unsigned level = 1; level < level_count(); ++level)
+  {
+    build_level(level, uvec2(begin.x >> level, begin.y >> level), uvec2((last.x >> level) + 1, (last.y >> level) + 1), pool);
+  }
+}
+
+void minmax_pyramid::build_level(const unsigned level, const uvec2& begin, const uvec2& end, parallel::thread_pool& pool)
+{
+  const uvec2 below_size(level_size(level - 1));
+  field<vec2>& target(m_levels[level - 1]);
+  parallel::for_each_tile(pool, end - begin, uvec2(64, 64), [&](const uvec2& tile_begin, const uvec2& tile_end)
+  {
+    for (unsigned y = begin.y + tile_begin.y; y < begin.y + tile_end.y; ++y)
+    {
+      for (unsigned x = begin.x + tile_begin.x; x < begin.x + tile_end.x; ++x)
+      {
+        vec2 b(merge(empty_bounds(), node(level - 1, uvec2(2 * x, 2 * y))));
+        if (2 * x + 1 < below_size.x)
+        {
+          b = merge(b, node(level - 1, uvec2(2 * x + 1, 2 * y)));
+        }
+        if (2 * y + 1 < below_size.y)
+        {
+          b = merge(b, node(level - 1, uvec2(2 * x, 2 * y + 1)));
+          if (2 * x + 1 < below_size.x)
+          {
+            b = merge(b, node(level - 1, uvec2(2 * x + 1, 2 * y + 1)));
+          }
+        }
+        target(uvec2(x, y)) = b;
+      }
+    }
+  });
+}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "types.h"
+#include "height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// min/max quadtree over a height field
+// level 0 is the field itself, a node of level l covers 2^l x 2^l samples
+// node bounds are vec2(min, max), NaN samples are skipped: a level 0 node of a NaN sample is NaN,
+// any other node and the bounds without valid samples have min > max
+  class minmax_pyramid
+  {
+  public:
+    using ptr = std::shared_ptr<minmax_pyramid>;
+
+  public:
+    // the field must outlive the pyramid
+    minmax_pyramid(const height_field& field, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+    const height_field& source() const
+    {
+      return m_field;
+    }
+
+    unsigned level_count() const;
+    uvec2 level_size(const unsigned level) const;
+    vec2 node(const unsigned level, const uvec2& pos) const;
+
+    // bounds of the whole field
+    vec2 bounds() const;
+
+    // exact bounds of the samples in [begin, end)
+    // nodes fully inside are taken whole, so the cost is O(log n) plus the rectangle border, not its area
+    vec2 bounds(const uvec2& begin, const uvec2& end) const;
+
+    // conservative bounds of [begin, end) from the lowest level where it spans at most 2x2 nodes, O(1)
+    vec2 coarse_bounds(const uvec2& begin, const uvec2& end) const;
+
+    // rebuilds the nodes above [begin, end) after the field changed there
+    void update(const uvec2& begin, const uvec2& end, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+  private:
+    void build_level(const unsigned level, const uvec2& begin, const uvec2& end, parallel::thread_pool& pool);
+
+  private:
+    const height_field& m_field;
+    std::vector<field<vec2>> m_levels; // m_levels[i] is level i + 1
+  };
+}
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
+
+#include "noise_generator.h"
+
+namespace terrain
+{
+namespace
+{
+// the noise is written once against these operations, for float / std::uint32_t and for 4 lanes with SSE2
+// both do the same float operations in the same order, no fused multiply-add
+
+float vfloor(const float a) { return std::floor(a); }
+float vabs(const float a) { return std::abs(a); }
+float vmin(const float a, const float b) { return b < a ? b : a; }
+float vmax(const float a, const float b) { return b > a ? b : a; }
+bool vgreater(const float a, const float b) { return a > b; }
+float vselect(const bool m, const float a, const float b) { return m ? a : b; }
+std::uint32_t vint(const float a) { return static_cast<std::uint32_t>(static_cast<std::int32_t>(a)); }
+float vfloat(const std::uint32_t a) { return static_cast<float>(static_cast<std::int32_t>(a)); }
+float vlookup(const float* table, const std::uint32_t i) { return table[i & 7]; }
+
+#ifdef TERRAIN_SSE2
+struct float4
+{
+  float4(const __m128 v) : m(v) { }
+  float4(const float v) : m(_mm_set1_ps(v)) { }
+  __m128 m;
+};
+
+struct uint4
+{
+  uint4(const __m128i v) : m(v) { }
+  uint4(const std::uint32_t v) : m(_mm_set1_epi32(static_cast<int>(v))) { }
+  __m128i m;
+};
+
+float4 operator + (const float4& a, const float4& b) { return _mm_add_ps(a.m, b.m); }
+float4 operator - (const float4& a, const float4& b) { return _mm_sub_ps(a.m, b.m); }
+float4 operator * (const float4& a, const float4& b) { return _mm_mul_ps(a.m, b.m); }
+uint4 operator + (const uint4& a, const uint4& b) { return _mm_add_epi32(a.m, b.m); }
+uint4 operator ^ (const uint4& a, const uint4& b) { return _mm_xor_si128(a.m, b.m); }
+uint4 operator >> (const uint4& a, const int n) { return _mm_srli_epi32(a.m, n); }
+
+// low 32 bits of the products, from the even and the odd lanes of two 32 x 32 -> 64 bit multiplies
+uint4 operator * (const uint4& a, const uint4& b)
+{
+  const __m128i even = _mm_mul_epu32(a.m, b.m);
+  const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a.m, 32), _mm_srli_epi64(b.m, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// truncation rounded down where it went up, exact for the int32 range the lattice uses
+float4 vfloor(const float4& a)
+{
+  const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.m));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.m), _mm_set1_ps(1.0f)));
+}
+float4 vabs(const float4& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.m); }
+float4 vmin(const float4& a, const float4& b) { return _mm_min_ps(b.m, a.m); }
+float4 vmax(const float4& a, const float4& b) { return _mm_max_ps(b.m, a.m); }
+float4 vgreater(const float4& a, const float4& b) { return _mm_cmpgt_ps(a.m, b.m); }
+float4 vselect(const float4& m, const float4& a, const float4& b) { return _mm_or_ps(_mm_and_ps(m.m, a.m), _mm_andnot_ps(m.m, b.m)); }
+uint4 vint(const float4& a) { return _mm_cvttps_epi32(a.m); }
+float4 vfloat(const uint4& a) { return _mm_cvtepi32_ps(a.m); }
+float4 vlookup(const float* table, const uint4& i)
+{
+  alignas(16) std::uint32_t index[4];
+  _mm_store_si128(reinterpret_cast<__m128i*>(index), i.m);
+  return _mm_setr_ps(table[index[0] & 7], table[index[1] & 7], table[index[2] & 7], table[index[3] & 7]);
+}
+#endif
+
+// gradients of simplex noise, 8 directions
+const float gradient_x[8] = { 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f };
+const float gradient_y[8] = { 1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, -1.0f };
+
+// different seeds per octave and for the warp, so the layers are not correlated
+const std::uint32_t octave_seed_step = 0x9e3779b9u;
+const std::uint32_t warp_x_seed = 0x85ebca6bu;
+const std::uint32_t warp_y_seed = 0xc2b2ae35u;
+
+template<typename U>
+U hash(const U& x, const U& y, const U& seed)
+{
+  U h = (x * U(0x27d4eb2du)) ^ (y * U(0x165667b1u)) ^ seed;
+  h = h ^ (h >> 15);
+  h = h * U(0x2c1b3c6du);
+  h = h ^ (h >> 12);
+  h = h * U(0x297a2d39u);
+  h = h ^ (h >> 15);
+  return h;
+}
+
+// in [-1, 1)
+template<typename F, typename U>
+F lattice_value(const U& x, const U& y, const U& seed)
+{
+  return vfloat(hash(x, y, seed) >> 8) * F(1.0f / 8388608.0f) - F(1.0f);
+}
+
+template<typename F, typename U>
+F value_noise(const F& x, const F& y, const U& seed)
+{
+  const F x_floor = vfloor(x);
+  const F y_floor = vfloor(y);
+  const U ix = vint(x_floor);
+  const U iy = vint(y_floor);
+  const F fx = x - x_floor;
+  const F fy = y - y_floor;
+
+  // quintic fade, continuous second derivative
+  const F u = fx * fx * fx * (fx * (fx * F(6.0f) - F(15.0f)) + F(10.0f));
+  const F v = fy * fy * fy * (fy * (fy * F(6.0f) - F(15.0f)) + F(10.0f));
+
+  const U one(1u);
+  const F v00 = lattice_value<F>(ix, iy, seed);
+  const F v10 = lattice_value<F>(ix + one, iy, seed);
+  const F v01 = lattice_value<F>(ix, iy + one, seed);
+  const F v11 = lattice_value<F>(ix + one, iy + one, seed);
+  const F a = v00 + u * (v10 - v00);
+  const F b = v01 + u * (v11 - v01);
+  return a + v * (b - a);
+}
+
+template<typename F, typename U>
+F simplex_corner(const F& x, const F& y, const U& ix, const U& iy, const U& seed)
+{
+  const F t = vmax(F(0.5f) - x * x - y * y, F(0.0f));
+  const F t2 = t * t;
+  const U h = hash(ix, iy, seed);
+  return t2 * t2 * (vlookup(gradient_x, h) * x + vlookup(gradient_y, h) * y);
+}
+
+// about in [-1, 1]
+template<typename F, typename U>
+F simplex_noise(const F& x, const F& y, const U& seed)
+{
+  const float f2 = 0.36602540378f; // (sqrt(3) - 1) / 2
+  const float g2 = 0.21132486540f; // (3 - sqrt(3)) / 6
+
+  const F s = (x + y) * F(f2);
+  const F i = vfloor(x + s);
+  const F j = vfloor(y + s);
+  const F t = (i + j) * F(g2);
+  const F x0 = x - (i - t);
+  const F y0 = y - (j - t);
+
+  // the middle corner is on the x or the y step of the cell
+  const auto lower = vgreater(x0, y0);
+  const F i1 = vselect(lower, F(1.0f), F(0.0f));
+  const F j1 = vselect(lower, F(0.0f), F(1.0f));
+  const F x1 = x0 - i1 + F(g2);
+  const F y1 = y0 - j1 + F(g2);
+  const F x2 = x0 - F(1.0f - 2.0f * g2);
+  const F y2 = y0 - F(1.0f - 2.0f * g2);
+
+  const U ii = vint(i);
+  const U jj = vint(j);
+  const U one(1u);
+  const F n0 = simplex_corner(x0, y0, ii, jj, seed);
+  const F n1 = simplex_corner(x1, y1, ii + vint(i1), jj + vint(j1), seed);
+  const F n2 = simplex_corner(x2, y2, ii + one, jj + one, seed);
+  return F(70.0f) * (n0 + n1 + n2);
+}
+
+template<typename F, typename U>
+F basis(const noise_type::Enum type, const F& x, const F& y, const U& seed)
+{
+  return type == noise_type::value ? value_noise(x, y, seed) : simplex_noise(x, y, seed);
+}
+
+template<typename F, typename U>
+F fractal(const noise_type::Enum type, const noise_settings& settings, const float normalization, const F& world_x, const F& world_y)
+{
+  F x = world_x;
+  F y = world_y;
+  if (settings.warp != 0.0f)
+  {
+    const F wx = world_x * F(settings.warp_frequency);
+    const F wy = world_y * F(settings.warp_frequency);
+    x = x + F(settings.warp) * basis(type, wx, wy, U(settings.seed ^ warp_x_seed));
+    y = y + F(settings.warp) * basis(type, wx, wy, U(settings.seed ^ warp_y_seed));
+  }
+
+  F sum(0.0f);
+  float frequency = settings.frequency;
+  float amplitude = 1.0f;
+  std::uint32_t seed = settings.seed;
+  if (type == noise_type::ridged)
+  {
+    // Musgrave: every octave is weighted by the previous one, the valleys stay smooth
+    F weight(1.0f);
+    for (unsigned octave = 0; octave < settings.octaves; ++octave)
+    {
+      F signal = F(1.0f) - vabs(simplex_noise(x * F(frequency), y * F(frequency), U(seed)));
+      signal = signal * signal * weight;
+      weight = vmin(vmax(signal * F(2.0f), F(0.0f)), F(1.0f));
+      sum = sum + signal * F(amplitude);
+      frequency *= settings.lacunarity;
+      amplitude *= settings.gain;
+      seed += octave_seed_step;
+    }
+  }
+  else
+  {
+    for (unsigned octave = 0; octave < settings.octaves; ++octave)
+    {
+      sum = sum + basis(type, x * F(frequency), y * F(frequency), U(seed)) * F(amplitude);
+      frequency *= settings.lacunarity;
+      amplitude *= settings.gain;
+      seed += octave_seed_step;
+    }
+  }
+  return F(settings.height_offset) + F(settings.height_scale) * (sum * F(normalization));
+}
+}
+
+noise_generator::noise_generator(height_field& field, const noise_type::Enum type, const noise_settings& settings)
+  : height_field::perrow_generator(field)
+  , m_type(type)
+  , m_settings(settings)
+  , m_resolution(field.resolution())
+  , m_normalization(1.0f)
+{
+  float amplitude = 1.0f;
+  float sum = 0.0f;
+  for (unsigned octave = 0; octave < settings.octaves; ++octave)
+  {
+    sum += amplitude;
+    amplitude *= settings.gain;
+  }
+  m_normalization = sum > 0.0f ? 1.0f / sum : 1.0f;
+}
+
+void noise_generator::operator ()(const uvec2& pos, const unsigned count, value_t* out) const
+{
+  const float world_y = static_cast<float>(pos.y) * m_resolution.y;
+  unsigned i = 0;
+#ifdef TERRAIN_SSE2
+  const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+  for (; i + 4 <= count; i += 4)
+  {
+    const float4 x(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(static_cast<int>(pos.x + i)), lanes)));
+    const float4 h(fractal<float4, uint4>(m_type, m_settings, m_normalization, x * float4(m_resolution.x), float4(world_y)));
+    _mm_storeu_ps(out + i, h.m);
+  }
+#endif
+  for (; i < count; ++i)
+  {
+    const float world_x = static_cast<float>(pos.x + i) * m_resolution.x;
+    out[i] = fractal<float, std::uint32_t>(m_type, m_settings, m_normalization, world_x, world_y);
+  }
+}
+
+noise_generator::value_t noise_generator::sample(const vec2& world_pos) const
+{
+  return fractal<float, std::uint32_t>(m_type, m_settings, m_normalization, world_pos.x, world_pos.y);
+}
+}
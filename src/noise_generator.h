@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+#include "types.h"
+#include "height_field.h"
+
+namespace terrain
+{
+  struct noise_type
+  {
+    enum Enum
+    {
+      value      // interpolated random lattice values, fBm
+      , simplex  // 2d simplex noise, fBm
+      , ridged   // ridged multifractal over simplex noise, sharp crests
+    };
+  };
+
+  struct noise_settings
+  {
+    noise_settings()
+      : seed(0)
+      , frequency(1.0f / 256.0f)
+      , octaves(6)
+      , lacunarity(2.0f)
+      , gain(0.5f)
+      , warp(0.0f)
+      , warp_frequency(1.0f / 512.0f)
+      , height_offset(0.0f)
+      , height_scale(1.0f)
+    { }
+
+    std::uint32_t seed;
+    float frequency;      // of the first octave, per world unit
+    unsigned octaves;
+    float lacunarity;     // frequency factor between octaves
+    float gain;           // amplitude factor between octaves
+    float warp;           // domain warp displacement in world units, 0 disables it
+    float warp_frequency; // of the warp noise, per world unit
+    float height_offset;
+    float height_scale;   // the noise is about in [-1, 1] (ridged in [0, 1]) before offset and scale
+  };
+
+// fills a height field with fractal noise sampled at the world positions of the samples
+// a sample only depends on its position and the settings, so the result is the same
+// for any tiling and thread count, and the SSE2 path matches the scalar one bit for bit
+  class noise_generator : public height_field::perrow_generator
+  {
+  public:
+    using value_t = height_field::value_t;
+
+  public:
+    // the field must outlive the generator
+    noise_generator(height_field& field, const noise_type::Enum type, const noise_settings& settings);
+
+    // 4 samples per step with SSE2
+    void operator ()(const uvec2& pos, const unsigned count, value_t* out) const override;
+
+    // a single sample at a world position
+    value_t sample(const vec2& world_pos) const;
+
+  private:
+    noise_type::Enum m_type;
+    noise_settings m_settings;
+    vec2 m_resolution;
+    float m_normalization; // 1 / sum of the octave amplitudes
+  };
+}
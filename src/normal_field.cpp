@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
+
+#include "normal_field.h"
+
+namespace terrain
+{
+namespace
+{
+void normals_row(const height_field& heights, const unsigned y, const unsigned x_begin, const unsigned x_end, field<vec3>& normals)
+{
+  const uvec2 size(heights.size());
+  const unsigned y0 = y > 0 ? y - 1 : y;
+  const unsigned y1 = y + 1 < size.y ? y + 1 : y;
+  const float* row = &heights(uvec2(0, y));
+  const float* up = &heights(uvec2(0, y0));
+  const float* down = &heights(uvec2(0, y1));
+  vec3* out = &normals(uvec2(0, y));
+
+  // a single row or column has no slope along it
+  const float inv_dy = y1 > y0 ? 1.0f / (static_cast<float>(y1 - y0) * heights.resolution().y) : 0.0f;
+
+  auto scalar = [&](const unsigned x)
+  {
+    const unsigned x0 = x > 0 ? x - 1 : x;
+    const unsigned x1 = x + 1 < size.x ? x + 1 : x;
+    const float inv_dx = x1 > x0 ? 1.0f / (static_cast<float>(x1 - x0) * heights.resolution().x) : 0.0f;
+    const vec3 n(-(row[x1] - row[x0]) * inv_dx, -(down[x] - up[x]) * inv_dy, 1.0f);
+    out[x] = n / std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+  };
+
+  unsigned x = x_begin;
+  for (; x < x_end && x == 0; ++x)
+  {
+    scalar(x);
+  }
+
+#ifdef TERRAIN_SSE2
+  // interior, 4 normals per step
+  const __m128 v_inv_2dx = _mm_set1_ps(0.5f / heights.resolution().x);
+  const __m128 v_inv_dy = _mm_set1_ps(inv_dy);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (; x + 4 < size.x && x + 4 <= x_end; x += 4)
+  {
+    const __m128 nx = _mm_xor_ps(sign, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + x + 1), _mm_loadu_ps(row + x - 1)), v_inv_2dx));
+    const __m128 ny = _mm_xor_ps(sign, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(down + x), _mm_loadu_ps(up + x)), v_inv_dy));
+    const __m128 inv_len = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), one)));
+
+    alignas(16) float sx[4], sy[4], sz[4];
+    _mm_store_ps(sx, _mm_mul_ps(nx, inv_len));
+    _mm_store_ps(sy, _mm_mul_ps(ny, inv_len));
+    _mm_store_ps(sz, inv_len);
+    for (unsigned i = 0; i < 4; ++i)
+    {
+      out[x + i] = vec3(sx[i], sy[i], sz[i]);
+    }
+  }
+#endif
+
+  for (; x < x_end; ++x)
+  {
+    scalar(x);
+  }
+}
+
+float sign_not_zero(const float v)
+{
+  return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+std::uint32_t to_snorm16(const float v)
+{
+  const float clamped = std::min(std::max(v, -1.0f), 1.0f);
+  return static_cast<std::uint32_t>(static_cast<std::uint16_t>(static_cast<std::int16_t>(std::floor(clamped * 32767.0f + 0.5f))));
+}
+
+float from_snorm16(const std::uint32_t v)
+{
+  return std::max(static_cast<float>(static_cast<std::int16_t>(static_cast<std::uint16_t>(v))) / 32767.0f, -1.0f);
+}
+}
+
+field<vec3>::ptr compute_normals(const height_field& heights, parallel::thread_pool& pool)
+{
+  field<vec3>::ptr normals(new field<vec3>(heights.size()));
+  compute_normals(heights, *normals, uvec2(0), heights.size(), pool);
+  return normals;
+}
+
+void compute_normals(const height_field& heights, field<vec3>& normals, const uvec2& begin, const uvec2& end, parallel::thread_pool& pool)
+{
+  const uvec2 clamped_end(glm::min(end, heights.size()));
+  if (begin.x >= clamped_end.x || begin.y >= clamped_end.y)
+  {
+    return;
+  }
+
+  // full rows per task, the stencil reads the rows above and below
+  pool.parallel_for(clamped_end.y - begin.y, [&](const unsigned i)
+  {
+    normals_row(heights, begin.y + i, begin.x, clamped_end.x, normals);
+  });
+}
+
+std::uint32_t encode_octahedral(const vec3& n)
+{
+  const float inv_l1 = 1.0f / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+  float u = n.x * inv_l1;
+  float v = n.y * inv_l1;
+  if (n.z < 0.0f)
+  {
+    const float fold_u = (1.0f - std::abs(v)) * sign_not_zero(u);
+    const float fold_v = (1.0f - std::abs(u)) * sign_not_zero(v);
+    u = fold_u;
+    v = fold_v;
+  }
+  return to_snorm16(u) | (to_snorm16(v) << 16);
+}
+
+vec3 decode_octahedral(const std::uint32_t packed)
+{
+  const float u = from_snorm16(packed & 0xffffu);
+  const float v = from_snorm16(packed >> 16);
+  vec3 n(u, v, 1.0f - std::abs(u) - std::abs(v));
+  if (n.z < 0.0f)
+  {
+    n.x = (1.0f - std::abs(v)) * sign_not_zero(u);
+    n.y = (1.0f - std::abs(u)) * sign_not_zero(v);
+  }
+  return n / std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+}
+
+field<std::uint32_t>::ptr encode_octahedral(const field<vec3>& normals, parallel::thread_pool& pool)
+{
+  field<std::uint32_t>::ptr packed(new field<std::uint32_t>(normals.size()));
+  encode_octahedral(normals, *packed, uvec2(0), normals.size(), pool);
+  return packed;
+}
+
+void encode_octahedral(const field<vec3>& normals, field<std::uint32_t>& packed, const uvec2& begin, const uvec2& end, parallel::thread_pool& pool)
+{
+  const uvec2 clamped_end(glm::min(end, normals.size()));
+  if (begin.x >= clamped_end.x || begin.y >= clamped_end.y)
+  {
+    return;
+  }
+
+  parallel::for_each_tile(pool, clamped_end - begin, uvec2(256, 64), [&](const uvec2& tile_begin, const uvec2& tile_end)
+  {
+    for (unsigned y = begin.y + tile_begin.y; y < begin.y + tile_end.y; ++y)
+    {
+      for (unsigned x = begin.x + tile_begin.x; x < begin.x + tile_end.x; ++x)
+      {
+        packed(uvec2(x, y)) = encode_octahedral(normals(uvec2(x, y)));
+      }
+    }
+  });
+}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+#include "types.h"
+#include "field.h"
+#include "height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// surface normals of a height field from central differences (one-sided at the border)
+// the spacing comes from resolution(), normals are in the height field frame: x, y along the grid, z up
+  field<vec3>::ptr compute_normals(const height_field& heights, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+  // recomputes the normals of [begin, end) only, e.g. after an edit of the heights
+  void compute_normals(const height_field& heights, field<vec3>& normals, const uvec2& begin, const uvec2& end, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+// octahedral encoding packed in two snorm16, x in the low half
+// a third of the size of vec3, uploads as GL_RG16_SNORM
+  std::uint32_t encode_octahedral(const vec3& n);
+  vec3 decode_octahedral(const std::uint32_t packed);
+
+  field<std::uint32_t>::ptr encode_octahedral(const field<vec3>& normals, parallel::thread_pool& pool = parallel::thread_pool::instance());
+  void encode_octahedral(const field<vec3>& normals, field<std::uint32_t>& packed, const uvec2& begin, const uvec2& end, parallel::thread_pool& pool = parallel::thread_pool::instance());
+}
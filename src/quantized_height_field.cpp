@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
+
+#include "quantized_height_field.h"
+
+namespace terrain
+{
+namespace
+{
+// the largest valid code, nan_sample is above it
+const float max_sample = 65534.0f;
+
+// half a step from rounding, plus the float error of quantizing and of offset + scale * sample
+float tile_error(const vec2& tile)
+{
+  const float epsilon = std::numeric_limits<float>::epsilon();
+  const float magnitude = std::max(std::abs(tile.x), std::abs(tile.x + tile.y * max_sample));
+  return tile.y * (0.5f + 4.0f * epsilon * max_sample) + 2.0f * epsilon * magnitude;
+}
+}
+
+quantized_height_field::quantized_height_field(const height_field& source, const float max_error, parallel::thread_pool& pool)
+  : m_size(source.size())
+  , m_resolution(source.resolution())
+  , m_error_limit(max_error)
+  , m_samples(static_cast<std::size_t>(m_size.x) * m_size.y)
+  , m_tiles(uvec2((m_size.x + tile_size - 1) / tile_size, (m_size.y + tile_size - 1) / tile_size))
+{
+  if (!(max_error >= 0.0f))
+  {
+    throw std::runtime_error(std::string("invalid quantization error limit"));
+  }
+  update(source, uvec2(0), m_size, pool);
+}
+
+quantized_height_field::value_t quantized_height_field::operator()(const uvec2& pos) const
+{
+  const vec2& t = m_tiles(pos / tile_size);
+  if (is_float_tile(t))
+  {
+    return m_float_samples[static_cast<std::size_t>(t.x) * tile_size * tile_size + pos.x % tile_size + tile_size * (pos.y % tile_size)];
+  }
+  const sample_t s = m_samples[pos.x + static_cast<std::size_t>(m_size.x) * pos.y];
+  return s == nan_sample ? std::numeric_limits<value_t>::quiet_NaN() : t.x + t.y * static_cast<value_t>(s);
+}
+
+void quantized_height_field::decode_row(const uvec2& pos, const unsigned count, value_t* out) const
+{
+  const sample_t* samples = &m_samples[pos.x + static_cast<std::size_t>(m_size.x) * pos.y];
+  unsigned i = 0;
+  while (i < count)
+  {
+    // one tile at a time, offset and scale are constant inside
+    const unsigned x = pos.x + i;
+    const unsigned run = std::min(count - i, tile_size - x % tile_size);
+    const vec2& t = m_tiles(uvec2(x / tile_size, pos.y / tile_size));
+    if (is_float_tile(t))
+    {
+      const value_t* row = &m_float_samples[static_cast<std::size_t>(t.x) * tile_size * tile_size + tile_size * (pos.y % tile_size) + x % tile_size];
+      std::copy(row, row + run, out + i);
+      i += run;
+      continue;
+    }
+    unsigned j = 0;
+#ifdef TERRAIN_SSE2
+    const __m128 offset = _mm_set1_ps(t.x);
+    const __m128 scale = _mm_set1_ps(t.y);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i nan_code = _mm_set1_epi16(static_cast<short>(nan_sample));
+    for (; j + 8 <= run; j += 8)
+    {
+      const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i + j));
+      const __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(s, zero));
+      const __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(s, zero));
+      // all bits set is a NaN, so the nan samples are or-ed in
+      const __m128i nan = _mm_cmpeq_epi16(s, nan_code);
+      const __m128 nan_lo = _mm_castsi128_ps(_mm_unpacklo_epi16(nan, nan));
+      const __m128 nan_hi = _mm_castsi128_ps(_mm_unpackhi_epi16(nan, nan));
+      _mm_storeu_ps(out + i + j, _mm_or_ps(_mm_add_ps(offset, _mm_mul_ps(scale, lo)), nan_lo));
+      _mm_storeu_ps(out + i + j + 4, _mm_or_ps(_mm_add_ps(offset, _mm_mul_ps(scale, hi)), nan_hi));
+    }
+#endif
+    for (; j < run; ++j)
+    {
+      out[i + j] = samples[i + j] == nan_sample ? std::numeric_limits<value_t>::quiet_NaN() : t.x + t.y * static_cast<value_t>(samples[i + j]);
+    }
+    i += run;
+  }
+}
+
+height_field::ptr quantized_height_field::decode(parallel::thread_pool& pool) const
+{
+  height_field::ptr result(new height_field(m_size, m_resolution));
+  pool.parallel_for(m_size.y, [&](const unsigned y)
+  {
+    decode_row(uvec2(0, y), m_size.x, &(*result)(uvec2(0, y)));
+  });
+  return result;
+}
+
+void quantized_height_field::update(const height_field& source, const uvec2& begin, const uvec2& end, parallel::thread_pool& pool)
+{
+  if (source.size() != m_size)
+  {
+    throw std::runtime_error(std::string("field size mismatch"));
+  }
+
+  const uvec2 clamped_end(glm::min(end, m_size));
+  if (begin.x >= clamped_end.x || begin.y >= clamped_end.y)
+  {
+    return;
+  }
+
+  const uvec2 first_tile(begin / tile_size);
+  const uvec2 tile_count((clamped_end - 1u) / tile_size - first_tile + 1u);
+  std::vector<vec2> ranges(tile_count.x * tile_count.y);
+  pool.parallel_for(tile_count.x * tile_count.y, [&](const unsigned i)
+  {
+    ranges[i] = tile_range(source, first_tile + uvec2(i % tile_count.x, i / tile_count.x));
+  });
+
+  // the float slots are handed out in order, so the same edits give the same layout
+  const std::size_t tile_area = static_cast<std::size_t>(tile_size) * tile_size;
+  for (unsigned i = 0; i < tile_count.x * tile_count.y; ++i)
+  {
+    vec2& t = m_tiles(first_tile + uvec2(i % tile_count.x, i / tile_count.x));
+    const vec2 quantized(ranges[i].x, (ranges[i].y - ranges[i].x) / max_sample);
+    if (tile_error(quantized) <= m_error_limit)
+    {
+      if (is_float_tile(t))
+      {
+        m_free_slots.push_back(static_cast<unsigned>(t.x));
+      }
+      t = quantized;
+    }
+    else if (!is_float_tile(t))
+    {
+      unsigned slot;
+      if (m_free_slots.empty())
+      {
+        slot = float_tile_slots();
+        m_float_samples.resize(m_float_samples.size() + tile_area);
+      }
+      else
+      {
+        // lowest first, keeps the atlas compact
+        const auto lowest = std::min_element(m_free_slots.begin(), m_free_slots.end());
+        slot = *lowest;
+        m_free_slots.erase(lowest);
+      }
+      t = vec2(static_cast<float>(slot), -1.0f);
+    }
+  }
+
+  pool.parallel_for(tile_count.x * tile_count.y, [&](const unsigned i)
+  {
+    quantize_tile(source, first_tile + uvec2(i % tile_count.x, i / tile_count.x));
+  });
+}
+
+float quantized_height_field::max_error() const
+{
+  float error(0.0f);
+  for (unsigned y = 0; y < m_tiles.size().y; ++y)
+  {
+    for (unsigned x = 0; x < m_tiles.size().x; ++x)
+    {
+      const vec2& t = m_tiles(uvec2(x, y));
+      error = is_float_tile(t) ? error : std::max(error, tile_error(t));
+    }
+  }
+  return error;
+}
+
+uvec2 quantized_height_field::float_atlas_size() const
+{
+  const unsigned rows = std::max((float_tile_slots() + float_atlas_columns - 1) / float_atlas_columns, 1u);
+  return uvec2(float_atlas_columns, rows) * tile_size;
+}
+
+vec2 quantized_height_field::tile_range(const height_field& source, const uvec2& tile) const
+{
+  const uvec2 begin(tile * tile_size);
+  const uvec2 end(glm::min(begin + uvec2(tile_size), m_size));
+
+  // NaN is skipped, a tile of only NaN gets the range 0 - 0
+  value_t h_min(std::numeric_limits<value_t>::infinity()), h_max(-std::numeric_limits<value_t>::infinity());
+  for (unsigned y = begin.y; y < end.y; ++y)
+  {
+    for (unsigned x = begin.x; x < end.x; ++x)
+    {
+      const value_t h = source(uvec2(x, y));
+      if (!std::isnan(h))
+      {
+        h_min = std::min(h_min, h);
+        h_max = std::max(h_max, h);
+      }
+    }
+  }
+  return h_min > h_max ? vec2(0.0f) : vec2(h_min, h_max);
+}
+
+// the tile entry is set by update
+void quantized_height_field::quantize_tile(const height_field& source, const uvec2& tile)
+{
+  const uvec2 begin(tile * tile_size);
+  const uvec2 end(glm::min(begin + uvec2(tile_size), m_size));
+  const vec2 t(m_tiles(tile));
+
+  if (is_float_tile(t))
+  {
+    value_t* slot = &m_float_samples[static_cast<std::size_t>(t.x) * tile_size * tile_size];
+    for (unsigned y = begin.y; y < end.y; ++y)
+    {
+      for (unsigned x = begin.x; x < end.x; ++x)
+      {
+        slot[(x - begin.x) + tile_size * (y - begin.y)] = source(uvec2(x, y));
+        m_samples[x + static_cast<std::size_t>(m_size.x) * y] = 0;
+      }
+    }
+    return;
+  }
+
+  const value_t inv_scale = t.y > 0.0f ? 1.0f / t.y : 0.0f;
+  for (unsigned y = begin.y; y < end.y; ++y)
+  {
+    for (unsigned x = begin.x; x < end.x; ++x)
+    {
+      const value_t h = source(uvec2(x, y));
+      const value_t q = std::floor((h - t.x) * inv_scale + 0.5f);
+      m_samples[x + static_cast<std::size_t>(m_size.x) * y] = std::isnan(h) ? nan_sample : static_cast<sample_t>(std::min(std::max(q, 0.0f), max_sample));
+    }
+  }
+}
+}
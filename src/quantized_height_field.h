@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "types.h"
+#include "field.h"
+#include "height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// height field stored as 16 bit samples with a per tile offset and scale
+// height = offset + scale * sample, the error of every sample is at most the error limit
+// a tile whose height range cannot be stored within the limit falls back to float samples,
+// its tiles() entry is vec2(slot, -1) and its samples are in float_tiles(), NaN samples get the reserved code nan_sample
+// samples are row-major over the whole field, so they can be uploaded as one R16 texture
+  class quantized_height_field
+  {
+  public:
+    using ptr = std::shared_ptr<quantized_height_field>;
+    using value_t = height_field::value_t;
+    using sample_t = std::uint16_t;
+
+    // must match tile_size in the vertex shaders
+    static const unsigned tile_size = 64;
+
+    // decodes to NaN, the valid codes are [0, nan_sample)
+    static const sample_t nan_sample = 0xffff;
+
+    // float tiles per row of the float tile atlas, must match float_atlas_columns in the vertex shaders
+    static const unsigned float_atlas_columns = 32;
+
+  public:
+    // max_error must not be negative, tiles that would exceed it are stored as floats
+    quantized_height_field(const height_field& source, const float max_error, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+    value_t operator()(const uvec2& pos) const;
+
+    // decodes [pos.x, pos.x + count) of row pos.y
+    void decode_row(const uvec2& pos, const unsigned count, value_t* out) const;
+    height_field::ptr decode(parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+    // re-quantizes the tiles touching [begin, end) from source
+    void update(const height_field& source, const uvec2& begin, const uvec2& end, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+    const uvec2& size() const
+    {
+      return m_size;
+    }
+
+    const vec2& resolution() const
+    {
+      return m_resolution;
+    }
+
+    // the max_error given to the constructor
+    float error_limit() const
+    {
+      return m_error_limit;
+    }
+
+    // largest error of the quantized tiles, at most error_limit(), float tiles are exact
+    float max_error() const;
+
+    const sample_t* data() const
+    {
+      return &m_samples[0];
+    }
+
+    // vec2(offset, scale) per tile, vec2(slot, -1) for float tiles
+    const field<vec2>& tiles() const
+    {
+      return m_tiles;
+    }
+
+    static bool is_float_tile(const vec2& tile)
+    {
+      return tile.y < 0.0f;
+    }
+
+    // tile_size * tile_size values per slot in row-major order, slot after slot, released slots are reused
+    const value_t* float_tiles() const
+    {
+      return m_float_samples.empty() ? nullptr : &m_float_samples[0];
+    }
+
+    unsigned float_tile_slots() const
+    {
+      return static_cast<unsigned>(m_float_samples.size() / (tile_size * tile_size));
+    }
+
+    // slot s is tile (s % float_atlas_columns, s / float_atlas_columns) of the atlas, which holds at least one row
+    uvec2 float_atlas_size() const;
+
+  private:
+    vec2 tile_range(const height_field& source, const uvec2& tile) const;
+    void quantize_tile(const height_field& source, const uvec2& tile);
+
+  private:
+    uvec2 m_size;
+    vec2 m_resolution;
+    float m_error_limit;
+    std::vector<sample_t> m_samples;
+    field<vec2> m_tiles;
+    std::vector<value_t> m_float_samples;
+    std::vector<unsigned> m_free_slots;
+  };
+}
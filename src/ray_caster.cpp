@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "ray_caster.h"
+
+namespace terrain
+{
+namespace
+{
+const std::size_t ray_chunk = 1024;
+
+// slab test, returns false if [t_near, t_far] is empty
+bool intersect_box(const vec3& origin, const vec3& inv_direction, const vec3& box_min, const vec3& box_max, float& t_near, float& t_far)
+{
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    float t0 = (box_min[axis] - origin[axis]) * inv_direction[axis];
+    float t1 = (box_max[axis] - origin[axis]) * inv_direction[axis];
+    if (t0 > t1)
+    {
+      std::swap(t0, t1);
+    }
+    t_near = std::max(t_near, t0);
+    t_far = std::min(t_far, t1);
+  }
+  return t_near <= t_far;
+}
+
+// Moller-Trumbore
+bool intersect_triangle(const ray& r, const vec3& a, const vec3& b, const vec3& c, float& t)
+{
+  const vec3 ab(b - a);
+  const vec3 ac(c - a);
+  const vec3 p(glm::cross(r.direction, ac));
+  const float det = glm::dot(ab, p);
+  if (std::abs(det) < 1e-12f)
+  {
+    return false;
+  }
+
+  const float inv_det = 1.0f / det;
+  const vec3 s(r.origin - a);
+  const float u = glm::dot(s, p) * inv_det;
+  if (u < 0.0f || u > 1.0f)
+  {
+    return false;
+  }
+
+  const vec3 q(glm::cross(s, ab));
+  const float v = glm::dot(r.direction, q) * inv_det;
+  if (v < 0.0f || u + v > 1.0f)
+  {
+    return false;
+  }
+
+  t = glm::dot(ac, q) * inv_det;
+  return true;
+}
+
+float safe_inverse(const float v)
+{
+  return std::abs(v) > 1e-30f ? 1.0f / v : (v < 0.0f ? -1e30f : 1e30f);
+}
+}
+
+ray_caster::ray_caster(const minmax_pyramid& pyramid)
+  : m_pyramid(pyramid)
+  , m_field(pyramid.source())
+{ }
+
+ray_hit ray_caster::intersect(const ray& r, const float t_max) const
+{
+  ray_hit best;
+  best.hit = false;
+  best.t = t_max;
+
+  const uvec2 size(m_field.size());
+  if (size.x < 2 || size.y < 2)
+  {
+    return best;
+  }
+
+  const uvec2 cell_count(size - 1u);
+  const vec2 resolution(m_field.resolution());
+  const vec3 inv_direction(safe_inverse(r.direction.x), safe_inverse(r.direction.y), safe_inverse(r.direction.z));
+
+  struct entry
+  {
+    unsigned level;
+    uvec2 pos;
+    float t_near;
+  };
+
+  auto visit = [&](const unsigned level, const uvec2& pos, std::vector<entry>& out)
+  {
+    const uvec2 cell_begin(pos.x << level, pos.y << level);
+    if (cell_begin.x >= cell_count.x || cell_begin.y >= cell_count.y)
+    {
+      return;
+    }
+    const uvec2 cell_end(glm::min(uvec2((pos.x + 1) << level, (pos.y + 1) << level), cell_count));
+    const vec2 z(node_height_bounds(level, pos));
+    const vec3 box_min(cell_begin.x * resolution.x, cell_begin.y * resolution.y, z.x);
+    const vec3 box_max(cell_end.x * resolution.x, cell_end.y * resolution.y, z.y);
+
+    float t_near(0.0f), t_far(best.t);
+    if (intersect_box(r.origin, inv_direction, glm::min(box_min, box_max), glm::max(box_min, box_max), t_near, t_far))
+    {
+      out.push_back({ level, pos, t_near });
+    }
+  };
+
+  std::vector<entry> stack;
+  std::vector<entry> children;
+  visit(m_pyramid.level_count() - 1, uvec2(0), stack);
+  while (!stack.empty())
+  {
+    const entry e = stack.back();
+    stack.pop_back();
+    if (e.t_near > best.t)
+    {
+      continue;
+    }
+
+    if (e.level == 0)
+    {
+      intersect_cell(r, e.pos, best);
+      continue;
+    }
+
+    children.clear();
+    for (unsigned j = 0; j < 2; ++j)
+    {
+      for (unsigned i = 0; i < 2; ++i)
+      {
+        visit(e.level - 1, uvec2(e.pos.x * 2 + i, e.pos.y * 2 + j), children);
+      }
+    }
+
+    // nearest child on top of the stack
+    std::sort(children.begin(), children.end(), [](const entry& a, const entry& b) { return a.t_near > b.t_near; });
+    stack.insert(stack.end(), children.begin(), children.end());
+  }
+  return best;
+}
+
+void ray_caster::intersect(span<const ray> rays, span<ray_hit> hits, parallel::thread_pool& pool) const
+{
+  if (hits.size() < rays.size())
+  {
+    throw std::runtime_error(std::string("hit output is shorter than the rays"));
+  }
+
+  const unsigned chunks = static_cast<unsigned>((rays.size() + ray_chunk - 1) / ray_chunk);
+  pool.parallel_for(chunks, [&](const unsigned chunk)
+  {
+    const std::size_t end = std::min((chunk + 1) * ray_chunk, rays.size());
+    for (std::size_t i = chunk * ray_chunk; i < end; ++i)
+    {
+      hits[i] = intersect(rays[i]);
+    }
+  });
+}
+
+ray ray_caster::cursor_ray(const vec2& cursor, const uvec2& window_size, const mat4& view, const mat4& projection, const mat4& model)
+{
+  const vec2 ndc(2.0f * cursor.x / static_cast<float>(window_size.x) - 1.0f, 1.0f - 2.0f * cursor.y / static_cast<float>(window_size.y));
+  const mat4 inv(glm::inverse(projection * view * model));
+
+  vec4 near_point(inv * vec4(ndc.x, ndc.y, -1.0f, 1.0f));
+  vec4 far_point(inv * vec4(ndc.x, ndc.y, 1.0f, 1.0f));
+  near_point /= near_point.w;
+  far_point /= far_point.w;
+
+  ray r;
+  r.origin = vec3(near_point.x, near_point.y, near_point.z);
+  r.direction = vec3(far_point.x, far_point.y, far_point.z) - r.origin;
+  return r;
+}
+
+vec2 ray_caster::node_height_bounds(const unsigned level, const uvec2& pos) const
+{
+  const uvec2 level_size(m_pyramid.level_size(level));
+  vec2 bounds(m_pyramid.node(level, pos));
+  for (unsigned j = 0; j < 2; ++j)
+  {
+    for (unsigned i = 0; i < 2; ++i)
+    {
+      const uvec2 neighbour(pos.x + i, pos.y + j);
+      if ((i != 0 || j != 0) && neighbour.x < level_size.x && neighbour.y < level_size.y)
+      {
+        const vec2 b(m_pyramid.node(level, neighbour));
+        bounds = vec2(std::min(bounds.x, b.x), std::max(bounds.y, b.y));
+      }
+    }
+  }
+  return bounds;
+}
+
+bool ray_caster::intersect_cell(const ray& r, const uvec2& cell, ray_hit& best) const
+{
+  // same split as the terrain mesh: (0, 0) (0, 1) (1, 0) and (1, 0) (0, 1) (1, 1)
+  const vec2 resolution(m_field.resolution());
+  auto corner = [&](const unsigned dx, const unsigned dy)
+  {
+    const uvec2 p(cell.x + dx, cell.y + dy);
+    return vec3(p.x * resolution.x, p.y * resolution.y, m_field(p));
+  };
+
+  const vec3 p00(corner(0, 0));
+  const vec3 p10(corner(1, 0));
+  const vec3 p01(corner(0, 1));
+  const vec3 p11(corner(1, 1));
+
+  bool found(false);
+  float t(0.0f);
+  if (intersect_triangle(r, p00, p01, p10, t) && t >= 0.0f && t < best.t)
+  {
+    best.t = t;
+    found = true;
+  }
+  if (intersect_triangle(r, p10, p01, p11, t) && t >= 0.0f && t < best.t)
+  {
+    best.t = t;
+    found = true;
+  }
+
+  if (found)
+  {
+    best.hit = true;
+    best.cell = cell;
+    best.position = r.origin + best.t * r.direction;
+  }
+  return found;
+}
+}
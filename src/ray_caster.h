@@ -0,0 +1,59 @@
+#pragma once
+
+#include <limits>
+#include <memory>
+
+#include "types.h"
+#include "span.h"
+#include "height_field.h"
+#include "minmax_pyramid.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// in the height field frame: sample (x, y) is at (x, y) * resolution(), z is the height
+  struct ray
+  {
+    vec3 origin;
+    vec3 direction;
+  };
+
+  struct ray_hit
+  {
+    bool hit;
+    float t;          // position = origin + t * direction
+    vec3 position;
+    uvec2 cell;       // the cell between samples cell and cell + 1
+  };
+
+// ray / height field intersection against the triangles of the terrain mesh
+// the max heights of the pyramid skip every node the ray passes above
+  class ray_caster
+  {
+  public:
+    using ptr = std::shared_ptr<ray_caster>;
+
+  public:
+    // the pyramid must outlive the caster
+    ray_caster(const minmax_pyramid& pyramid);
+
+    ray_hit intersect(const ray& r, const float t_max = std::numeric_limits<float>::max()) const;
+
+    // hits must be as long as rays, batches are split over the pool
+    void intersect(span<const ray> rays, span<ray_hit> hits, parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+  public:
+    // ray through a cursor position (pixels, origin top left) from the near to the far plane
+    // model maps the height field frame to world, t = 0 is on the near plane and t = 1 on the far plane
+    static ray cursor_ray(const vec2& cursor, const uvec2& window_size, const mat4& view, const mat4& projection, const mat4& model);
+
+  private:
+    // z range of the cells of a node, the cells also touch the first samples of the neighbour nodes
+    vec2 node_height_bounds(const unsigned level, const uvec2& pos) const;
+    bool intersect_cell(const ray& r, const uvec2& cell, ray_hit& best) const;
+
+  private:
+    const minmax_pyramid& m_pyramid;
+    const height_field& m_field;
+  };
+}
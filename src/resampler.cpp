@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
+
+#include "resampler.h"
+
+namespace terrain
+{
+namespace
+{
+// output rows per task, the intermediate rows of a band stay in cache
+const unsigned band_rows = 32;
+
+// keeps float error in i * step from adding nodes that are only touched
+const float footprint_epsilon = 1e-4f;
+
+// source samples and weights of every output sample along one axis
+struct taps
+{
+  std::vector<unsigned> first;
+  std::vector<unsigned> count;
+  std::vector<unsigned> offset;
+  std::vector<float> weights;
+};
+
+float lanczos3(const float x)
+{
+  const float pi = 3.14159265358979f;
+  if (std::fabs(x) < 1e-6f)
+  {
+    return 1.0f;
+  }
+  if (std::fabs(x) >= 3.0f)
+  {
+    return 0.0f;
+  }
+  const float px = pi * x;
+  return 3.0f * std::sin(px) * std::sin(px / 3.0f) / (px * px);
+}
+
+// source node distance between output samples, a single output sample stays on the first node
+float node_step(const unsigned source_size, const unsigned size)
+{
+  return size > 1 ? static_cast<float>(source_size - 1) / (size - 1) : static_cast<float>(std::max(source_size - 1, 1u));
+}
+
+taps make_taps(const unsigned source_size, const unsigned size, const resample_filter::Enum filter)
+{
+  taps t;
+  t.first.resize(size);
+  t.count.resize(size);
+  t.offset.resize(size);
+
+  const float step = node_step(source_size, size);
+  const float stretch = std::max(step, 1.0f);
+  const int last = static_cast<int>(source_size) - 1;
+  std::vector<float> w;
+  for (unsigned i = 0; i < size; ++i)
+  {
+    // output node i sits on source node i * step
+    const float center = i * step;
+    int begin;
+    int end;
+    float a = 0.0f;
+    float b = 0.0f;
+    if (filter == resample_filter::lanczos)
+    {
+      // stretched over the source nodes when shrinking, plain interpolation when enlarging
+      begin = static_cast<int>(std::floor(center - 3.0f * stretch)) + 1;
+      end = static_cast<int>(std::ceil(center + 3.0f * stretch));
+    }
+    else
+    {
+      // [a, b) against the cells [j - 0.5, j + 0.5) of the source nodes, linear interpolation when enlarging
+      a = center - 0.5f * stretch;
+      b = center + 0.5f * stretch;
+      begin = static_cast<int>(std::floor(a - 0.5f + footprint_epsilon)) + 1;
+      end = std::max(static_cast<int>(std::ceil(b + 0.5f - footprint_epsilon)), begin + 1);
+    }
+
+    // the border is repeated
+    const unsigned lo = static_cast<unsigned>(std::min(std::max(begin, 0), last));
+    const unsigned hi = static_cast<unsigned>(std::min(std::max(end - 1, 0), last));
+    w.assign(hi - lo + 1, 0.0f);
+    for (int j = begin; j < end; ++j)
+    {
+      const float weight = filter == resample_filter::lanczos
+        ? lanczos3((j - center) / stretch)
+        : std::max(std::min(b, j + 0.5f) - std::max(a, j - 0.5f), 0.0f);
+      w[std::min(std::max(j, 0), last) - lo] += weight;
+    }
+
+    float sum = 0.0f;
+    for (const float weight : w)
+    {
+      sum += weight;
+    }
+
+    t.first[i] = lo;
+    t.count[i] = hi - lo + 1;
+    t.offset[i] = static_cast<unsigned>(t.weights.size());
+    for (const float weight : w)
+    {
+      // min and max only use the footprint, the weights are ignored
+      t.weights.push_back(sum != 0.0f ? weight / sum : 0.0f);
+    }
+  }
+  return t;
+}
+
+// out[x] = sum of weight * rows[k][x], or min / max over the rows
+void combine_rows(const float* const* rows, const float* weights, const unsigned row_count, const unsigned width, const resample_filter::Enum filter, float* out)
+{
+  const bool weighted = filter == resample_filter::box || filter == resample_filter::lanczos;
+
+  unsigned x = 0;
+#ifdef TERRAIN_SSE2
+  for (; x + 4 <= width; x += 4)
+  {
+    __m128 acc;
+    if (weighted)
+    {
+      acc = _mm_setzero_ps();
+      for (unsigned k = 0; k < row_count; ++k)
+      {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + x)));
+      }
+    }
+    else
+    {
+      acc = _mm_loadu_ps(rows[0] + x);
+      for (unsigned k = 1; k < row_count; ++k)
+      {
+        acc = filter == resample_filter::min ? _mm_min_ps(acc, _mm_loadu_ps(rows[k] + x)) : _mm_max_ps(acc, _mm_loadu_ps(rows[k] + x));
+      }
+    }
+    _mm_storeu_ps(out + x, acc);
+  }
+#endif
+  for (; x < width; ++x)
+  {
+    float acc;
+    if (weighted)
+    {
+      acc = 0.0f;
+      for (unsigned k = 0; k < row_count; ++k)
+      {
+        acc += weights[k] * rows[k][x];
+      }
+    }
+    else
+    {
+      acc = rows[0][x];
+      for (unsigned k = 1; k < row_count; ++k)
+      {
+        acc = filter == resample_filter::min ? std::min(acc, rows[k][x]) : std::max(acc, rows[k][x]);
+      }
+    }
+    out[x] = acc;
+  }
+}
+
+void resample_row(const float* in, const taps& t, const resample_filter::Enum filter, float* out)
+{
+  const unsigned width = static_cast<unsigned>(t.first.size());
+  for (unsigned x = 0; x < width; ++x)
+  {
+    const float* from = in + t.first[x];
+    const float* weights = &t.weights[t.offset[x]];
+    const unsigned count = t.count[x];
+    float acc;
+    if (filter == resample_filter::box || filter == resample_filter::lanczos)
+    {
+      acc = 0.0f;
+      for (unsigned k = 0; k < count; ++k)
+      {
+        acc += weights[k] * from[k];
+      }
+    }
+    else if (filter == resample_filter::min)
+    {
+      acc = *std::min_element(from, from + count);
+    }
+    else
+    {
+      acc = *std::max_element(from, from + count);
+    }
+    out[x] = acc;
+  }
+}
+}
+
+// the filters are separable, every band of output rows filters along y first (vectorized along x)
+// and then along x from the band buffer
+height_field::ptr resample(const height_field& source, const uvec2& size, const resample_filter::Enum filter, parallel::thread_pool& pool)
+{
+  const uvec2 source_size(source.size());
+  if (size.x == 0 || size.y == 0 || source_size.x == 0 || source_size.y == 0)
+  {
+    throw std::runtime_error(std::string("Cannot resample an empty height field"));
+  }
+
+  const vec2 step(node_step(source_size.x, size.x), node_step(source_size.y, size.y));
+  height_field::ptr result(new height_field(size, source.resolution() * step));
+
+  const taps x_taps(make_taps(source_size.x, size.x, filter));
+  const taps y_taps(make_taps(source_size.y, size.y, filter));
+
+  const unsigned band_count = (size.y + band_rows - 1) / band_rows;
+  pool.parallel_for(band_count, [&](const unsigned band)
+  {
+    std::vector<float> column(source_size.x);
+    std::vector<const float*> rows;
+    const unsigned y_end = std::min((band + 1) * band_rows, size.y);
+    for (unsigned y = band * band_rows; y < y_end; ++y)
+    {
+      rows.resize(y_taps.count[y]);
+      for (unsigned k = 0; k < y_taps.count[y]; ++k)
+      {
+        rows[k] = &source(uvec2(0, y_taps.first[y] + k));
+      }
+      combine_rows(&rows[0], &y_taps.weights[y_taps.offset[y]], y_taps.count[y], source_size.x, filter, &column[0]);
+      resample_row(&column[0], x_taps, filter, &(*result)(uvec2(0, y)));
+    }
+  });
+  return result;
+}
+
+std::vector<height_field::ptr> downsample_chain(const height_field& source, const resample_filter::Enum filter, const unsigned min_size, parallel::thread_pool& pool)
+{
+  std::vector<height_field::ptr> levels;
+  const height_field* level = &source;
+  while (level->size().x > std::max(min_size, 1u) || level->size().y > std::max(min_size, 1u))
+  {
+    const uvec2 size((level->size() + 1u) / 2u);
+    levels.push_back(resample(*level, size, filter, pool));
+    level = levels.back().get();
+  }
+  return levels;
+}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+#include "types.h"
+#include "height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// resizing of height fields
+// samples are nodes like everywhere else: output x sits on source x * step with step = (source size - 1) / (size - 1),
+// so the first and last samples keep their world positions, the resolution is scaled by step
+// box averages the source cells within step / 2 of the output node, min and max take the nodes under it
+  struct resample_filter
+  {
+    enum Enum
+    {
+      box        // area average
+      , lanczos  // Lanczos 3, sharper, can overshoot
+      , min      // lowest sample under the output sample, conservative for collision
+      , max      // highest sample under the output sample, conservative for occlusion
+    };
+  };
+
+  height_field::ptr resample(const height_field& source, const uvec2& size, const resample_filter::Enum filter, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+  // halves the size until both sides are at most min_size
+  // level i + 1 is resampled from level i, the first level is half the size of source
+  std::vector<height_field::ptr> downsample_chain(const height_field& source, const resample_filter::Enum filter, const unsigned min_size = 1, parallel::thread_pool& pool = parallel::thread_pool::instance());
+}
@@ -11,6 +11,8 @@ shader_program::shader_program(const std::string name)
   , m_fragment_shader(0)
   , m_need_normal_matrix(false)
   , m_need_height_field(false)
+  , m_need_normal_field(false)
+  , m_need_shading_field(false)
   , m_name(name)
 {}
 
@@ -129,6 +131,26 @@ bool shader_program::need_height_field() const
   return m_need_height_field;
 }
 
+void shader_program::set_need_normal_field(const bool v)
+{
+  m_need_normal_field = v;
+}
+
+bool shader_program::need_normal_field() const
+{
+  return m_need_normal_field;
+}
+
+void shader_program::set_need_shading_field(const bool v)
+{
+  m_need_shading_field = v;
+}
+
+bool shader_program::need_shading_field() const
+{
+  return m_need_shading_field;
+}
+
 void shader_program::set_need_model_view_matrix(const bool v)
 {
   m_need_model_view_matrix = v;
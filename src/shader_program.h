@@ -46,6 +46,10 @@ public:
   bool need_normal_matrix() const;
   void set_need_height_field(const bool v);
   bool need_height_field() const;
+  void set_need_normal_field(const bool v);
+  bool need_normal_field() const;
+  void set_need_shading_field(const bool v);
+  bool need_shading_field() const;
   void set_need_light_position(const bool v);
   bool need_light_position() const;
   void set_need_model_view_matrix(const bool v);
@@ -79,6 +83,8 @@ private:
   std::map<attribute_kind::Enum, unsigned> m_attribute_location_table;
 
   bool m_need_height_field;
+  bool m_need_normal_field;
+  bool m_need_shading_field;
 
   bool m_need_normal_matrix;
   bool m_need_model_view_matrix;
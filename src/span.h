@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// non-owning view of a contiguous array, the subset of std::span the batch apis need
+template<typename T>
+class span
+{
+public:
+  using value_type = T;
+  using iterator = T*;
+
+public:
+  span()
+    : m_data(nullptr)
+    , m_size(0)
+  { }
+
+  span(T* data, const std::size_t size)
+    : m_data(data)
+    , m_size(size)
+  { }
+
+  // only where U* converts to T*, so overloads on the element type are not ambiguous
+  template<typename U, typename A, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+  span(std::vector<U, A>& v)
+    : m_data(v.data())
+    , m_size(v.size())
+  { }
+
+  template<typename U, typename A, typename = typename std::enable_if<std::is_convertible<const U*, T*>::value>::type>
+  span(const std::vector<U, A>& v)
+    : m_data(v.data())
+    , m_size(v.size())
+  { }
+
+  // span<T> converts to span<const T>
+  template<typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+  span(const span<U>& other)
+    : m_data(other.data())
+    , m_size(other.size())
+  { }
+
+  T* data() const
+  {
+    return m_data;
+  }
+
+  std::size_t size() const
+  {
+    return m_size;
+  }
+
+  bool empty() const
+  {
+    return m_size == 0;
+  }
+
+  T& operator[](const std::size_t i) const
+  {
+    return m_data[i];
+  }
+
+  iterator begin() const
+  {
+    return m_data;
+  }
+
+  iterator end() const
+  {
+    return m_data + m_size;
+  }
+
+  span subspan(const std::size_t offset, const std::size_t count) const
+  {
+    return span(m_data + offset, count);
+  }
+
+private:
+  T* m_data;
+  std::size_t m_size;
+};
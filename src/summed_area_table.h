@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "field.h"
+#include "span.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// sum, mean and variance of any rectangle of a field in constant time
+// T must convert to double
+// the tables hold the prefix sums of (value - offset) and its square in double with Kahan summation,
+// the offset is the mean of the field and keeps the variance from cancelling out on large heights
+// two doubles per sample, 16 bytes per sample of the source
+  template<typename T>
+  class summed_area_table
+  {
+  public:
+    using ptr = std::shared_ptr<summed_area_table>;
+
+    struct window_stats
+    {
+      double sum;
+      double mean;
+      double variance;
+    };
+
+  public:
+    template<typename Layout>
+    summed_area_table(const field<T, Layout>& source, parallel::thread_pool& pool = parallel::thread_pool::instance())
+      : m_size(source.size())
+      , m_offset(0.0)
+      , m_sums(source.size() + 1u)
+      , m_squares(source.size() + 1u)
+    {
+      if (m_size.x == 0 || m_size.y == 0)
+      {
+        return;
+      }
+
+      // offset
+      {
+        std::vector<double> row_sums(m_size.y);
+        pool.parallel_for(m_size.y, [&](const unsigned y)
+        {
+          kahan sum;
+          for (unsigned x = 0; x < m_size.x; ++x)
+          {
+            sum.add(static_cast<double>(source(uvec2(x, y))));
+          }
+          row_sums[y] = sum.value();
+        });
+
+        kahan sum;
+        for (const double s : row_sums)
+        {
+          sum.add(s);
+        }
+        m_offset = sum.value() / (static_cast<double>(m_size.x) * m_size.y);
+      }
+
+      // pass 1, prefix sums along the rows
+      pool.parallel_for(m_size.y, [&](const unsigned y)
+      {
+        double* sums = &m_sums(uvec2(0, y + 1));
+        double* squares = &m_squares(uvec2(0, y + 1));
+        kahan sum;
+        kahan square;
+        for (unsigned x = 0; x < m_size.x; ++x)
+        {
+          const double v = static_cast<double>(source(uvec2(x, y))) - m_offset;
+          sum.add(v);
+          square.add(v * v);
+          sums[x + 1] = sum.value();
+          squares[x + 1] = square.value();
+        }
+      });
+
+      // pass 2, prefix sums along the columns, in strips of columns so the rows are read contiguously
+      const unsigned width = m_size.x + 1;
+      const unsigned strip_width = 256;
+      pool.parallel_for((width + strip_width - 1) / strip_width, [&](const unsigned strip)
+      {
+        const unsigned x_begin = strip * strip_width;
+        const unsigned x_end = std::min(x_begin + strip_width, width);
+        std::vector<kahan> sums(x_end - x_begin);
+        std::vector<kahan> squares(x_end - x_begin);
+        for (unsigned y = 1; y <= m_size.y; ++y)
+        {
+          double* sum_row = &m_sums(uvec2(0, y));
+          double* square_row = &m_squares(uvec2(0, y));
+          for (unsigned x = x_begin; x < x_end; ++x)
+          {
+            sums[x - x_begin].add(sum_row[x]);
+            squares[x - x_begin].add(square_row[x]);
+            sum_row[x] = sums[x - x_begin].value();
+            square_row[x] = squares[x - x_begin].value();
+          }
+        }
+      });
+    }
+
+    const uvec2& size() const
+    {
+      return m_size;
+    }
+
+    // [begin, end) is clipped to the field, empty windows have a sum, mean and variance of 0
+    double sum(const uvec2& begin, const uvec2& end) const
+    {
+      const region r(clip(begin, end));
+      return table_sum(m_sums, r) + m_offset * count(r);
+    }
+
+    double mean(const uvec2& begin, const uvec2& end) const
+    {
+      const region r(clip(begin, end));
+      const double n = count(r);
+      return n > 0.0 ? table_sum(m_sums, r) / n + m_offset : 0.0;
+    }
+
+    // population variance
+    double variance(const uvec2& begin, const uvec2& end) const
+    {
+      return stats(begin, end).variance;
+    }
+
+    window_stats stats(const uvec2& begin, const uvec2& end) const
+    {
+      const region r(clip(begin, end));
+      const double n = count(r);
+      window_stats s = { 0.0, 0.0, 0.0 };
+      if (n > 0.0)
+      {
+        const double shifted_mean = table_sum(m_sums, r) / n;
+        s.mean = shifted_mean + m_offset;
+        s.sum = s.mean * n;
+        s.variance = std::max(table_sum(m_squares, r) / n - shifted_mean * shifted_mean, 0.0);
+      }
+      return s;
+    }
+
+    void stats(span<const region> windows, span<window_stats> out, parallel::thread_pool& pool = parallel::thread_pool::instance()) const
+    {
+      if (out.size() < windows.size())
+      {
+        throw std::runtime_error(std::string("stats output is shorter than the windows"));
+      }
+
+      const std::size_t chunk_size = 4096;
+      const unsigned chunk_count = static_cast<unsigned>((windows.size() + chunk_size - 1) / chunk_size);
+      pool.parallel_for(chunk_count, [&](const unsigned chunk)
+      {
+        const std::size_t end = std::min((chunk + 1) * chunk_size, windows.size());
+        for (std::size_t i = chunk * chunk_size; i < end; ++i)
+        {
+          out[i] = stats(windows[i].begin, windows[i].end);
+        }
+      });
+    }
+
+  private:
+    // compensated summation, keeps the prefix sums exact to about 1e-16 relative over any field size
+    class kahan
+    {
+    public:
+      kahan()
+        : m_sum(0.0)
+        , m_compensation(0.0)
+      { }
+
+      void add(const double v)
+      {
+        const double y = v - m_compensation;
+        const double t = m_sum + y;
+        m_compensation = (t - m_sum) - y;
+        m_sum = t;
+      }
+
+      double value() const
+      {
+        return m_sum;
+      }
+
+    private:
+      double m_sum;
+      double m_compensation;
+    };
+
+    region clip(const uvec2& begin, const uvec2& end) const
+    {
+      const uvec2 clipped_end(glm::min(end, m_size));
+      const region r = { glm::min(begin, clipped_end), clipped_end };
+      return r;
+    }
+
+    static double count(const region& r)
+    {
+      return static_cast<double>(r.end.x - r.begin.x) * (r.end.y - r.begin.y);
+    }
+
+    static double table_sum(const field<double>& table, const region& r)
+    {
+      return table(r.end) - table(uvec2(r.begin.x, r.end.y)) - table(uvec2(r.end.x, r.begin.y)) + table(r.begin);
+    }
+
+  private:
+    uvec2 m_size;
+    double m_offset;
+    field<double> m_sums;
+    field<double> m_squares;
+  };
+
+// out(pos) is the mean of the (2 radius + 1)^2 window around pos, clipped at the border
+// out must have the size of in
+  template<typename T, typename Layout>
+  void box_filter(const field<T, Layout>& in, field<T, Layout>& out, const unsigned radius, parallel::thread_pool& pool = parallel::thread_pool::instance())
+  {
+    if (out.size() != in.size())
+    {
+      throw std::runtime_error(std::string("field size mismatch"));
+    }
+
+    const summed_area_table<T> table(in, pool);
+    const uvec2 size(in.size());
+    pool.parallel_for(size.y, [&](const unsigned y)
+    {
+      for (unsigned x = 0; x < size.x; ++x)
+      {
+        const uvec2 pos(x, y);
+        const uvec2 begin(glm::max(pos, uvec2(radius)) - radius);
+        out(pos) = static_cast<T>(table.mean(begin, pos + radius + 1u));
+      }
+    });
+  }
+}
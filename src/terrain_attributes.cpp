@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
+
+#include "terrain_attributes.h"
+
+namespace terrain
+{
+namespace
+{
+const float pi = 3.14159265359f;
+const float half_pi = 1.57079632679f;
+const float two_pi = 6.28318530718f;
+
+// squared gradients below are flat
+const float flat_gradient = 1e-12f;
+
+// minimax polynomial for atan on [-1, 1], max error about 1e-5 radians
+const float atan_c1 = 0.99997726f;
+const float atan_c3 = -0.33262347f;
+const float atan_c5 = 0.19354346f;
+const float atan_c7 = -0.11643287f;
+const float atan_c9 = 0.05265332f;
+const float atan_c11 = -0.01172120f;
+
+// tiles of whole rows, keep the three input rows and the output rows in cache
+const uvec2 tile_size(1024, 32);
+
+// the output rows of one row of samples, null where not requested
+struct attribute_rows
+{
+  float* slope;
+  float* aspect;
+  float* plan;
+  float* profile;
+  float* roughness;
+};
+
+// the scalar and the sse2 path evaluate the same expressions in the same order
+
+float atan_unit(const float a)
+{
+  const float a2 = a * a;
+  return a * (atan_c1 + a2 * (atan_c3 + a2 * (atan_c5 + a2 * (atan_c7 + a2 * (atan_c9 + a2 * atan_c11)))));
+}
+
+// angle of (x, y) in [0, 2 pi)
+float angle(const float y, const float x)
+{
+  const float ax = std::abs(x);
+  const float ay = std::abs(y);
+  float r = atan_unit(std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f));
+  r = ay > ax ? half_pi - r : r;
+  r = x < 0.0f ? pi - r : r;
+  r = y < 0.0f ? -r : r;
+  return r < 0.0f ? r + two_pi : r;
+}
+
+// p, q first and r, s, t second derivatives, d2 the summed squared differences to the neighbours
+void attributes(const float p, const float q, const float r, const float s, const float t, const float d2, const attribute_rows& out, const unsigned x)
+{
+  const float w = p * p + q * q;
+  const bool flat = w < flat_gradient;
+  if (out.slope)
+  {
+    const float g = std::sqrt(w);
+    out.slope[x] = g > 1.0f ? half_pi - atan_unit(1.0f / g) : atan_unit(g);
+  }
+  if (out.aspect)
+  {
+    out.aspect[x] = flat ? -1.0f : angle(-q, -p);
+  }
+  if (out.plan)
+  {
+    const float w_safe = flat ? 1.0f : w;
+    out.plan[x] = flat ? 0.0f : -(q * q * r - 2.0f * p * q * s + p * p * t) / (w_safe * std::sqrt(w_safe));
+  }
+  if (out.profile)
+  {
+    const float w_safe = flat ? 1.0f : w;
+    const float v = 1.0f + w;
+    out.profile[x] = flat ? 0.0f : -(p * p * r + 2.0f * p * q * s + q * q * t) / (w_safe * (v * std::sqrt(v)));
+  }
+  if (out.roughness)
+  {
+    out.roughness[x] = std::sqrt(d2);
+  }
+}
+
+#ifdef TERRAIN_SSE2
+__m128 select(const __m128 mask, const __m128 a, const __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+__m128 atan_unit(const __m128 a)
+{
+  const __m128 a2 = _mm_mul_ps(a, a);
+  __m128 v = _mm_add_ps(_mm_set1_ps(atan_c9), _mm_mul_ps(a2, _mm_set1_ps(atan_c11)));
+  v = _mm_add_ps(_mm_set1_ps(atan_c7), _mm_mul_ps(a2, v));
+  v = _mm_add_ps(_mm_set1_ps(atan_c5), _mm_mul_ps(a2, v));
+  v = _mm_add_ps(_mm_set1_ps(atan_c3), _mm_mul_ps(a2, v));
+  v = _mm_add_ps(_mm_set1_ps(atan_c1), _mm_mul_ps(a2, v));
+  return _mm_mul_ps(a, v);
+}
+
+__m128 angle(const __m128 y, const __m128 x)
+{
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 ax = _mm_andnot_ps(sign, x);
+  const __m128 ay = _mm_andnot_ps(sign, y);
+  __m128 r = atan_unit(_mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f))));
+  r = select(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(half_pi), r), r);
+  r = select(_mm_cmplt_ps(x, zero), _mm_sub_ps(_mm_set1_ps(pi), r), r);
+  r = select(_mm_cmplt_ps(y, zero), _mm_xor_ps(sign, r), r);
+  return select(_mm_cmplt_ps(r, zero), _mm_add_ps(r, _mm_set1_ps(two_pi)), r);
+}
+
+void attributes(const __m128 p, const __m128 q, const __m128 r, const __m128 s, const __m128 t, const __m128 d2, const attribute_rows& out, const unsigned x)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 w = _mm_add_ps(_mm_mul_ps(p, p), _mm_mul_ps(q, q));
+  const __m128 flat = _mm_cmplt_ps(w, _mm_set1_ps(flat_gradient));
+  const __m128 w_safe = select(flat, one, w);
+  if (out.slope)
+  {
+    const __m128 g = _mm_sqrt_ps(w);
+    const __m128 steep = _mm_sub_ps(_mm_set1_ps(half_pi), atan_unit(_mm_div_ps(one, _mm_max_ps(g, one))));
+    _mm_storeu_ps(out.slope + x, select(_mm_cmpgt_ps(g, one), steep, atan_unit(g)));
+  }
+  if (out.aspect)
+  {
+    _mm_storeu_ps(out.aspect + x, select(flat, _mm_set1_ps(-1.0f), angle(_mm_xor_ps(sign, q), _mm_xor_ps(sign, p))));
+  }
+  if (out.plan)
+  {
+    const __m128 pqs2 = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(two, p), q), s);
+    const __m128 n = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(q, q), r), pqs2), _mm_mul_ps(_mm_mul_ps(p, p), t));
+    const __m128 c = _mm_xor_ps(sign, _mm_div_ps(n, _mm_mul_ps(w_safe, _mm_sqrt_ps(w_safe))));
+    _mm_storeu_ps(out.plan + x, _mm_andnot_ps(flat, c));
+  }
+  if (out.profile)
+  {
+    const __m128 pqs2 = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(two, p), q), s);
+    const __m128 n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, p), r), pqs2), _mm_mul_ps(_mm_mul_ps(q, q), t));
+    const __m128 v = _mm_add_ps(one, w);
+    const __m128 c = _mm_xor_ps(sign, _mm_div_ps(n, _mm_mul_ps(w_safe, _mm_mul_ps(v, _mm_sqrt_ps(v)))));
+    _mm_storeu_ps(out.profile + x, _mm_andnot_ps(flat, c));
+  }
+  if (out.roughness)
+  {
+    _mm_storeu_ps(out.roughness + x, _mm_sqrt_ps(d2));
+  }
+}
+#endif
+
+void attributes_row(const height_field& heights, const unsigned y, const unsigned x_begin, const unsigned x_end, const attribute_rows& out)
+{
+  const uvec2 size(heights.size());
+  const vec2 spacing(heights.resolution());
+  const unsigned y0 = y > 0 ? y - 1 : y;
+  const unsigned y1 = y + 1 < size.y ? y + 1 : y;
+  const float* up = &heights(uvec2(0, y0));
+  const float* row = &heights(uvec2(0, y));
+  const float* down = &heights(uvec2(0, y1));
+
+  // across the border the first derivative is one-sided and the second one is 0
+  const float inv_dy1 = y1 > y0 ? 1.0f / (static_cast<float>(y1 - y0) * spacing.y) : 0.0f;
+  const float inv_dy2 = y1 - y0 == 2 ? 1.0f / (spacing.y * spacing.y) : 0.0f;
+
+  auto scalar = [&](const unsigned x)
+  {
+    const unsigned x0 = x > 0 ? x - 1 : x;
+    const unsigned x1 = x + 1 < size.x ? x + 1 : x;
+    const float inv_dx1 = x1 > x0 ? 1.0f / (static_cast<float>(x1 - x0) * spacing.x) : 0.0f;
+    const float inv_dx2 = x1 - x0 == 2 ? 1.0f / (spacing.x * spacing.x) : 0.0f;
+
+    const float z = row[x];
+    const float p = (row[x1] - row[x0]) * inv_dx1;
+    const float q = (down[x] - up[x]) * inv_dy1;
+    const float r = (row[x1] - 2.0f * z + row[x0]) * inv_dx2;
+    const float t = (down[x] - 2.0f * z + up[x]) * inv_dy2;
+    const float s = (down[x1] - down[x0] - up[x1] + up[x0]) * (inv_dx1 * inv_dy1);
+
+    float d2 = 0.0f;
+    const float neighbours[8] = { up[x0], up[x], up[x1], row[x0], row[x1], down[x0], down[x], down[x1] };
+    for (const float n : neighbours)
+    {
+      d2 += (n - z) * (n - z);
+    }
+    attributes(p, q, r, s, t, d2, out, x);
+  };
+
+  unsigned x = x_begin;
+  for (; x < x_end && x == 0; ++x)
+  {
+    scalar(x);
+  }
+
+#ifdef TERRAIN_SSE2
+  // interior, 4 samples per step, the nine loads cover the whole stencil
+  const __m128 v_inv_dx1 = _mm_set1_ps(1.0f / (2.0f * spacing.x));
+  const __m128 v_inv_dx2 = _mm_set1_ps(1.0f / (spacing.x * spacing.x));
+  const __m128 v_inv_dy1 = _mm_set1_ps(inv_dy1);
+  const __m128 v_inv_dy2 = _mm_set1_ps(inv_dy2);
+  const __m128 v_inv_dxdy = _mm_set1_ps(1.0f / (2.0f * spacing.x) * inv_dy1);
+  const __m128 two = _mm_set1_ps(2.0f);
+  for (; x + 4 < size.x && x + 4 <= x_end; x += 4)
+  {
+    const __m128 z00 = _mm_loadu_ps(up + x - 1);
+    const __m128 z01 = _mm_loadu_ps(up + x);
+    const __m128 z02 = _mm_loadu_ps(up + x + 1);
+    const __m128 z10 = _mm_loadu_ps(row + x - 1);
+    const __m128 z = _mm_loadu_ps(row + x);
+    const __m128 z12 = _mm_loadu_ps(row + x + 1);
+    const __m128 z20 = _mm_loadu_ps(down + x - 1);
+    const __m128 z21 = _mm_loadu_ps(down + x);
+    const __m128 z22 = _mm_loadu_ps(down + x + 1);
+
+    const __m128 p = _mm_mul_ps(_mm_sub_ps(z12, z10), v_inv_dx1);
+    const __m128 q = _mm_mul_ps(_mm_sub_ps(z21, z01), v_inv_dy1);
+    const __m128 r = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(z12, _mm_mul_ps(two, z)), z10), v_inv_dx2);
+    const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(z21, _mm_mul_ps(two, z)), z01), v_inv_dy2);
+    const __m128 s = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(_mm_sub_ps(z22, z20), z02), z00), v_inv_dxdy);
+
+    __m128 d2 = _mm_setzero_ps();
+    const __m128 neighbours[8] = { z00, z01, z02, z10, z12, z20, z21, z22 };
+    for (const __m128 n : neighbours)
+    {
+      const __m128 d = _mm_sub_ps(n, z);
+      d2 = _mm_add_ps(d2, _mm_mul_ps(d, d));
+    }
+    attributes(p, q, r, s, t, d2, out, x);
+  }
+#endif
+
+  for (; x < x_end; ++x)
+  {
+    scalar(x);
+  }
+}
+
+field<float>::ptr allocate(const unsigned attributes, const terrain_attribute::Enum attribute, const uvec2& size)
+{
+  return (attributes & attribute) ? field<float>::ptr(new field<float>(size)) : field<float>::ptr();
+}
+
+float* row_of(const field<float>::ptr& f, const unsigned y)
+{
+  return f ? &(*f)(uvec2(0, y)) : nullptr;
+}
+}
+
+terrain_attributes compute_attributes(const height_field& heights, const unsigned attributes, parallel::thread_pool& pool)
+{
+  const uvec2 size(heights.size());
+  terrain_attributes result;
+  result.slope = allocate(attributes, terrain_attribute::slope, size);
+  result.aspect = allocate(attributes, terrain_attribute::aspect, size);
+  result.plan_curvature = allocate(attributes, terrain_attribute::plan_curvature, size);
+  result.profile_curvature = allocate(attributes, terrain_attribute::profile_curvature, size);
+  result.roughness = allocate(attributes, terrain_attribute::roughness, size);
+  if ((attributes & terrain_attribute::all) == 0)
+  {
+    return result;
+  }
+
+  parallel::for_each_tile(pool, size, tile_size, [&](const uvec2& begin, const uvec2& end)
+  {
+    for (unsigned y = begin.y; y < end.y; ++y)
+    {
+      attribute_rows out;
+      out.slope = row_of(result.slope, y);
+      out.aspect = row_of(result.aspect, y);
+      out.plan = row_of(result.plan_curvature, y);
+      out.profile = row_of(result.profile_curvature, y);
+      out.roughness = row_of(result.roughness, y);
+      attributes_row(heights, y, begin.x, end.x, out);
+    }
+  });
+  return result;
+}
+}
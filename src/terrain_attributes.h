@@ -0,0 +1,37 @@
+#pragma once
+
+#include "types.h"
+#include "field.h"
+#include "height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+  struct terrain_attribute
+  {
+    enum Enum
+    {
+      slope = 1
+      , aspect = 2
+      , plan_curvature = 4
+      , profile_curvature = 8
+      , roughness = 16
+      , all = 31
+    };
+  };
+
+  // only the requested outputs are allocated, the others stay null
+  struct terrain_attributes
+  {
+    field<float>::ptr slope;             // radians from the horizontal
+    field<float>::ptr aspect;            // radians of the downhill direction counter clockwise from the x axis of the grid, in [0, 2 pi), -1 where flat
+    field<float>::ptr plan_curvature;    // curvature of the contour line, 1 / world unit, positive on ridges, 0 where flat
+    field<float>::ptr profile_curvature; // curvature along the slope, 1 / world unit, positive where convex, 0 where flat
+    field<float>::ptr roughness;         // terrain ruggedness index, root of the summed squared differences to the 8 neighbours
+  };
+
+// all requested attributes in one pass over the heights (a mask of terrain_attribute::Enum)
+// every sample reads its 3x3 neighbourhood once and derives the first and second derivatives (Zevenbergen and Thorne)
+// with the spacing from resolution(), at the border the neighbours are clamped and the derivatives across it are one-sided or 0
+  terrain_attributes compute_attributes(const height_field& heights, const unsigned attributes, parallel::thread_pool& pool = parallel::thread_pool::instance());
+}
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <exception>
+
+#include "thread_pool.h"
+
+namespace parallel
+{
+thread_pool& thread_pool::instance()
+{
+  // the thread calling parallel_for works too, so keep one core for it
+  static thread_pool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1u);
+  return pool;
+}
+
+thread_pool::thread_pool(const unsigned worker_count)
+  : m_pending(0)
+  , m_next_queue(0)
+  , m_stop(false)
+{
+  // one extra queue for tasks submitted from outside the pool
+  for (unsigned i = 0; i < worker_count + 1; ++i)
+  {
+    m_queues.emplace_back(new worker_queue);
+  }
+
+  for (unsigned i = 0; i < worker_count; ++i)
+  {
+    m_workers.emplace_back(&thread_pool::worker_loop, this, i);
+  }
+}
+
+thread_pool::~thread_pool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+
+  for (auto& worker : m_workers)
+  {
+    worker.join();
+  }
+}
+
+unsigned thread_pool::worker_count() const
+{
+  return static_cast<unsigned>(m_workers.size());
+}
+
+void thread_pool::submit(task t)
+{
+  const unsigned index = m_next_queue++ % m_queues.size();
+  {
+    std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+    m_queues[index]->tasks.push_back(std::move(t));
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    ++m_pending;
+  }
+  m_wake.notify_one();
+}
+
+void thread_pool::parallel_for(const unsigned count, const std::function<void(unsigned)>& fn)
+{
+  if (m_workers.empty() || count < 2)
+  {
+    for (unsigned i = 0; i < count; ++i)
+    {
+      fn(i);
+    }
+    return;
+  }
+
+  std::atomic<unsigned> remaining(count);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  for (unsigned i = 0; i < count; ++i)
+  {
+    submit([&, i]()
+    {
+      try
+      {
+        fn(i);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+        {
+          error = std::current_exception();
+        }
+      }
+      --remaining;
+    });
+  }
+
+  // help out instead of blocking, this is what makes nested calls safe
+  const unsigned self = static_cast<unsigned>(m_queues.size() - 1);
+  task t;
+  while (remaining != 0)
+  {
+    if (try_steal(self, t))
+    {
+      t();
+      t = nullptr;
+    }
+    else
+    {
+      std::this_thread::yield();
+    }
+  }
+
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+}
+
+bool thread_pool::try_pop(const unsigned index, task& t)
+{
+  worker_queue& queue(*m_queues[index]);
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty())
+  {
+    return false;
+  }
+  t = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  --m_pending;
+  return true;
+}
+
+bool thread_pool::try_steal(const unsigned thief, task& t)
+{
+  const unsigned queue_count = static_cast<unsigned>(m_queues.size());
+  for (unsigned i = 1; i <= queue_count; ++i)
+  {
+    worker_queue& queue(*m_queues[(thief + i) % queue_count]);
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty())
+    {
+      t = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      --m_pending;
+      return true;
+    }
+  }
+  return false;
+}
+
+void thread_pool::worker_loop(const unsigned index)
+{
+  task t;
+  while (true)
+  {
+    if (try_pop(index, t) || try_steal(index, t))
+    {
+      t();
+      t = nullptr;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_wake_mutex);
+    m_wake.wait(lock, [this]() { return m_stop || m_pending != 0; });
+    if (m_stop && m_pending == 0)
+    {
+      return;
+    }
+  }
+}
+}
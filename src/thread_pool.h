@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+namespace parallel
+{
+// fixed size pool of workers, each with its own task queue
+// idle workers (and threads waiting in parallel_for) steal from the other queues
+class thread_pool
+{
+public:
+  using task = std::function<void()>;
+
+public:
+  static thread_pool& instance();
+
+public:
+  explicit thread_pool(const unsigned worker_count);
+  ~thread_pool();
+
+  unsigned worker_count() const;
+
+  void submit(task t);
+
+  // calls fn(i) for every i in [0, count) and blocks until all calls returned
+  // the calling thread executes tasks as well, so nested calls do not deadlock
+  // the first exception thrown by fn is rethrown here
+  void parallel_for(const unsigned count, const std::function<void(unsigned)>& fn);
+
+private:
+  struct worker_queue
+  {
+    std::mutex mutex;
+    std::deque<task> tasks;
+  };
+
+  bool try_pop(const unsigned index, task& t);
+  bool try_steal(const unsigned thief, task& t);
+  void worker_loop(const unsigned index);
+
+private:
+  std::vector<std::unique_ptr<worker_queue>> m_queues;
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_wake_mutex;
+  std::condition_variable m_wake;
+  std::atomic<unsigned> m_pending;
+  std::atomic<unsigned> m_next_queue;
+  bool m_stop;
+
+private:
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator = (const thread_pool&) = delete;
+};
+
+// splits [0, size) into tiles of tile_size and calls fn(begin, end) for each tile on the pool
+template<class F>
+void for_each_tile(thread_pool& pool, const uvec2& size, const uvec2& tile_size, const F& fn)
+{
+  if (size.x == 0 || size.y == 0)
+  {
+    return;
+  }
+
+  const uvec2 tile_count((size.x + tile_size.x - 1) / tile_size.x, (size.y + tile_size.y - 1) / tile_size.y);
+  pool.parallel_for(tile_count.x * tile_count.y, [&](const unsigned tile)
+  {
+    const uvec2 begin((tile % tile_count.x) * tile_size.x, (tile / tile_count.x) * tile_size.y);
+    const uvec2 end(glm::min(begin + tile_size, size));
+    fn(begin, end);
+  });
+}
+}
@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "tiled_height_field.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+namespace
+{
+// tiled height file, little endian
+// header, then the tiles in row-major tile order, each tile_size * tile_size floats
+struct tiled_height_header
+{
+  char magic[4];            // "THF1"
+  std::uint32_t version;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t tile_size;
+  float resolution[2];
+  std::uint32_t reserved;
+  std::uint64_t data_offset;
+};
+
+const char tiled_height_magic[4] = { 'T', 'H', 'F', '1' };
+const std::uint32_t tiled_height_version = 1;
+}
+
+tiled_height_field::pin::pin(const tiled_height_field& owner, std::vector<tile_ptr>&& tiles)
+  : m_owner(&owner)
+  , m_tiles(std::move(tiles))
+{ }
+
+tiled_height_field::pin::pin(pin&& other)
+  : m_owner(other.m_owner)
+  , m_tiles(std::move(other.m_tiles))
+{
+  other.m_owner = nullptr;
+}
+
+tiled_height_field::pin::~pin()
+{
+  if (m_owner)
+  {
+    m_owner->unpin(m_tiles);
+  }
+}
+
+tiled_height_field::tiled_height_field(const std::string& path, const std::size_t memory_budget)
+  : m_file(path)
+  , m_data_offset(0)
+  , m_tile_size(0)
+  , m_memory_budget(memory_budget)
+{
+  tiled_height_header header;
+  if (m_file.size() < sizeof(header))
+  {
+    throw std::runtime_error(std::string("not a tiled height file: ") + path);
+  }
+  m_file.read(0, sizeof(header), &header);
+
+  if (std::memcmp(header.magic, tiled_height_magic, sizeof(tiled_height_magic)) != 0 || header.version != tiled_height_version || header.tile_size == 0)
+  {
+    throw std::runtime_error(std::string("not a tiled height file: ") + path);
+  }
+
+  m_data_offset = header.data_offset;
+  m_size = uvec2(header.width, header.height);
+  m_resolution = vec2(header.resolution[0], header.resolution[1]);
+  m_tile_size = header.tile_size;
+
+  // in 64 bits, the header values come from the file and the sums and products must not wrap
+  const std::uint64_t tiles_x = (static_cast<std::uint64_t>(header.width) + header.tile_size - 1) / header.tile_size;
+  const std::uint64_t tiles_y = (static_cast<std::uint64_t>(header.height) + header.tile_size - 1) / header.tile_size;
+  const std::uint64_t tile_samples = static_cast<std::uint64_t>(header.tile_size) * header.tile_size;
+  if (tiles_x * tiles_y > std::numeric_limits<unsigned>::max())
+  {
+    throw std::runtime_error(std::string("too many tiles in tiled height file: ") + path);
+  }
+  m_tile_count = uvec2(static_cast<unsigned>(tiles_x), static_cast<unsigned>(tiles_y));
+
+  if (m_data_offset > m_file.size())
+  {
+    throw std::runtime_error(std::string("truncated tiled height file: ") + path);
+  }
+  const std::uint64_t payload = m_file.size() - m_data_offset;
+  if (tile_samples > payload / sizeof(value_t) || tiles_x * tiles_y > payload / (tile_samples * sizeof(value_t)))
+  {
+    throw std::runtime_error(std::string("truncated tiled height file: ") + path);
+  }
+}
+
+tiled_height_field::value_t tiled_height_field::operator()(const uvec2& pos) const
+{
+  const tile_ptr t = get_tile(pos / m_tile_size);
+  return t->values[(pos.x % m_tile_size) + m_tile_size * (pos.y % m_tile_size)];
+}
+
+tiled_height_field::tile_ptr tiled_height_field::get_tile(const uvec2& tile_pos) const
+{
+  const unsigned key = tile_key(tile_pos);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+      ++m_stats.hits;
+      m_lru.splice(m_lru.begin(), m_lru, it->second.lru_position);
+      return it->second.data;
+    }
+    ++m_stats.misses;
+  }
+
+  // read without holding the lock, a racing load of the same tile is dropped in insert
+  const tile_ptr loaded = load_tile(tile_pos);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const tile_ptr result = insert(key, loaded).data;
+  evict();
+  return result;
+}
+
+tiled_height_field::pin tiled_height_field::pin_tiles(const std::vector<uvec2>& tile_positions) const
+{
+  // the hits are pinned right away and released by the pin if a load throws, missing tiles stay null until inserted
+  pin result(*this, std::vector<tile_ptr>(tile_positions.size()));
+  std::vector<unsigned> missing;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (unsigned i = 0; i < tile_positions.size(); ++i)
+    {
+      auto it = m_entries.find(tile_key(tile_positions[i]));
+      if (it != m_entries.end())
+      {
+        ++m_stats.hits;
+        ++it->second.pins;
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru_position);
+        result.m_tiles[i] = it->second.data;
+      }
+      else
+      {
+        ++m_stats.misses;
+        missing.push_back(i);
+      }
+    }
+  }
+
+  std::vector<tile_ptr> loaded(missing.size());
+  parallel::thread_pool::instance().parallel_for(static_cast<unsigned>(missing.size()), [&](const unsigned i)
+  {
+    loaded[i] = load_tile(tile_positions[missing[i]]);
+  });
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (unsigned i = 0; i < missing.size(); ++i)
+  {
+    cache_entry& entry = insert(tile_key(tile_positions[missing[i]]), loaded[i]);
+    ++entry.pins;
+    result.m_tiles[missing[i]] = entry.data;
+  }
+  evict();
+  return result;
+}
+
+void tiled_height_field::set_memory_budget(const std::size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_memory_budget = bytes;
+  evict();
+}
+
+std::size_t tiled_height_field::memory_budget() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_memory_budget;
+}
+
+tiled_height_field::statistics tiled_height_field::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+void tiled_height_field::reset_stats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const std::uint64_t bytes_resident = m_stats.bytes_resident;
+  m_stats = statistics();
+  m_stats.bytes_resident = bytes_resident;
+}
+
+void tiled_height_field::write(const std::string& path, const height_field& field, const unsigned tile_size)
+{
+  if (tile_size == 0)
+  {
+    throw std::runtime_error(std::string("invalid tile size"));
+  }
+
+  tiled_height_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, tiled_height_magic, sizeof(tiled_height_magic));
+  header.version = tiled_height_version;
+  header.width = field.size().x;
+  header.height = field.size().y;
+  header.tile_size = tile_size;
+  header.resolution[0] = field.resolution().x;
+  header.resolution[1] = field.resolution().y;
+  header.data_offset = sizeof(header);
+
+  std::ofstream stream(path.c_str(), std::ios::binary | std::ios::out);
+  if (!stream.is_open())
+  {
+    throw std::runtime_error(std::string("could not open tiled height file: ") + path);
+  }
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  const uvec2 tile_count((field.size().x + tile_size - 1) / tile_size, (field.size().y + tile_size - 1) / tile_size);
+  std::vector<value_t> values(tile_size * tile_size);
+  for (unsigned ty = 0; ty < tile_count.y; ++ty)
+  {
+    for (unsigned tx = 0; tx < tile_count.x; ++tx)
+    {
+      std::fill(values.begin(), values.end(), 0.0f);
+      const uvec2 begin(tx * tile_size, ty * tile_size);
+      const uvec2 end(glm::min(begin + uvec2(tile_size), field.size()));
+      for (unsigned y = begin.y; y < end.y; ++y)
+      {
+        const value_t* row = &field(uvec2(begin.x, y));
+        std::copy(row, row + (end.x - begin.x), &values[(y - begin.y) * tile_size]);
+      }
+      stream.write(reinterpret_cast<const char*>(&values[0]), values.size() * sizeof(value_t));
+    }
+  }
+
+  if (!stream)
+  {
+    throw std::runtime_error(std::string("could not write tiled height file: ") + path);
+  }
+}
+
+unsigned tiled_height_field::tile_key(const uvec2& tile_pos) const
+{
+  if (tile_pos.x >= m_tile_count.x || tile_pos.y >= m_tile_count.y)
+  {
+    throw std::runtime_error(std::string("tile position out of range"));
+  }
+  return tile_pos.x + m_tile_count.x * tile_pos.y;
+}
+
+std::size_t tiled_height_field::tile_bytes() const
+{
+  return static_cast<std::size_t>(m_tile_size) * m_tile_size * sizeof(value_t);
+}
+
+tiled_height_field::tile_ptr tiled_height_field::load_tile(const uvec2& tile_pos) const
+{
+  std::shared_ptr<tile> t(new tile);
+  t->position = tile_pos;
+  t->values.resize(static_cast<std::size_t>(m_tile_size) * m_tile_size);
+  m_file.read(m_data_offset + tile_key(tile_pos) * static_cast<std::uint64_t>(tile_bytes()), tile_bytes(), &t->values[0]);
+  return t;
+}
+
+tiled_height_field::cache_entry& tiled_height_field::insert(const unsigned key, const tile_ptr& loaded) const
+{
+  auto it = m_entries.find(key);
+  if (it != m_entries.end())
+  {
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lru_position);
+    return it->second;
+  }
+
+  m_lru.push_front(key);
+  cache_entry& entry = m_entries[key];
+  entry.data = loaded;
+  entry.lru_position = m_lru.begin();
+  entry.pins = 0;
+  m_stats.bytes_resident += tile_bytes();
+  return entry;
+}
+
+void tiled_height_field::evict() const
+{
+  // the most recently used tile always stays, the caller is about to use it
+  auto it = m_lru.end();
+  while (m_stats.bytes_resident > m_memory_budget && it != m_lru.begin())
+  {
+    --it;
+    if (it == m_lru.begin())
+    {
+      break;
+    }
+
+    auto entry = m_entries.find(*it);
+    if (entry->second.pins != 0)
+    {
+      continue;
+    }
+
+    m_entries.erase(entry);
+    it = m_lru.erase(it);
+    m_stats.bytes_resident -= tile_bytes();
+    ++m_stats.evictions;
+  }
+}
+
+void tiled_height_field::unpin(const std::vector<tile_ptr>& tiles) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const tile_ptr& t : tiles)
+  {
+    if (!t)
+    {
+      continue;
+    }
+    auto it = m_entries.find(tile_key(t->position));
+    if (it != m_entries.end() && it->second.pins != 0)
+    {
+      --it->second.pins;
+    }
+  }
+  evict();
+}
+}
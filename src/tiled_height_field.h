@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+#include "height_field.h"
+#include "file_reader.h"
+
+namespace terrain
+{
+// height field that lives on disk in square tiles
+// decoded tiles are kept in a bounded LRU cache, so the terrain does not have to fit in memory
+// same sampling surface as height_field: operator(), size(), resolution()
+  class tiled_height_field
+  {
+  public:
+    using ptr = std::shared_ptr<tiled_height_field>;
+    using value_t = height_field::value_t;
+
+    // tile_size * tile_size values in row-major order, edge tiles are padded
+    struct tile
+    {
+      uvec2 position;
+      std::vector<value_t> values;
+    };
+    using tile_ptr = std::shared_ptr<const tile>;
+
+    struct statistics
+    {
+      statistics()
+        : hits(0)
+        , misses(0)
+        , evictions(0)
+        , bytes_resident(0)
+      { }
+
+      double hit_rate() const
+      {
+        return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+      }
+
+      std::uint64_t hits;
+      std::uint64_t misses;
+      std::uint64_t evictions;
+      std::uint64_t bytes_resident;
+    };
+
+    // keeps a set of tiles resident until destroyed, the owner must outlive it
+    // pinned tiles are never evicted, even above the memory budget
+    class pin
+    {
+    public:
+      pin(pin&& other);
+      ~pin();
+
+      const std::vector<tile_ptr>& tiles() const
+      {
+        return m_tiles;
+      }
+
+    private:
+      friend class tiled_height_field;
+      pin(const tiled_height_field& owner, std::vector<tile_ptr>&& tiles);
+
+    private:
+      const tiled_height_field* m_owner;
+      std::vector<tile_ptr> m_tiles;
+
+    private:
+      pin(const pin&) = delete;
+      pin& operator = (const pin&) = delete;
+    };
+
+  public:
+    tiled_height_field(const std::string& path, const std::size_t memory_budget);
+
+    // locks the cache on every call, bulk operations should work on tiles
+    value_t operator()(const uvec2& pos) const;
+
+    const uvec2& size() const
+    {
+      return m_size;
+    }
+
+    const vec2& resolution() const
+    {
+      return m_resolution;
+    }
+
+    unsigned tile_size() const
+    {
+      return m_tile_size;
+    }
+
+    const uvec2& tile_count() const
+    {
+      return m_tile_count;
+    }
+
+    tile_ptr get_tile(const uvec2& tile_pos) const;
+
+    // loads the missing tiles in parallel and keeps all of them resident while the pin lives
+    pin pin_tiles(const std::vector<uvec2>& tile_positions) const;
+
+    void set_memory_budget(const std::size_t bytes);
+    std::size_t memory_budget() const;
+
+    statistics stats() const;
+    void reset_stats();
+
+  public:
+    static void write(const std::string& path, const height_field& field, const unsigned tile_size);
+
+  private:
+    struct cache_entry
+    {
+      tile_ptr data;
+      std::list<unsigned>::iterator lru_position;
+      unsigned pins;
+    };
+
+    unsigned tile_key(const uvec2& tile_pos) const;
+    std::size_t tile_bytes() const;
+    tile_ptr load_tile(const uvec2& tile_pos) const;
+    // inserts or finds the tile, the cache mutex must be held
+    cache_entry& insert(const unsigned key, const tile_ptr& loaded) const;
+    void evict() const;
+    void unpin(const std::vector<tile_ptr>& tiles) const;
+
+  private:
+    io::file_reader m_file;
+    std::uint64_t m_data_offset;
+    uvec2 m_size;
+    vec2 m_resolution;
+    unsigned m_tile_size;
+    uvec2 m_tile_count;
+
+    mutable std::mutex m_mutex;
+    mutable std::list<unsigned> m_lru; // most recently used first
+    mutable std::unordered_map<unsigned, cache_entry> m_entries;
+    mutable statistics m_stats;
+    std::size_t m_memory_budget;
+  };
+}
@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "resampler.h"
+#include "tiled_pyramid.h"
+
+namespace terrain
+{
+namespace
+{
+// tiled pyramid file, little endian
+// header, level table, tile index (levels in order, tiles row-major within a level), then the tiles
+struct pyramid_header
+{
+  char magic[4];            // "TPF1"
+  std::uint32_t version;
+  std::uint32_t tile_size;
+  std::uint32_t level_count;
+  float max_error;
+  std::uint32_t reserved;
+};
+
+struct pyramid_level
+{
+  std::uint32_t width;
+  std::uint32_t height;
+  float resolution[2];
+};
+
+struct pyramid_tile
+{
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+const char pyramid_magic[4] = { 'T', 'P', 'F', '1' };
+const std::uint32_t pyramid_version = 1;
+const unsigned max_levels = 32;
+
+// first byte of every tile
+const std::uint8_t tile_raw = 0;
+const std::uint8_t tile_lerc = 1;
+
+// lerc tile: the byte above, float min, uint32 nan code, uint8 bits per code, then the codes packed lsb first
+// sample = min + code * 2 * max_error, the nan code (if not no_nan) stands for NaN
+const std::size_t lerc_header_size = 1 + 4 + 4 + 1;
+const std::uint32_t no_nan = 0xffffffffu;
+// codes stay well inside the 32 bits the packer handles
+const double max_code = 1073741824.0;
+
+unsigned bit_width(std::uint32_t v)
+{
+  unsigned bits = 0;
+  while (v)
+  {
+    ++bits;
+    v >>= 1;
+  }
+  return bits;
+}
+
+void encode_raw(const float* values, const std::size_t count, std::vector<std::uint8_t>& out)
+{
+  out.resize(1 + count * sizeof(float));
+  out[0] = tile_raw;
+  std::memcpy(&out[1], values, count * sizeof(float));
+}
+
+void encode_tile(const float* values, const std::size_t count, const tiled_pyramid::codec::Enum c, const float max_error, std::vector<std::uint8_t>& out)
+{
+  const double step = 2.0 * max_error;
+  if (c == tiled_pyramid::codec::raw || !(step > 0.0))
+  {
+    encode_raw(values, count, out);
+    return;
+  }
+
+  float min = std::numeric_limits<float>::infinity();
+  float max = -std::numeric_limits<float>::infinity();
+  bool has_nan = false;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    if (std::isnan(values[i]))
+    {
+      has_nan = true;
+      continue;
+    }
+    min = std::min(min, values[i]);
+    max = std::max(max, values[i]);
+  }
+  if (min > max)
+  {
+    // only NaN
+    min = max = 0.0f;
+  }
+
+  const double range = std::floor((static_cast<double>(max) - min) / step + 0.5);
+  if (!(range < max_code))
+  {
+    encode_raw(values, count, out);
+    return;
+  }
+
+  const std::uint32_t max_value = static_cast<std::uint32_t>(range);
+  const std::uint32_t nan_code = has_nan ? max_value + 1 : no_nan;
+  const std::uint8_t bits = static_cast<std::uint8_t>(bit_width(has_nan ? nan_code : max_value));
+  const std::size_t payload = (count * bits + 7) / 8;
+  if (lerc_header_size + payload >= 1 + count * sizeof(float))
+  {
+    encode_raw(values, count, out);
+    return;
+  }
+
+  out.assign(lerc_header_size + payload, 0);
+  out[0] = tile_lerc;
+  std::memcpy(&out[1], &min, sizeof(min));
+  std::memcpy(&out[5], &nan_code, sizeof(nan_code));
+  out[9] = bits;
+
+  std::uint8_t* dst = &out[lerc_header_size];
+  std::uint64_t acc = 0;
+  unsigned filled = 0;
+  for (std::size_t i = 0; i < count && bits > 0; ++i)
+  {
+    const std::uint32_t code = std::isnan(values[i]) ? nan_code : static_cast<std::uint32_t>(std::floor((static_cast<double>(values[i]) - min) / step + 0.5));
+    acc |= static_cast<std::uint64_t>(code) << filled;
+    filled += bits;
+    while (filled >= 8)
+    {
+      *dst++ = static_cast<std::uint8_t>(acc);
+      acc >>= 8;
+      filled -= 8;
+    }
+  }
+  if (filled > 0)
+  {
+    *dst = static_cast<std::uint8_t>(acc);
+  }
+}
+
+void decode_tile(const std::uint8_t* in, const std::size_t size, const float max_error, float* out, const std::size_t count)
+{
+  if (size >= 1 && in[0] == tile_raw && size == 1 + count * sizeof(float))
+  {
+    std::memcpy(out, in + 1, count * sizeof(float));
+    return;
+  }
+  if (size < lerc_header_size || in[0] != tile_lerc)
+  {
+    throw std::runtime_error(std::string("corrupt pyramid tile"));
+  }
+
+  float min;
+  std::uint32_t nan_code;
+  std::memcpy(&min, in + 1, sizeof(min));
+  std::memcpy(&nan_code, in + 5, sizeof(nan_code));
+  const unsigned bits = in[9];
+  if (bits > 31 || size < lerc_header_size + (count * bits + 7) / 8)
+  {
+    throw std::runtime_error(std::string("corrupt pyramid tile"));
+  }
+
+  const double step = 2.0 * max_error;
+  const std::uint8_t* src = in + lerc_header_size;
+  const std::uint64_t mask = (std::uint64_t(1) << bits) - 1;
+  std::uint64_t acc = 0;
+  unsigned available = 0;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    while (available < bits)
+    {
+      acc |= static_cast<std::uint64_t>(*src++) << available;
+      available += 8;
+    }
+    const std::uint32_t code = static_cast<std::uint32_t>(acc & mask);
+    acc >>= bits;
+    available -= bits;
+    out[i] = code == nan_code ? std::numeric_limits<float>::quiet_NaN() : static_cast<float>(min + code * step);
+  }
+}
+
+// tile of field with the last row and column repeated into the padding, that keeps the value range of edge tiles tight
+void gather_tile(const height_field& field, const uvec2& begin, const unsigned tile_size, float* out)
+{
+  const uvec2 end(glm::min(begin + uvec2(tile_size), field.size()));
+  for (unsigned y = 0; y < tile_size; ++y)
+  {
+    const float* row = &field(uvec2(begin.x, std::min(begin.y + y, end.y - 1)));
+    float* dst = out + static_cast<std::size_t>(y) * tile_size;
+    std::copy(row, row + (end.x - begin.x), dst);
+    std::fill(dst + (end.x - begin.x), dst + tile_size, row[end.x - begin.x - 1]);
+  }
+}
+}
+
+void tiled_pyramid::write(const std::string& path, const height_field& source, const unsigned tile_size, const codec::Enum c, const float max_error, parallel::thread_pool& pool)
+{
+  if (tile_size == 0 || source.size().x == 0 || source.size().y == 0)
+  {
+    throw std::runtime_error(std::string("invalid tiled pyramid parameter(s)"));
+  }
+  if (!(max_error >= 0.0f) || (c == codec::lerc && max_error == 0.0f))
+  {
+    throw std::runtime_error(std::string("lerc needs a positive max_error"));
+  }
+
+  const std::vector<height_field::ptr> overviews = downsample_chain(source, resample_filter::box, tile_size, pool);
+  std::vector<const height_field*> levels(1, &source);
+  for (const height_field::ptr& o : overviews)
+  {
+    levels.push_back(o.get());
+  }
+  if (levels.size() > max_levels)
+  {
+    throw std::runtime_error(std::string("too many pyramid levels"));
+  }
+
+  pyramid_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, pyramid_magic, sizeof(pyramid_magic));
+  header.version = pyramid_version;
+  header.tile_size = tile_size;
+  header.level_count = static_cast<std::uint32_t>(levels.size());
+  header.max_error = c == codec::lerc ? max_error : 0.0f;
+
+  std::vector<pyramid_level> level_table(levels.size());
+  std::size_t tile_total = 0;
+  for (std::size_t l = 0; l < levels.size(); ++l)
+  {
+    level_table[l].width = levels[l]->size().x;
+    level_table[l].height = levels[l]->size().y;
+    level_table[l].resolution[0] = levels[l]->resolution().x;
+    level_table[l].resolution[1] = levels[l]->resolution().y;
+    tile_total += static_cast<std::size_t>((levels[l]->size().x + tile_size - 1) / tile_size) * ((levels[l]->size().y + tile_size - 1) / tile_size);
+  }
+  std::vector<pyramid_tile> index(tile_total);
+
+  std::ofstream stream(path.c_str(), std::ios::binary | std::ios::out);
+  if (!stream.is_open())
+  {
+    throw std::runtime_error(std::string("could not open tiled pyramid file: ") + path);
+  }
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  stream.write(reinterpret_cast<const char*>(&level_table[0]), level_table.size() * sizeof(pyramid_level));
+  const std::uint64_t index_offset = sizeof(header) + level_table.size() * sizeof(pyramid_level);
+  stream.write(reinterpret_cast<const char*>(&index[0]), index.size() * sizeof(pyramid_tile));
+
+  // batches of tiles are encoded on the pool and appended in order, that bounds the encoded data in memory
+  std::uint64_t offset = index_offset + index.size() * sizeof(pyramid_tile);
+  const std::size_t tile_values = static_cast<std::size_t>(tile_size) * tile_size;
+  const unsigned batch_size = std::max(1u, pool.worker_count()) * 8;
+  std::vector<std::vector<std::uint8_t>> encoded(batch_size);
+  std::size_t tile_index = 0;
+  for (const height_field* field : levels)
+  {
+    const uvec2 count((field->size().x + tile_size - 1) / tile_size, (field->size().y + tile_size - 1) / tile_size);
+    const unsigned tiles = count.x * count.y;
+    for (unsigned first = 0; first < tiles; first += batch_size)
+    {
+      const unsigned n = std::min(batch_size, tiles - first);
+      pool.parallel_for(n, [&](const unsigned i)
+      {
+        const unsigned t = first + i;
+        std::vector<float> values(tile_values);
+        gather_tile(*field, uvec2(t % count.x, t / count.x) * tile_size, tile_size, &values[0]);
+        encode_tile(&values[0], tile_values, c, max_error, encoded[i]);
+      });
+
+      for (unsigned i = 0; i < n; ++i)
+      {
+        index[tile_index].offset = offset;
+        index[tile_index].size = encoded[i].size();
+        stream.write(reinterpret_cast<const char*>(&encoded[i][0]), encoded[i].size());
+        offset += encoded[i].size();
+        ++tile_index;
+      }
+    }
+  }
+
+  stream.seekp(static_cast<std::streamoff>(index_offset));
+  stream.write(reinterpret_cast<const char*>(&index[0]), index.size() * sizeof(pyramid_tile));
+  if (!stream)
+  {
+    throw std::runtime_error(std::string("could not write tiled pyramid file: ") + path);
+  }
+}
+
+tiled_pyramid::tiled_pyramid(const std::string& path)
+  : m_file(path)
+  , m_tile_size(0)
+  , m_max_error(0.0f)
+{
+  pyramid_header header;
+  if (m_file.size() < sizeof(header))
+  {
+    throw std::runtime_error(std::string("not a tiled pyramid file: ") + path);
+  }
+  m_file.read(0, sizeof(header), &header);
+  if (std::memcmp(header.magic, pyramid_magic, sizeof(pyramid_magic)) != 0 || header.version != pyramid_version
+    || header.tile_size == 0 || header.level_count == 0 || header.level_count > max_levels)
+  {
+    throw std::runtime_error(std::string("not a tiled pyramid file: ") + path);
+  }
+  m_tile_size = header.tile_size;
+  m_max_error = header.max_error;
+
+  std::vector<pyramid_level> level_table(header.level_count);
+  m_file.read(sizeof(header), level_table.size() * sizeof(pyramid_level), &level_table[0]);
+  unsigned tile_total = 0;
+  for (const pyramid_level& l : level_table)
+  {
+    level_info lvl;
+    lvl.size = uvec2(l.width, l.height);
+    lvl.resolution = vec2(l.resolution[0], l.resolution[1]);
+    lvl.tile_count = (lvl.size + m_tile_size - 1u) / m_tile_size;
+    lvl.first_tile = tile_total;
+    tile_total += lvl.tile_count.x * lvl.tile_count.y;
+    m_levels.push_back(lvl);
+  }
+
+  const std::uint64_t index_offset = sizeof(header) + level_table.size() * sizeof(pyramid_level);
+  if (index_offset + static_cast<std::uint64_t>(tile_total) * sizeof(pyramid_tile) > m_file.size())
+  {
+    throw std::runtime_error(std::string("truncated tiled pyramid file: ") + path);
+  }
+  std::vector<pyramid_tile> index(tile_total);
+  m_file.read(index_offset, index.size() * sizeof(pyramid_tile), &index[0]);
+  for (const pyramid_tile& t : index)
+  {
+    if (t.size == 0 || t.offset + t.size > m_file.size())
+    {
+      throw std::runtime_error(std::string("truncated tiled pyramid file: ") + path);
+    }
+    tile_location entry;
+    entry.offset = t.offset;
+    entry.size = t.size;
+    m_tiles.push_back(entry);
+  }
+}
+
+uvec2 tiled_pyramid::level_size(const unsigned level) const
+{
+  return m_levels.at(level).size;
+}
+
+vec2 tiled_pyramid::level_resolution(const unsigned level) const
+{
+  return m_levels.at(level).resolution;
+}
+
+uvec2 tiled_pyramid::tile_count(const unsigned level) const
+{
+  return m_levels.at(level).tile_count;
+}
+
+const tiled_pyramid::tile_location& tiled_pyramid::location(const unsigned level, const uvec2& tile_pos) const
+{
+  const level_info& l = m_levels.at(level);
+  if (tile_pos.x >= l.tile_count.x || tile_pos.y >= l.tile_count.y)
+  {
+    throw std::runtime_error(std::string("tile position out of range"));
+  }
+  return m_tiles[l.first_tile + tile_pos.y * l.tile_count.x + tile_pos.x];
+}
+
+void tiled_pyramid::read_tile(const unsigned level, const uvec2& tile_pos, value_t* out) const
+{
+  const tile_location& t = location(level, tile_pos);
+  std::vector<std::uint8_t> data(static_cast<std::size_t>(t.size));
+  m_file.read(t.offset, data.size(), &data[0]);
+  decode_tile(&data[0], data.size(), m_max_error, out, static_cast<std::size_t>(m_tile_size) * m_tile_size);
+}
+
+std::vector<tiled_pyramid::value_t> tiled_pyramid::read_tile(const unsigned level, const uvec2& tile_pos) const
+{
+  std::vector<value_t> values(static_cast<std::size_t>(m_tile_size) * m_tile_size);
+  read_tile(level, tile_pos, &values[0]);
+  return values;
+}
+
+height_field::ptr tiled_pyramid::read_level(const unsigned level, parallel::thread_pool& pool) const
+{
+  const level_info& l = m_levels.at(level);
+  height_field::ptr result(new height_field(l.size, l.resolution));
+  pool.parallel_for(l.tile_count.x * l.tile_count.y, [&](const unsigned t)
+  {
+    const uvec2 tile_pos(t % l.tile_count.x, t / l.tile_count.x);
+    const std::vector<value_t> values = read_tile(level, tile_pos);
+    const uvec2 begin(tile_pos * m_tile_size);
+    const uvec2 end(glm::min(begin + uvec2(m_tile_size), l.size));
+    for (unsigned y = begin.y; y < end.y; ++y)
+    {
+      const value_t* src = &values[static_cast<std::size_t>(y - begin.y) * m_tile_size];
+      std::copy(src, src + (end.x - begin.x), &(*result)(uvec2(begin.x, y)));
+    }
+  });
+  return result;
+}
+}
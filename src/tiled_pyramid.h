@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "height_field.h"
+#include "file_reader.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+// height field file with box filtered overview levels, cut into square tiles that are compressed one by one
+// the header holds the level sizes and the offset and byte count of every tile, so any tile of any level
+// is fetched with a single positioned read and decoded on its own
+// level 0 is the source, each level halves the previous one until it fits into a single tile
+  class tiled_pyramid
+  {
+  public:
+    using ptr = std::shared_ptr<tiled_pyramid>;
+    using value_t = height_field::value_t;
+
+    struct codec
+    {
+      enum Enum
+      {
+        raw      // 32 bit floats
+        , lerc   // per tile quantization to a step of 2 * max_error and bit packing, like LERC
+      };
+    };
+
+  public:
+    // tiles are encoded in parallel and written in level order
+    // with lerc every decoded sample is within max_error (plus float rounding) of the source
+    // tiles that would not get smaller are stored raw, NaN samples survive both codecs
+    static void write(const std::string& path, const height_field& source, const unsigned tile_size, const codec::Enum c, const float max_error = 0.0f, parallel::thread_pool& pool = parallel::thread_pool::instance());
+
+    tiled_pyramid(const std::string& path);
+
+    unsigned level_count() const
+    {
+      return static_cast<unsigned>(m_levels.size());
+    }
+
+    uvec2 level_size(const unsigned level) const;
+    vec2 level_resolution(const unsigned level) const;
+    uvec2 tile_count(const unsigned level) const;
+
+    unsigned tile_size() const
+    {
+      return m_tile_size;
+    }
+
+    float max_error() const
+    {
+      return m_max_error;
+    }
+
+    // tile_size * tile_size values in row-major order, edge tiles are padded with their last row and column
+    // safe to call from several threads at once
+    void read_tile(const unsigned level, const uvec2& tile_pos, value_t* out) const;
+    std::vector<value_t> read_tile(const unsigned level, const uvec2& tile_pos) const;
+
+    // the whole level, the tiles are read and decoded in parallel
+    height_field::ptr read_level(const unsigned level, parallel::thread_pool& pool = parallel::thread_pool::instance()) const;
+
+  private:
+    struct level_info
+    {
+      uvec2 size;
+      vec2 resolution;
+      uvec2 tile_count;
+      unsigned first_tile;  // into m_tiles
+    };
+
+    struct tile_location
+    {
+      std::uint64_t offset;
+      std::uint64_t size;
+    };
+
+    const tile_location& location(const unsigned level, const uvec2& tile_pos) const;
+
+  private:
+    io::file_reader m_file;
+    unsigned m_tile_size;
+    float m_max_error;
+    std::vector<level_info> m_levels;
+    std::vector<tile_location> m_tiles;
+  };
+}
@@ -7,11 +7,14 @@
 #pragma warning( pop )
 
 using uvec2 = glm::uvec2;
+using ivec2 = glm::ivec2;
 
 using vec2 = glm::vec2;
 using vec3 = glm::vec3;
 using vec4 = glm::vec4;
 
+using dvec2 = glm::dvec2;
+
 using mat2 = glm::mat2;
 using mat3 = glm::mat3;
 using mat4 = glm::mat4;
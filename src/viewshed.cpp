@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "viewshed.h"
+
+namespace terrain
+{
+namespace
+{
+const float infinity = std::numeric_limits<float>::infinity();
+
+void check_observer(const height_field& heights, const viewshed_observer& observer)
+{
+  if (observer.position.x >= heights.size().x || observer.position.y >= heights.size().y)
+  {
+    throw std::runtime_error(std::string("viewshed observer outside the height field"));
+  }
+}
+
+// calls visit(pos, sight) for every cell within radius of the observer
+// sight is the elevation of the line of sight over the cell, -infinity where nothing can block it
+// buffer receives the elevation that blocks the sight behind each cell of the window
+template<class F>
+void xdraw(const height_field& heights, const viewshed_observer& observer, const unsigned radius, std::vector<float>& buffer, const F& visit)
+{
+  const uvec2 size(heights.size());
+  const uvec2 o(observer.position);
+  const unsigned max_radius = std::max(std::max(o.x, size.x - 1 - o.x), std::max(o.y, size.y - 1 - o.y));
+  const unsigned r_end = radius > 0 ? std::min(radius, max_radius) : max_radius;
+
+  const uvec2 begin(glm::max(o, uvec2(r_end)) - r_end);
+  const uvec2 end(glm::min(o + r_end + 1u, size));
+  const unsigned width = end.x - begin.x;
+  buffer.resize(static_cast<std::size_t>(width) * (end.y - begin.y));
+  auto blocking = [&](const unsigned x, const unsigned y) -> float&
+  {
+    return buffer[(x - begin.x) + static_cast<std::size_t>(width) * (y - begin.y)];
+  };
+
+  const float eye = heights(o) + observer.height;
+  blocking(o.x, o.y) = heights(o);
+  visit(o, -infinity);
+
+  const int ox = static_cast<int>(o.x);
+  const int oy = static_cast<int>(o.y);
+  for (unsigned r = 1; r <= r_end; ++r)
+  {
+    const int ri = static_cast<int>(r);
+    const float previous = static_cast<float>(r - 1) / static_cast<float>(r);
+    const float extend = static_cast<float>(r) / static_cast<float>(r - 1);
+
+    // (dx, dy) on ring r, the sight line crosses ring r - 1 on the side of the larger offset
+    auto cell = [&](const int dx, const int dy)
+    {
+      const unsigned x = static_cast<unsigned>(ox + dx);
+      const unsigned y = static_cast<unsigned>(oy + dy);
+      const float h = heights(uvec2(x, y));
+      float sight = -infinity;
+      if (r > 1)
+      {
+        float behind;
+        if (std::abs(dx) == ri)
+        {
+          const float cy = static_cast<float>(oy) + static_cast<float>(dy) * previous;
+          const unsigned cx = static_cast<unsigned>(ox + (dx > 0 ? ri - 1 : 1 - ri));
+          const unsigned y0 = static_cast<unsigned>(cy);
+          const unsigned y1 = std::min(y0 + 1, end.y - 1);
+          const float f = cy - static_cast<float>(y0);
+          behind = blocking(cx, y0) + f * (blocking(cx, y1) - blocking(cx, y0));
+        }
+        else
+        {
+          const float cx = static_cast<float>(ox) + static_cast<float>(dx) * previous;
+          const unsigned cy = static_cast<unsigned>(oy + (dy > 0 ? ri - 1 : 1 - ri));
+          const unsigned x0 = static_cast<unsigned>(cx);
+          const unsigned x1 = std::min(x0 + 1, end.x - 1);
+          const float f = cx - static_cast<float>(x0);
+          behind = blocking(x0, cy) + f * (blocking(x1, cy) - blocking(x0, cy));
+        }
+        sight = eye + (behind - eye) * extend;
+      }
+      blocking(x, y) = std::max(h, sight);
+      visit(uvec2(x, y), sight);
+    };
+
+    // rows above and below, then the columns left and right without the corners
+    const int x_first = std::max(-ri, -ox);
+    const int x_last = std::min(ri, static_cast<int>(end.x) - 1 - ox);
+    const int y_first = std::max(1 - ri, -oy);
+    const int y_last = std::min(ri - 1, static_cast<int>(end.y) - 1 - oy);
+    if (oy - ri >= 0)
+    {
+      for (int dx = x_first; dx <= x_last; ++dx)
+      {
+        cell(dx, -ri);
+      }
+    }
+    if (oy + ri < static_cast<int>(end.y))
+    {
+      for (int dx = x_first; dx <= x_last; ++dx)
+      {
+        cell(dx, ri);
+      }
+    }
+    if (ox - ri >= 0)
+    {
+      for (int dy = y_first; dy <= y_last; ++dy)
+      {
+        cell(-ri, dy);
+      }
+    }
+    if (ox + ri < static_cast<int>(end.x))
+    {
+      for (int dy = y_first; dy <= y_last; ++dy)
+      {
+        cell(ri, dy);
+      }
+    }
+  }
+}
+}
+
+field<float>::ptr compute_viewshed(const height_field& heights, const viewshed_observer& observer, const unsigned radius)
+{
+  check_observer(heights, observer);
+
+  field<float>::ptr result(new field<float>(heights.size()));
+  for (unsigned y = 0; y < heights.size().y; ++y)
+  {
+    for (unsigned x = 0; x < heights.size().x; ++x)
+    {
+      (*result)(uvec2(x, y)) = infinity;
+    }
+  }
+
+  std::vector<float> buffer;
+  xdraw(heights, observer, radius, buffer, [&](const uvec2& pos, const float sight)
+  {
+    (*result)(pos) = std::max(sight - heights(pos), 0.0f);
+  });
+  return result;
+}
+
+field<std::uint8_t>::ptr visibility(const field<float>& viewshed, const float target_height)
+{
+  field<std::uint8_t>::ptr result(new field<std::uint8_t>(viewshed.size()));
+  for (unsigned y = 0; y < viewshed.size().y; ++y)
+  {
+    for (unsigned x = 0; x < viewshed.size().x; ++x)
+    {
+      const uvec2 pos(x, y);
+      (*result)(pos) = viewshed(pos) <= target_height ? 1 : 0;
+    }
+  }
+  return result;
+}
+
+field<std::uint32_t>::ptr cumulative_viewshed(const height_field& heights
+                                              , span<const viewshed_observer> observers
+                                              , const float target_height
+                                              , const unsigned radius
+                                              , const viewshed_progress_callback& progress
+                                              , parallel::thread_pool& pool)
+{
+  // all of them before any work starts
+  for (const viewshed_observer& observer : observers)
+  {
+    check_observer(heights, observer);
+  }
+
+  const uvec2 size(heights.size());
+  const std::size_t cell_count = static_cast<std::size_t>(size.x) * size.y;
+  std::vector<std::atomic<std::uint32_t>> counts(cell_count);
+  for (std::atomic<std::uint32_t>& count : counts)
+  {
+    count.store(0, std::memory_order_relaxed);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::mutex progress_mutex;
+  std::size_t done = 0;
+
+  pool.parallel_for(static_cast<unsigned>(observers.size()), [&](const unsigned i)
+  {
+    // the window of an observer is allocated per task, the counts are shared
+    std::vector<float> buffer;
+    xdraw(heights, observers[i], radius, buffer, [&](const uvec2& pos, const float sight)
+    {
+      if (heights(pos) + target_height >= sight)
+      {
+        counts[pos.x + static_cast<std::size_t>(size.x) * pos.y].fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    ++done;
+    if (progress)
+    {
+      viewshed_progress p;
+      p.done = done;
+      p.total = observers.size();
+      p.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      progress(p);
+    }
+  });
+
+  field<std::uint32_t>::ptr result(new field<std::uint32_t>(size));
+  pool.parallel_for(size.y, [&](const unsigned y)
+  {
+    for (unsigned x = 0; x < size.x; ++x)
+    {
+      (*result)(uvec2(x, y)) = counts[x + static_cast<std::size_t>(size.x) * y].load(std::memory_order_relaxed);
+    }
+  });
+  return result;
+}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "types.h"
+#include "field.h"
+#include "height_field.h"
+#include "span.h"
+#include "thread_pool.h"
+
+namespace terrain
+{
+  struct viewshed_observer
+  {
+    viewshed_observer(const uvec2& p, const float h)
+      : position(p)
+      , height(h)
+    { }
+
+    uvec2 position;
+    float height; // eye above the ground
+  };
+
+  struct viewshed_progress
+  {
+    std::size_t done;
+    std::size_t total;
+    double seconds;
+
+    // linear estimate from the observers done so far
+    double seconds_remaining() const
+    {
+      return done > 0 ? seconds * static_cast<double>(total - done) / static_cast<double>(done) : 0.0;
+    }
+  };
+
+  using viewshed_progress_callback = std::function<void(const viewshed_progress&)>;
+
+// XDraw line of sight: the cells are visited in square rings around the observer,
+// the sight line of a cell is interpolated from the two cells of the previous ring it passes between
+// O(n) per observer, approximate where the sight line passes far from the grid points
+
+// height above the ground a target must have to be seen from observer, 0 where the ground is visible
+// radius in samples limits the area, 0 covers the whole field, cells outside are infinity
+// throws if the observer is outside the field
+  field<float>::ptr compute_viewshed(const height_field& heights, const viewshed_observer& observer, const unsigned radius = 0);
+
+// 1 where a target of target_height above the ground is visible
+  field<std::uint8_t>::ptr visibility(const field<float>& viewshed, const float target_height);
+
+// number of observers each cell is visible from, the observers run in parallel
+// progress is called after every observer, one call at a time, throws if any observer is outside the field
+  field<std::uint32_t>::ptr cumulative_viewshed(const height_field& heights
+                                                , span<const viewshed_observer> observers
+                                                , const float target_height
+                                                , const unsigned radius = 0
+                                                , const viewshed_progress_callback& progress = viewshed_progress_callback()
+                                                , parallel::thread_pool& pool = parallel::thread_pool::instance());
+}